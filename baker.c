@@ -1,7 +1,15 @@
 #include "common.h"
+#include "log_ring.h"
 
 /*
  * baker.c – proces piekarza: produkuje losowo produkty i dokłada na podajniki (FIFO).
+ *
+ * Piekarzy może być kilku (./baker <id>, --bakers w kierowniku). Każdy wypieka
+ * produkty ze swojego shardu (bakery_baker_owner()[pid] == id). Piekarz, którego
+ * wszystkie podajniki są pełne, przejmuje (CAS właściciela) pusty podajnik
+ * innego piekarza - produkcja przesuwa się tam, gdzie towaru brakuje.
+ * Z --bake=demand zamiast losowania wybiera własny produkt o największym
+ * niedoborze: popyt z liczników klientów w SHM minus zapas (BakeDemand).
  */
 
 static volatile sig_atomic_t g_stop = 0;
@@ -16,10 +24,84 @@ static void handler(int sig) {
     }
 }
 
-int main(void) {
-    setvbuf(stdout, NULL, _IOLBF, 0);
-    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+/* Numery seryjne sztuk z licznika podajnika - unikalne także przy dwóch piekarzach */
+static int next_items(BakeryState* st, int pid, int n) {
+    return atomic_fetch_add_explicit(&bakery_conveyor(st, pid)->next_item, n, memory_order_relaxed);
+}
+
+/* Zwrot niewydanych numerow [first+used, first+n) - udaje sie, gdy nikt nie pobral numerow po nas */
+static void return_items(BakeryState* st, int pid, int first, int n, int used) {
+    int expect = first + n;
+    atomic_compare_exchange_strong_explicit(&bakery_conveyor(st, pid)->next_item, &expect, first + used,
+                                            memory_order_relaxed, memory_order_relaxed);
+}
+
+static int conveyor_has_room(const BakeryState* st, int pid, int qty) {
+    return conveyor_count(st, pid) + qty <= bakery_conveyor(st, pid)->capacity;
+}
+
+/*
+ * Wybór produktu do wypieku: własny z miejscem na partię - losowy albo
+ * (bd != NULL) o największym niedoborze, remisy od losowego; gdy wszystkie
+ * własne są pełne - przejęcie pustego podajnika innego piekarza. -1 = nic do roboty.
+ */
+static int pick_product(BakeryState* st, int id, int qty, const BakeDemand* bd) {
+    int P = st->P;
+    _Atomic int* owner = bakery_baker_owner(st);
+    int first = rand_between(0, P - 1);
+    int best = -1;
+    double best_score = 0.0;
+
+    for (int k = 0; k < P; ++k) {
+        int pid = (first + k) % P;
+        if (atomic_load_explicit(&owner[pid], memory_order_relaxed) == id && conveyor_has_room(st, pid, qty)) {
+            if (!bd) return pid;
+            double score = bake_demand_score(bd, pid, conveyor_count(st, pid));
+            if (best == -1 || score > best_score) {
+                best = pid;
+                best_score = score;
+            }
+        }
+    }
+    if (best != -1) return best;
+
+    for (int k = 0; k < P; ++k) {
+        int pid = (first + k) % P;
+        int cur = atomic_load_explicit(&owner[pid], memory_order_relaxed);
+        if (cur == id || conveyor_count(st, pid) > 0) continue;
+        if (atomic_compare_exchange_strong_explicit(&owner[pid], &cur, id,
+                                                    memory_order_relaxed, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&st->bakers[id].taken_over, 1, memory_order_relaxed);
+            LOGE(PIEKARZ, LOG_INFO, EV_PI_TAKEOVER, id, pid, cur);
+            return pid;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Przerwa między wypiekami (ms symulacji). Zamknięcie sklepu albo ewakuacja
+ * budzi piekarza od razu (control_wait); inne zmiany stanu nie skracają przerwy.
+ * Zwraca 1 gdy sklep przestał działać.
+ */
+static int bake_pause(BakeryState* st, int sem_id, ControlView* ctl, int ms) {
+    long long until = vclock_now_ms() + ms;
+    for (;;) {
+        control_refresh(st, sem_id, -1, ctl);
+        if (!ctl->store_open || ctl->evacuated) return 1;
+        long long left = until - vclock_now_ms();
+        if (left <= 0 || g_stop) return 0;
+        control_wait(st, ctl, (int)left);
+    }
+}
 
+int main(int argc, char** argv) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    int id = argc >= 2 ? atoi(argv[1]) : 0;
+    if (id < 0 || id >= BAKERS_MAX) {
+        fprintf(stderr, "Użycie: baker [id 0..%d]\n", BAKERS_MAX - 1);
+        return EXIT_FAILURE;
+    }
     install_signal_handlers_or_die(handler);
 
     /* Odszukaj IPC */
@@ -27,132 +109,131 @@ int main(void) {
     IpcHandles h;
     memset(&h, 0, sizeof(h));
 
-    h.shm_id = shmget(bakery_ftok_or_die(0x41), sizeof(BakeryState), IPC_PERMS_MIN);
+    h.shm_id = shmget(bakery_ftok_or_die(0x41), 0, IPC_PERMS_MIN);
     if (h.shm_id == -1) DIE_PERROR("shmget(baker)");
 
     h.sem_id = semget(bakery_ftok_or_die(0x42), 0, IPC_PERMS_MIN);
     if (h.sem_id == -1) DIE_PERROR("semget(baker)");
 
-    for (int i = 0; i < CASHIERS; ++i) {
-        h.msg_id[i] = msgget(bakery_ftok_or_die(0x50 + i), IPC_PERMS_MIN);
-        if (h.msg_id[i] == -1) DIE_PERROR("msgget(baker)");
-    }
-
     BakeryState* st = NULL;
     ipc_attach_or_die(&h, &st);
+    ipc_open_queues_or_die(&h, st);
 
-    int P = 0;
+    int P = 0, bakers = 0;
     shm_lock(h.sem_id);
     P = st->P;
+    bakers = st->baker_count;
     shm_unlock(h.sem_id);
+    if (id >= bakers) {
+        fprintf(stderr, "Błędny id piekarza (piekarzy: %d).\n", bakers);
+        return EXIT_FAILURE;
+    }
 
-    LOGF("piekarz", "Start pracy. Liczba produktów: %d", P);
+    rng_thread_seed(rng_derive(st->seed, RNG_ROLE_BAKER, id));
+    BakerBlock* me = &st->bakers[id];
+    _Atomic int* owner = bakery_baker_owner(st);
+    me->start_ms = vclock_now_ms();
+    LOGF("piekarz", "Start pracy. Piekarz %d/%d, liczba produktów: %d, harmonogram: %s", id, bakers, P,
+         bake_mode_name(st->bake_mode));
 
-    /* Faza rozgrzewki - wyprodukuj troche na zapas zanim klienci zaczna wchodzic */
+    int* wyprodukowano = calloc((size_t)P, sizeof(int));
+    int* razem = calloc((size_t)P, sizeof(int));          /* wypieki tego piekarza (raport) */
+    int* zapas = calloc((size_t)P, sizeof(int));          /* stan podajników dla BakeDemand */
+    if (!wyprodukowano || !razem || !zapas) DIE_PERROR("calloc(baker)");
+    BakeDemand demand;
+    bake_demand_init(&demand, P);
+    const BakeDemand* sched = st->bake_mode == BAKE_DEMAND ? &demand : NULL;
+
+    /* Faza rozgrzewki - wyprodukuj troche na zapas zanim klienci zaczna wchodzic (tylko swoj shard) */
     for (int warmup = 0; warmup < 3 && !g_stop; warmup++) {
         for (int pid = 0; pid < P && !g_stop; ++pid) {
+            if (atomic_load_explicit(&owner[pid], memory_order_relaxed) != id) continue;
             int qty = rand_between(2, 4);
-            for (int k = 0; k < qty && !g_stop; ++k) {
-                if (sem_P_nowait(h.sem_id, SEM_CONV_EMPTY(pid)) == -1) {
-                    if (errno == EAGAIN) break; /* pelny podajnik */
-                    continue;
-                }
-                sem_P(h.sem_id, SEM_CONV_MUTEX(pid));
-                Conveyor* cv = &st->conveyors[pid];
-                if (cv->capacity > 0 && cv->capacity <= MAX_KI) {
-                    cv->items[cv->tail] = 1;
-                    cv->tail = (cv->tail + 1) % cv->capacity;
-                    cv->count++;
-                    st->produced[pid]++;
-                }
-                sem_V(h.sem_id, SEM_CONV_MUTEX(pid));
-                sem_V(h.sem_id, SEM_CONV_FULL(pid));
+            /* cala partia jednym wywolaniem; pelny podajnik -> tyle ile sie zmiesci */
+            int first = next_items(st, pid, qty);
+            int k = conveyor_push_n(st, h.sem_id, pid, first, qty, 1);
+            if (k < qty) return_items(st, pid, first, qty, k > 0 ? k : 0);
+            if (k > 0) {
+                atomic_fetch_add_explicit(&bakery_conveyor(st, pid)->produced, k, memory_order_relaxed);
+                atomic_fetch_add_explicit(&me->produced, k, memory_order_relaxed);
+                razem[pid] += k;
             }
         }
     }
     LOGF("piekarz", "Rozgrzewka zakonczona - produkty na polkach.");
 
+    ControlView ctl = {0};
     while (!g_stop) {
-        /* Sprawdź czy sklep otwarty */
-        shm_lock(h.sem_id);
-        int open = st->store_open;
-        int evacuated = st->evacuated;
-        shm_unlock(h.sem_id);
+        /* Sprawdź czy sklep otwarty (shm_lock tylko po zmianie generacji stanu) */
+        control_refresh(st, h.sem_id, -1, &ctl);
+        if (!ctl.store_open || ctl.evacuated) break;
 
-        if (!open || evacuated) break;
-
-        int wyprodukowano[MAX_P] = {0};
+        memset(wyprodukowano, 0, sizeof(int) * (size_t)P);
+        if (sched) {
+            for (int i = 0; i < P; ++i) zapas[i] = conveyor_count(st, i);
+            bake_demand_update(&demand, st, zapas, vclock_now_ms());
+        }
         /* Losowo wybierz ile produktów i ile sztuk do upieczenia */
         int batches = rand_between(1, 4);
 
         for (int b = 0; b < batches; ++b) {
             if (g_stop) break;
-            int pid = rand_between(0, P - 1);
             int qty = rand_between(1, 5);
+            int pid = pick_product(st, id, qty, sched);
+            if (pid == -1) break;          /* wszystkie podajniki pełne - przerwa */
+            atomic_fetch_add_explicit(&me->batches, 1, memory_order_relaxed);
 
-            for (int k = 0; k < qty; ++k) {
+            /* numery calej partii raz; powtorki po EINTR i doklady biora kolejne z tego bloku */
+            int first = next_items(st, pid, qty);
+            int done = 0;
+            while (done < qty) {
                 if (g_stop || g_evac) break;
                 /* Czekaj na miejsce na podajniku pid */
-                int empty_slots = semctl(h.sem_id, SEM_CONV_EMPTY(pid), GETVAL);
-                if (empty_slots == 0) {
-                    LOGF("piekarz", "Taśma pełna dla %s, czekam...", st->produkty[pid].nazwa);
+                if (conveyor_count(st, pid) + (qty - done) > bakery_conveyor(st, pid)->capacity) {
+                    LOGE(PIEKARZ, LOG_DEBUG, EV_PI_FULL, pid);
                 }
                 
-                /* Przerywalne oczekiwanie na semafor */
-                struct sembuf sop = { .sem_num = SEM_CONV_EMPTY(pid), .sem_op = -1, .sem_flg = 0 };
-                while (semop(h.sem_id, &sop, 1) == -1) {
+                /* Przerywalne oczekiwanie na miejsce dla calej partii; sztuki niosa numery seryjne (FIFO) */
+                int k;
+                while ((k = conveyor_push_n(st, h.sem_id, pid, first + done, qty - done, 0)) == -1) {
                     if (errno == EINTR) {
                         if (g_stop || g_evac) goto cleanup;
                         continue;
                     }
-                    perror("semop(baker EMPTY)");
-                    goto cleanup;
-                }
-                
-                if (g_stop || g_evac) {
-                    /* Oddaj semafor i wyjdź */
-                    sem_V(h.sem_id, SEM_CONV_EMPTY(pid));
+                    if (errno == EINVAL) {
+                        /* Sprawdzenie poprawności capacity (Ki) – bezpieczeństwo przed dzieleniem modulo przez 0 */
+                        fprintf(stderr, "[baker] ERROR: invalid capacity=%d for product %d (KI_LIMIT=%d)\n",
+                                bakery_conveyor(st, pid)->capacity, pid, KI_LIMIT);
+                        g_stop = 1;
+                        break;
+                    }
+                    perror("conveyor_push_n(baker)");
                     goto cleanup;
                 }
-                
-                sem_P(h.sem_id, SEM_CONV_MUTEX(pid));
-
-                /* Sekcja krytyczna: dopisac na tail (FIFO) */
-                Conveyor* cv = &st->conveyors[pid];
-                
-                /* Sprawdzenie poprawności capacity (Ki) – bezpieczeństwo przed dzieleniem modulo przez 0 */
-                if (cv->capacity <= 0 || cv->capacity > MAX_KI) {
-                    fprintf(stderr, "[baker] ERROR: invalid capacity=%d for product %d (MAX_KI=%d)\n", cv->capacity, pid, MAX_KI);
-                    /* Cofnij zajęte miejsce i wyjdź bez zostawiania niespójności */
-                    sem_V(h.sem_id, SEM_CONV_MUTEX(pid));
-                    sem_V(h.sem_id, SEM_CONV_EMPTY(pid));
-                    g_stop = 1;
-                    break;
-                }
+                if (g_stop) break;
 
-                int pos = cv->tail;
-                cv->items[pos] = 1; /* placeholder "sztuka" */
-                cv->tail = (cv->tail + 1) % cv->capacity;
-                cv->count++;
+                /* Statystyka produkcji (atomowo - produkt może mieć chwilowo dwóch piekarzy) */
+                atomic_fetch_add_explicit(&bakery_conveyor(st, pid)->produced, k, memory_order_relaxed);
+                atomic_fetch_add_explicit(&me->produced, k, memory_order_relaxed);
+                wyprodukowano[pid] += k;
+                razem[pid] += k;
+                done += k;
 
-                /* Statystyka produkcji */
-                st->produced[pid]++;
-                wyprodukowano[pid]++;
-
-                sem_V(h.sem_id, SEM_CONV_MUTEX(pid));
-                sem_V(h.sem_id, SEM_CONV_FULL(pid));
+                if (g_evac) goto cleanup;
             }
         }
 
         for (int i = 0; i < P; ++i) {
             if (wyprodukowano[i] > 0) {
-                LOGF("piekarz", "Wypiek: %s x%d", st->produkty[i].nazwa, wyprodukowano[i]);
+                LOGE(PIEKARZ, LOG_DEBUG, EV_PI_BAKED, i, wyprodukowano[i]);
             }
         }
-        msleep(rand_between(100, 300)); 
+        if (bake_pause(st, h.sem_id, &ctl, rand_between(100, 300))) break;
     }
 
 cleanup:
+    me->end_ms = vclock_now_ms();
+
     /* Inwentaryzacja: podsumowanie wytworzonych produktow */
     /* Wypisz raport zawsze przy zamknięciu sklepu lub ewakuacji */
     shm_lock(h.sem_id);
@@ -164,30 +245,37 @@ cleanup:
     if (inv || closed || evac) {
         fprintf(stdout, "\n" COLOR_PIEKARZ);
         fprintf(stdout, "╔══════════════════════════════════════════════════════════╗\n");
-        fprintf(stdout, "║       🥖 RAPORT PIEKARZA - WYPRODUKOWANE PRODUKTY        ║\n");
+        fprintf(stdout, "║     🥖 RAPORT PIEKARZA %2d - WYPRODUKOWANE PRODUKTY       ║\n", id);
         fprintf(stdout, "╠══════════════════════════════════════════════════════════╣\n");
         fprintf(stdout, ANSI_RESET);
         
         int total = 0;
-        shm_lock(h.sem_id);
         for (int i = 0; i < P; ++i) {
-            int qty = st->produced[i];
+            int qty = razem[i];
             if (qty > 0) {
                 fprintf(stdout, COLOR_PIEKARZ "║" ANSI_RESET "  P%02d: %-30s %6d szt.        " COLOR_PIEKARZ "║" ANSI_RESET "\n", 
-                        i, st->produkty[i].nazwa, qty);
+                        i, bakery_product(st, i)->nazwa, qty);
                 total += qty;
             }
         }
-        shm_unlock(h.sem_id);
         
         fprintf(stdout, COLOR_PIEKARZ "╠══════════════════════════════════════════════════════════╣" ANSI_RESET "\n");
         fprintf(stdout, COLOR_PIEKARZ "║" ANSI_RESET "  " ANSI_BOLD "SUMA WYPRODUKOWANYCH: %6d szt." ANSI_RESET "                       " COLOR_PIEKARZ "║" ANSI_RESET "\n", total);
+        double hours = (double)(me->end_ms - me->start_ms) / 3600000.0;
+        fprintf(stdout, COLOR_PIEKARZ "║" ANSI_RESET "  partii: %6d, przejete: %3d, wydajnosc: %8.0f szt./h  " COLOR_PIEKARZ "║" ANSI_RESET "\n",
+                atomic_load_explicit(&me->batches, memory_order_relaxed),
+                atomic_load_explicit(&me->taken_over, memory_order_relaxed),
+                hours > 0.0 ? total / hours : 0.0);
         fprintf(stdout, COLOR_PIEKARZ "╚══════════════════════════════════════════════════════════╝" ANSI_RESET "\n");
     }
 
     if (g_evac) LOGF("piekarz", "Kończę pracę (ewakuacja).");
     else        LOGF("piekarz", "Kończę pracę.");
 
+    free(wyprodukowano);
+    free(razem);
+    free(zapas);
+    bake_demand_free(&demand);
     ipc_detach_or_die(st);
     return 0;
 }
@@ -0,0 +1,285 @@
+#include "common.h"
+
+#include <sys/wait.h>
+
+/*
+ * bench_checkout.c – pomiar czasu obiegu klient -> kasjer -> klient.
+ *
+ * Porównuje dwa kanały kasowe na prywatnych zasobach IPC (IPC_PRIVATE, nie
+ * koliduje z działającą piekarnią):
+ *   mq  - msgsnd koszyka + msgrcv odpowiedzi (jak --checkout=mq)
+ *   shm - skrzynka w SHM + pierścień kasy + futex (jak --checkout=shm)
+ * Proces potomny gra kasjera i odpowiada natychmiast, więc mierzony jest
+ * sam koszt kanału (przełączenia kontekstu, kopiowanie, wywołania systemowe).
+ *
+ * Użycie: bench_checkout [liczba_obiegow=100000] [pozycji_w_koszyku=3]
+ *         bench_checkout tills [obiegow_na_klienta=20000] [pozycji_w_koszyku=3]
+ *
+ * Tryb tills mierzy przepustowość przy rosnącej liczbie kas (1, 2, 4, ... 32):
+ * C procesów-kasjerów i BENCH_CLIENTS_PER_TILL*C procesów-klientów, klient k
+ * płaci zawsze w kasie k % C. Wynik: obiegi na sekundę dla mq i shm.
+ */
+
+#define BENCH_DEFAULT_ROUNDS  100000
+#define BENCH_CLIENT_ID       1000L
+#define BENCH_TILL_ROUNDS     20000
+#define BENCH_CLIENTS_PER_TILL 2
+
+static long long now_ns(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/* Percentyl z posortowanej tablicy (metoda najbliższej rangi) */
+static long long percentile(const long long* sorted, int n, double p) {
+    int idx = (int)(p / 100.0 * n + 0.999999) - 1;
+    if (idx < 0) idx = 0;
+    if (idx >= n) idx = n - 1;
+    return sorted[idx];
+}
+
+static void report(const char* name, long long* lat_ns, int n) {
+    long long sum = 0;
+    for (int i = 0; i < n; ++i) sum += lat_ns[i];
+    qsort(lat_ns, (size_t)n, sizeof(long long), cmp_ll);
+    printf("%-4s obiegow=%d  [ns] p50=%lld p90=%lld p99=%lld max=%lld srednia=%lld\n",
+           name, n, percentile(lat_ns, n, 50), percentile(lat_ns, n, 90),
+           percentile(lat_ns, n, 99), lat_ns[n - 1], sum / n);
+}
+
+/* Kasjer: najpierw rounds obiegów przez kolejkę, potem rounds przez SHM */
+static void run_responder(BakeryState* st, int msg_id, int rounds) {
+    ClientMsg* msg = malloc(client_msg_size(st->basket_max));
+    if (!msg) DIE_PERROR("malloc(bench)");
+    for (int i = 0; i < rounds; ++i) {
+        if (msgrcv(msg_id, msg, client_msg_size(st->basket_max) - sizeof(long), CLIENT_MSG_TYPE, 0) == -1) {
+            DIE_PERROR("msgrcv(bench)");
+        }
+        CashierReply reply = { msg->client_id, 0, (double)msg->item_count, 1 };
+        if (msgsnd(msg_id, &reply, sizeof(reply) - sizeof(long), 0) == -1) {
+            DIE_PERROR("msgsnd(bench)");
+        }
+    }
+    for (int i = 0; i < rounds; ++i) {
+        int slot = checkout_take(st, 0, -1);
+        if (slot < 0) DIE_PERROR("checkout_take(bench)");
+        checkout_reply(st, slot, 0, (double)bakery_checkout_slot(st, slot)->item_count, 1);
+    }
+    free(msg);
+}
+
+/* =========================
+ *  Tryb tills: przepustowość vs liczba kas
+ * ========================= */
+
+static void fill_basket(ClientMsg* msg, long client_id, int items) {
+    msg->mtype = CLIENT_MSG_TYPE;
+    msg->client_id = client_id;
+    msg->item_count = items;
+    for (int i = 0; i < items; ++i) {
+        msg->items[i].product_id = i;
+        msg->items[i].quantity = 1;
+    }
+}
+
+/* Kasjer kasy till: dokładnie n obiegów w wybranym kanale */
+static void till_responder(BakeryState* st, int mode, int msg_id, int till, int n) {
+    ClientMsg* msg = malloc(client_msg_size(st->basket_max));
+    if (!msg) DIE_PERROR("malloc(bench)");
+    for (int i = 0; i < n; ++i) {
+        if (mode == CHECKOUT_MQ) {
+            if (msgrcv(msg_id, msg, client_msg_size(st->basket_max) - sizeof(long), CLIENT_MSG_TYPE, 0) == -1) {
+                DIE_PERROR("msgrcv(bench)");
+            }
+            CashierReply reply = { msg->client_id, till, (double)msg->item_count, 1 };
+            if (msgsnd(msg_id, &reply, sizeof(reply) - sizeof(long), 0) == -1) DIE_PERROR("msgsnd(bench)");
+        } else {
+            int slot = checkout_take(st, till, -1);
+            if (slot < 0) DIE_PERROR("checkout_take(bench)");
+            checkout_reply(st, slot, till, (double)bakery_checkout_slot(st, slot)->item_count, 1);
+        }
+    }
+    free(msg);
+}
+
+static void till_client(BakeryState* st, int mode, int msg_id, int till, long client_id, int items, int rounds) {
+    ClientMsg* msg = malloc(client_msg_size(items));
+    if (!msg) DIE_PERROR("malloc(bench)");
+    fill_basket(msg, client_id, items);
+    for (int i = 0; i < rounds; ++i) {
+        CashierReply reply;
+        if (mode == CHECKOUT_MQ) {
+            if (msgsnd(msg_id, msg, client_msg_size(items) - sizeof(long), 0) == -1) DIE_PERROR("msgsnd(bench)");
+            if (msgrcv(msg_id, &reply, sizeof(reply) - sizeof(long), client_id, 0) == -1) {
+                DIE_PERROR("msgrcv(bench)");
+            }
+        } else {
+            int slot = checkout_submit(st, till, client_id, msg->items, items);
+            if (slot < 0) DIE_PERROR("checkout_submit(bench)");
+            if (checkout_wait(st, slot, 0, &reply) == -1) DIE_PERROR("checkout_wait(bench)");
+        }
+    }
+    free(msg);
+}
+
+static void wait_all(pid_t* pids, int n) {
+    for (int i = 0; i < n; ++i) CHECK_SYS(waitpid(pids[i], NULL, 0), "waitpid(bench)");
+}
+
+/* Jeden punkt pomiaru: tills kas w kanale mode, wynik w obiegach/s */
+static double till_run(int mode, int tills, int items, int rounds) {
+    ShmConfig cfg = { 0, NULL, items, tills, CHECKOUT_SHM, 0, tills * BENCH_CLIENTS_PER_TILL };
+    size_t shm_size = bakery_layout(NULL, &cfg);
+    int shm_id = shmget(IPC_PRIVATE, shm_size, IPC_CREAT | IPC_PERMS_MIN);
+    if (shm_id == -1) DIE_PERROR("shmget(bench)");
+    BakeryState* st = shmat(shm_id, NULL, 0);
+    if (st == (void*)-1) DIE_PERROR("shmat(bench)");
+    memset(st, 0, shm_size);
+    bakery_layout(st, &cfg);
+    checkout_init(st);
+
+    int msg_id[CASHIERS_MAX];
+    for (int c = 0; c < tills; ++c) {
+        msg_id[c] = msgget(IPC_PRIVATE, IPC_CREAT | IPC_PERMS_MIN);
+        if (msg_id[c] == -1) DIE_PERROR("msgget(bench)");
+    }
+
+    int clients = tills * BENCH_CLIENTS_PER_TILL;
+    pid_t resp[CASHIERS_MAX];
+    pid_t cli[CASHIERS_MAX * BENCH_CLIENTS_PER_TILL];
+
+    for (int c = 0; c < tills; ++c) {
+        resp[c] = fork();
+        if (resp[c] == -1) DIE_PERROR("fork(bench)");
+        if (resp[c] == 0) {
+            till_responder(st, mode, msg_id[c], c, BENCH_CLIENTS_PER_TILL * rounds);
+            _exit(0);
+        }
+    }
+
+    long long t = now_ns();
+    for (int k = 0; k < clients; ++k) {
+        cli[k] = fork();
+        if (cli[k] == -1) DIE_PERROR("fork(bench)");
+        if (cli[k] == 0) {
+            till_client(st, mode, msg_id[k % tills], k % tills, BENCH_CLIENT_ID + k, items, rounds);
+            _exit(0);
+        }
+    }
+    wait_all(cli, clients);
+    long long elapsed = now_ns() - t;
+    wait_all(resp, tills);
+
+    for (int c = 0; c < tills; ++c) CHECK_SYS(msgctl(msg_id[c], IPC_RMID, NULL), "msgctl(IPC_RMID)");
+    CHECK_SYS(shmdt(st), "shmdt(bench)");
+    CHECK_SYS(shmctl(shm_id, IPC_RMID, NULL), "shmctl(IPC_RMID)");
+    return (double)clients * rounds * 1e9 / (double)elapsed;
+}
+
+static int run_tills(int argc, char** argv) {
+    int rounds = argc >= 3 ? atoi(argv[2]) : BENCH_TILL_ROUNDS;
+    int items = argc >= 4 ? atoi(argv[3]) : 3;
+    if (rounds <= 0 || items <= 0 || items > BASKET_LIMIT) {
+        fprintf(stderr, "Użycie: bench_checkout tills [obiegow_na_klienta] [pozycji_w_koszyku 1..%d]\n",
+                BASKET_LIMIT);
+        return EXIT_FAILURE;
+    }
+
+    printf("bench_checkout tills: %d obiegow na klienta, %d klientow na kase, %d pozycji, CPU=%ld\n",
+           rounds, BENCH_CLIENTS_PER_TILL, items, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%5s %14s %14s\n", "kasy", "mq [obieg/s]", "shm [obieg/s]");
+    for (int tills = 1; tills <= CASHIERS_MAX; tills *= 2) {
+        double mq = till_run(CHECKOUT_MQ, tills, items, rounds);
+        double shm = till_run(CHECKOUT_SHM, tills, items, rounds);
+        printf("%5d %14.0f %14.0f\n", tills, mq, shm);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (argc >= 2 && strcmp(argv[1], "tills") == 0) return run_tills(argc, argv);
+
+    int rounds = argc >= 2 ? atoi(argv[1]) : BENCH_DEFAULT_ROUNDS;
+    int items = argc >= 3 ? atoi(argv[2]) : 3;
+    if (rounds <= 0 || items <= 0 || items > BASKET_LIMIT) {
+        fprintf(stderr, "Użycie: bench_checkout [liczba_obiegow] [pozycji_w_koszyku 1..%d]\n",
+                BASKET_LIMIT);
+        return EXIT_FAILURE;
+    }
+
+    /* Segment tylko z kanałem kasowym (P=0), koszyk na items pozycji */
+    ShmConfig cfg = { 0, NULL, items, 1, CHECKOUT_SHM, 0, 1 };
+    size_t shm_size = bakery_layout(NULL, &cfg);
+    int shm_id = shmget(IPC_PRIVATE, shm_size, IPC_CREAT | IPC_PERMS_MIN);
+    if (shm_id == -1) DIE_PERROR("shmget(bench)");
+    int msg_id = msgget(IPC_PRIVATE, IPC_CREAT | IPC_PERMS_MIN);
+    if (msg_id == -1) DIE_PERROR("msgget(bench)");
+
+    BakeryState* st = shmat(shm_id, NULL, 0);
+    if (st == (void*)-1) DIE_PERROR("shmat(bench)");
+    memset(st, 0, shm_size);
+    bakery_layout(st, &cfg);
+    checkout_init(st);
+
+    pid_t pid = fork();
+    if (pid == -1) DIE_PERROR("fork(bench)");
+    if (pid == 0) {
+        run_responder(st, msg_id, rounds);
+        _exit(0);
+    }
+
+    BasketItem* basket = calloc((size_t)items, sizeof(BasketItem));
+    ClientMsg* msg = malloc(client_msg_size(items));
+    if (!basket || !msg) DIE_PERROR("calloc(bench)");
+    for (int i = 0; i < items; ++i) {
+        basket[i].product_id = i;
+        basket[i].quantity = 1;
+    }
+    long long* lat_ns = calloc((size_t)rounds, sizeof(long long));
+    if (!lat_ns) DIE_PERROR("calloc(bench)");
+
+    printf("bench_checkout: %d obiegow, %d pozycji w koszyku\n", rounds, items);
+
+    for (int i = 0; i < rounds; ++i) {
+        msg->mtype = CLIENT_MSG_TYPE;
+        msg->client_id = BENCH_CLIENT_ID;
+        msg->item_count = items;
+        memcpy(msg->items, basket, (size_t)items * sizeof(BasketItem));
+        CashierReply reply;
+
+        long long t = now_ns();
+        if (msgsnd(msg_id, msg, client_msg_size(items) - sizeof(long), 0) == -1) DIE_PERROR("msgsnd(bench)");
+        if (msgrcv(msg_id, &reply, sizeof(reply) - sizeof(long), BENCH_CLIENT_ID, 0) == -1) {
+            DIE_PERROR("msgrcv(bench)");
+        }
+        lat_ns[i] = now_ns() - t;
+    }
+    report("mq", lat_ns, rounds);
+
+    for (int i = 0; i < rounds; ++i) {
+        CashierReply reply;
+
+        long long t = now_ns();
+        int slot = checkout_submit(st, 0, BENCH_CLIENT_ID, basket, items);
+        if (slot < 0) DIE_PERROR("checkout_submit(bench)");
+        if (checkout_wait(st, slot, 0, &reply) == -1) DIE_PERROR("checkout_wait(bench)");
+        lat_ns[i] = now_ns() - t;
+    }
+    report("shm", lat_ns, rounds);
+
+    free(lat_ns);
+    free(msg);
+    free(basket);
+    CHECK_SYS(waitpid(pid, NULL, 0), "waitpid(bench)");
+    CHECK_SYS(shmdt(st), "shmdt(bench)");
+    CHECK_SYS(shmctl(shm_id, IPC_RMID, NULL), "shmctl(IPC_RMID)");
+    CHECK_SYS(msgctl(msg_id, IPC_RMID, NULL), "msgctl(IPC_RMID)");
+    return 0;
+}
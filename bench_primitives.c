@@ -0,0 +1,289 @@
+#include "common.h"
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+ * bench_primitives.c – mikropomiary prymitywów, z których zbudowana jest piekarnia.
+ *
+ * Każdy prymityw mierzony przy 1, 2, 4, ... max procesach działających naraz
+ * na prywatnych zasobach IPC (IPC_PRIVATE, nie koliduje z działającą piekarnią):
+ *   sem       - sem_P + sem_V na semaforze z wolnymi miejscami (jak drzwi sklepu)
+ *   shm_lock  - shm_lock + inkrementacja + shm_unlock (jeden mutex dla wszystkich)
+ *   conv_sem  - conveyor_push_n + conveyor_pop_up_to_n jak piekarz i klient
+ *   conv_lf     (podajnik w trybie --conveyor=sem i --conveyor=lockfree)
+ *   mq        - msgsnd ClientMsg + msgrcv CashierReply, jeden proces-kasjer
+ * Wynik: ns/op (czas jednej operacji widziany przez proces: czas * procesy /
+ * operacje) i op/s wszystkich procesów łącznie. Backend semaforów wybiera
+ * kompilacja (make SYNC=sysv|futex), więc dwa przebiegi dają punkt odniesienia
+ * dla nowego backendu synchronizacji albo transportu.
+ *
+ * Użycie: bench_primitives [operacji_na_punkt=200000] [max_procesow=64] [prymityw...]
+ */
+
+#define BENCH_DEFAULT_OPS     200000
+#define BENCH_DEFAULT_PROCS   64
+#define BENCH_PROCS_LIMIT     256
+#define BENCH_CONV_BATCH      2       /* sztuk na operację podajnika (jak qty klienta) */
+#define BENCH_ITEMS           3       /* pozycji w koszyku ClientMsg */
+#define BENCH_CLIENT_ID       1000L
+
+/* Liczniki wspólne dla procesów pomiaru (poza segmentem piekarni) */
+typedef struct BenchShared {
+    CACHELINE_ALIGNED
+    long long locked_counter;     /* zmieniany tylko pod shm_lock */
+} BenchShared;
+
+typedef struct BenchEnv {
+    BakeryState* st;
+    int shm_id;
+    int sem_id;
+    int msg_id;
+    BenchShared* shared;
+} BenchEnv;
+
+typedef enum BenchKind { BK_SEM, BK_SHM_LOCK, BK_CONV_SEM, BK_CONV_LF, BK_MQ, BK_COUNT } BenchKind;
+static const char* const g_bench_names[BK_COUNT] = { "sem", "shm_lock", "conv_sem", "conv_lf", "mq" };
+
+static long long now_ns(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Segment z jednym podajnikiem o pojemności ki i jedną kasą; semafory z tą samą numeracją */
+static void env_create(BenchEnv* env, int ki) {
+    int Ki[1] = { ki };
+    ShmConfig cfg = { 1, Ki, BENCH_ITEMS, 1, CHECKOUT_MQ, 0, 0 };
+    size_t shm_size = bakery_layout(NULL, &cfg);
+
+    IpcHandles h;
+    memset(&h, 0, sizeof(h));
+    h.shm_id = shmget(IPC_PRIVATE, shm_size, IPC_CREAT | IPC_PERMS_MIN);
+    if (h.shm_id == -1) DIE_PERROR("shmget(bench)");
+    h.sem_id = semget(IPC_PRIVATE, sem_count_for_P(1), IPC_CREAT | IPC_PERMS_MIN);
+    if (h.sem_id == -1) DIE_PERROR("semget(bench)");
+    env->msg_id = msgget(IPC_PRIVATE, IPC_CREAT | IPC_PERMS_MIN);
+    if (env->msg_id == -1) DIE_PERROR("msgget(bench)");
+
+    /* attach ustawia segment dla backendu futex (semafory w SHM) */
+    ipc_attach_or_die(&h, &env->st);
+    memset(env->st, 0, shm_size);
+    bakery_layout(env->st, &cfg);
+    env->shm_id = h.shm_id;
+    env->sem_id = h.sem_id;
+
+    env->shared = mmap(NULL, sizeof(BenchShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (env->shared == MAP_FAILED) DIE_PERROR("mmap(bench)");
+}
+
+static void env_destroy(BenchEnv* env) {
+    CHECK_SYS(munmap(env->shared, sizeof(BenchShared)), "munmap(bench)");
+    ipc_detach_or_die(env->st);
+    CHECK_SYS(shmctl(env->shm_id, IPC_RMID, NULL), "shmctl(IPC_RMID)");
+    CHECK_SYS(semctl(env->sem_id, 0, IPC_RMID), "semctl(IPC_RMID)");
+    CHECK_SYS(msgctl(env->msg_id, IPC_RMID, NULL), "msgctl(IPC_RMID)");
+}
+
+/* Stan początkowy przed każdym punktem: pusty podajnik, wolny mutex, procs miejsc w drzwiach */
+static void env_reset(BenchEnv* env, int conveyor_mode, int procs) {
+    env->st->conveyor_mode = conveyor_mode;
+    conveyor_init(env->st, 0);
+    sem_setval(env->sem_id, SEM_STORE_SLOTS, procs);
+    sem_setval(env->sem_id, SEM_SHM_GLOBAL, 1);
+    sem_setval(env->sem_id, SEM_CONV_MUTEX(0), 1);
+    sem_setval(env->sem_id, SEM_CONV_EMPTY(0), bakery_conveyor(env->st, 0)->capacity);
+    sem_setval(env->sem_id, SEM_CONV_FULL(0), 0);
+    env->shared->locked_counter = 0;
+}
+
+static void run_sem(BenchEnv* env, int ops) {
+    for (int i = 0; i < ops; ++i) {
+        sem_P(env->sem_id, SEM_STORE_SLOTS);
+        sem_V(env->sem_id, SEM_STORE_SLOTS);
+    }
+}
+
+static void run_shm_lock(BenchEnv* env, int ops) {
+    for (int i = 0; i < ops; ++i) {
+        shm_lock(env->sem_id);
+        env->shared->locked_counter++;
+        shm_unlock(env->sem_id);
+    }
+}
+
+/*
+ * Piekarz dokłada partię (czekając na miejsce, jak baker.c), klient zdejmuje
+ * do tylu sztuk bez czekania (jak client_core.c). Proces zdejmuje tyle, ile
+ * dołożył, więc na podajniku jest najwyżej procs*BENCH_CONV_BATCH sztuk
+ * i dokładanie nigdy nie czeka w nieskończoność.
+ */
+static void run_conveyor(BenchEnv* env, int ops) {
+    for (int i = 0; i < ops; ++i) {
+        int k;
+        while ((k = conveyor_push_n(env->st, env->sem_id, 0, i * BENCH_CONV_BATCH, BENCH_CONV_BATCH, 0)) == -1) {
+            if (errno != EINTR) DIE_PERROR("conveyor_push_n(bench)");
+        }
+        for (int left = k; left > 0;) {
+            int got = conveyor_pop_up_to_n(env->st, env->sem_id, 0, left, NULL);
+            if (got > 0) {
+                left -= got;
+            } else if (errno == EAGAIN || errno == EINTR) {
+                sched_yield();    /* sztuki zabrał inny proces; jego partia zaraz dojdzie */
+            } else {
+                DIE_PERROR("conveyor_pop_up_to_n(bench)");
+            }
+        }
+    }
+}
+
+static void run_mq_client(BenchEnv* env, long client_id, int ops) {
+    ClientMsg* msg = malloc(client_msg_size(BENCH_ITEMS));
+    if (!msg) DIE_PERROR("malloc(bench)");
+    msg->mtype = CLIENT_MSG_TYPE;
+    msg->client_id = client_id;
+    msg->item_count = BENCH_ITEMS;
+    for (int i = 0; i < BENCH_ITEMS; ++i) {
+        msg->items[i].product_id = 0;
+        msg->items[i].quantity = 1;
+    }
+    for (int i = 0; i < ops; ++i) {
+        CashierReply reply;
+        if (msgsnd(env->msg_id, msg, client_msg_size(BENCH_ITEMS) - sizeof(long), 0) == -1) {
+            DIE_PERROR("msgsnd(bench)");
+        }
+        if (msgrcv(env->msg_id, &reply, sizeof(reply) - sizeof(long), client_id, 0) == -1) {
+            DIE_PERROR("msgrcv(bench)");
+        }
+    }
+    free(msg);
+}
+
+/* Kasjer: odpowiada natychmiast na dokładnie n koszyków */
+static void run_mq_cashier(BenchEnv* env, int n) {
+    ClientMsg* msg = malloc(client_msg_size(BENCH_ITEMS));
+    if (!msg) DIE_PERROR("malloc(bench)");
+    for (int i = 0; i < n; ++i) {
+        if (msgrcv(env->msg_id, msg, client_msg_size(BENCH_ITEMS) - sizeof(long), CLIENT_MSG_TYPE, 0) == -1) {
+            DIE_PERROR("msgrcv(bench)");
+        }
+        CashierReply reply = { msg->client_id, 0, (double)msg->item_count, 1 };
+        if (msgsnd(env->msg_id, &reply, sizeof(reply) - sizeof(long), 0) == -1) DIE_PERROR("msgsnd(bench)");
+    }
+    free(msg);
+}
+
+static void run_worker(BenchEnv* env, BenchKind kind, int worker, int ops) {
+    switch (kind) {
+    case BK_SEM:      run_sem(env, ops); break;
+    case BK_SHM_LOCK: run_shm_lock(env, ops); break;
+    case BK_CONV_SEM:
+    case BK_CONV_LF:  run_conveyor(env, ops); break;
+    case BK_MQ:       run_mq_client(env, BENCH_CLIENT_ID + worker, ops); break;
+    default: break;
+    }
+}
+
+/*
+ * Jeden punkt pomiaru: procs procesów po ops operacji. Procesy czekają na
+ * zamknięcie rury startowej, żeby fork nie wchodził do mierzonego czasu.
+ * Zwraca czas w ns od startu do zakończenia ostatniego procesu.
+ */
+static long long bench_point(BenchEnv* env, BenchKind kind, int procs, int ops) {
+    env_reset(env, kind == BK_CONV_LF ? CONVEYOR_LOCKFREE : CONVEYOR_SEM, procs);
+
+    int go[2];
+    CHECK_SYS(pipe(go), "pipe(bench)");
+
+    pid_t cashier = -1;
+    if (kind == BK_MQ) {
+        cashier = fork();
+        if (cashier == -1) DIE_PERROR("fork(bench)");
+        if (cashier == 0) {
+            close(go[1]);
+            run_mq_cashier(env, procs * ops);
+            _exit(0);
+        }
+    }
+
+    pid_t pids[BENCH_PROCS_LIMIT];
+    for (int w = 0; w < procs; ++w) {
+        pids[w] = fork();
+        if (pids[w] == -1) DIE_PERROR("fork(bench)");
+        if (pids[w] == 0) {
+            close(go[1]);
+            char c;
+            while (read(go[0], &c, 1) == -1 && errno == EINTR) {
+            }
+            run_worker(env, kind, w, ops);
+            _exit(0);
+        }
+    }
+    close(go[0]);
+
+    long long t = now_ns();
+    close(go[1]);
+    for (int w = 0; w < procs; ++w) CHECK_SYS(waitpid(pids[w], NULL, 0), "waitpid(bench)");
+    long long elapsed = now_ns() - t;
+    if (cashier > 0) CHECK_SYS(waitpid(cashier, NULL, 0), "waitpid(bench)");
+
+    if (kind == BK_SHM_LOCK && env->shared->locked_counter != (long long)procs * ops) {
+        fprintf(stderr, "bench_primitives: shm_lock nie wyklucza - licznik %lld zamiast %lld\n",
+                env->shared->locked_counter, (long long)procs * ops);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    int total_ops = argc >= 2 ? atoi(argv[1]) : BENCH_DEFAULT_OPS;
+    int max_procs = argc >= 3 ? atoi(argv[2]) : BENCH_DEFAULT_PROCS;
+    if (total_ops <= 0 || max_procs <= 0 || max_procs > BENCH_PROCS_LIMIT) {
+        fprintf(stderr, "Użycie: bench_primitives [operacji_na_punkt] [max_procesow 1..%d] [prymityw...]\n"
+                        "  prymitywy: sem shm_lock conv_sem conv_lf mq (domyslnie wszystkie)\n",
+                BENCH_PROCS_LIMIT);
+        return EXIT_FAILURE;
+    }
+
+    int enabled[BK_COUNT];
+    for (int k = 0; k < BK_COUNT; ++k) enabled[k] = argc < 4;
+    for (int i = 3; i < argc; ++i) {
+        int found = 0;
+        for (int k = 0; k < BK_COUNT; ++k) {
+            if (strcmp(argv[i], g_bench_names[k]) == 0) enabled[k] = found = 1;
+        }
+        if (!found) {
+            fprintf(stderr, "Nieznany prymityw: %s (sem shm_lock conv_sem conv_lf mq)\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    BenchEnv env;
+    env_create(&env, max_procs * BENCH_CONV_BATCH);
+
+    printf("bench_primitives: %d operacji na punkt, do %d procesow, SYNC=%s, CPU=%ld\n", total_ops, max_procs,
+#ifdef BAKERY_SYNC_FUTEX
+           "futex",
+#else
+           "sysv",
+#endif
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-9s %8s %12s %14s\n", "prymityw", "procesy", "ns/op", "op/s");
+    for (int k = 0; k < BK_COUNT; ++k) {
+        if (!enabled[k]) continue;
+        /* 1, 2, 4, ... i zawsze max_procs na koniec */
+        for (int procs = 1;; procs = procs * 2 > max_procs ? max_procs : procs * 2) {
+            int ops = total_ops / procs > 0 ? total_ops / procs : 1;
+            long long elapsed = bench_point(&env, (BenchKind)k, procs, ops);
+            double done = (double)procs * ops;
+            printf("%-9s %8d %12.1f %14.0f\n", g_bench_names[k], procs, (double)elapsed * procs / done,
+                   done * 1e9 / (double)elapsed);
+            if (procs == max_procs) break;
+        }
+    }
+
+    env_destroy(&env);
+    return 0;
+}
@@ -0,0 +1,366 @@
+#include "common.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <sys/wait.h>
+
+/*
+ * bench_sweep.c – przegląd parametrów: ./manager test dla każdej kombinacji
+ * N (--store), P (--products), Ki (--ki), liczby kas, liczby klientów, wyboru
+ * kasy przez klienta (--till=queue,work - porównanie czekania w kolejce) i
+ * harmonogramu piekarza (--bake=random,demand - sprzedaż i utracona sprzedaż).
+ *
+ * Każda konfiguracja idzie --reps razy (ziarno --seed + numer powtórzenia,
+ * ten sam zestaw ziaren w każdym przebiegu przeglądu). ./manager dopisuje
+ * wynik przebiegu do pliku --raw (linia JSON, opcja --report), a tu wiersz
+ * CSV na konfigurację: przepustowość jako średnia i odchylenie, opóźnienia
+ * przy kasie i czas CPU ról jako mediana powtórzeń (odporna na pojedynczy
+ * zakłócony przebieg). Kolumna tag (np. skrót commita) pozwala porównywać
+ * wyniki między wersjami. Opóźnienia są w µs czasu rzeczywistego przy
+ * zegarze x speed (kolumna speed) - porównywalne tylko przy tym samym speed
+ * i nie wprost z ./sim, który mierzy czas symulowany.
+ *
+ * Użycie: bench_sweep [--store=L] [--products=L] [--ki=L] [--cashiers=L] [--clients=L] [--till=L] [--bake=L]
+ *                     [--reps=R] [--seed=S] [--speed=X] [--timeout=SEK] [--tag=T]
+ *                     [--out=PLIK.csv] [--raw=PLIK.jsonl] [-- opcje ./manager]
+ *   L - lista po przecinku, np. --cashiers=2,4,8; --ki=0 to domyślne Ki (10..14)
+ */
+
+#define SWEEP_MAX_VALUES    16
+#define SWEEP_DEFAULT_REPS  3
+#define SWEEP_DEFAULT_SEED  1
+#define SWEEP_DEFAULT_SPEED 100.0
+#define SWEEP_TIMEOUT_S     120
+#define SWEEP_MAX_EXTRA     16
+
+typedef struct SweepList {
+    int n;
+    int v[SWEEP_MAX_VALUES];
+} SweepList;
+
+enum { AX_STORE, AX_PRODUCTS, AX_KI, AX_CASHIERS, AX_CLIENTS, AX_TILL, AX_BAKE, AX_COUNT };
+static const char* const g_axis_opt[AX_COUNT] = { "store", "products", "ki", "cashiers", "clients", "till", "bake" };
+static const char* const g_till_names[] = { [TILL_QUEUE] = "queue", [TILL_WORK] = "work" };
+static const char* const g_bake_names[] = { [BAKE_RANDOM] = "random", [BAKE_DEMAND] = "demand" };
+
+/* Kolumny CSV: klucz z raportu ./manager i sposób agregacji powtórzeń */
+typedef struct SweepMetric {
+    const char* key;
+    const char* column;
+    int median;                   /* 1 = mediana, 0 = średnia i odchylenie */
+} SweepMetric;
+
+static const SweepMetric g_metrics[] = {
+    { "customers_per_s",  "customers_per_s",  0 },
+    { "units_sold_per_s", "units_sold_per_s", 0 },
+    { "units_sold_per_min", "units_sold_per_min", 0 },
+    { "lost_units",       "lost_units",       0 },
+    { "wall_ms",          "wall_ms",          0 },
+    { "wasted",           "wasted",           0 },
+    { "checkout_mean_us", "checkout_mean_us", 1 },
+    { "checkout_p50_us",  "checkout_p50_us",  1 },
+    { "checkout_p99_us",  "checkout_p99_us",  1 },
+    { "checkout_p999_us", "checkout_p999_us", 1 },
+    { "till_wait_mean_us", "till_wait_mean_us", 1 },
+    { "till_wait_p99_us", "till_wait_p99_us", 1 },
+    { "manager",          "cpu_manager_ms",   1 },
+    { "baker",            "cpu_baker_ms",     1 },
+    { "cashier",          "cpu_cashier_ms",   1 },
+    { "client",           "cpu_client_ms",    1 },
+    { "logdrain",         "cpu_logdrain_ms",  1 },
+};
+#define SWEEP_METRICS ((int)(sizeof(g_metrics) / sizeof(g_metrics[0])))
+
+static int parse_list(const char* s, SweepList* out) {
+    out->n = 0;
+    while (*s) {
+        char* end = NULL;
+        long v = strtol(s, &end, 10);
+        if (end == s || v < 0 || out->n >= SWEEP_MAX_VALUES) return -1;
+        out->v[out->n++] = (int)v;
+        s = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return -1;
+    }
+    return out->n > 0 ? 0 : -1;
+}
+
+/* Lista nazw po przecinku (np. queue,work) -> indeksy w names (TILL_*, BAKE_*) */
+static int parse_name_list(const char* s, const char* const* names, int count, SweepList* out) {
+    out->n = 0;
+    while (*s) {
+        size_t len = strcspn(s, ",");
+        int v = -1;
+        for (int t = 0; t < count; ++t) {
+            if (strlen(names[t]) == len && strncmp(s, names[t], len) == 0) v = t;
+        }
+        if (v < 0 || out->n >= SWEEP_MAX_VALUES) return -1;
+        out->v[out->n++] = v;
+        s += len;
+        if (*s == ',') s++;
+    }
+    return out->n > 0 ? 0 : -1;
+}
+
+/* Wartość liczbowa "klucz":liczba z linii JSON raportu (klucze w raporcie są unikalne) */
+static int json_number(const char* line, const char* key, double* out) {
+    char pat[64];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char* p = strstr(line, pat);
+    if (!p) return -1;
+    char* end = NULL;
+    *out = strtod(p + strlen(pat), &end);
+    return end == p + strlen(pat) ? -1 : 0;
+}
+
+/* Zasoby IPC po przerwanym przebiegu - kolejny ./manager tworzy je z IPC_EXCL */
+static void ipc_cleanup(void) {
+    ensure_ipc_key_file_or_die();
+    int id = shmget(bakery_ftok_or_die(0x41), 0, IPC_PERMS_MIN);
+    if (id != -1) shmctl(id, IPC_RMID, NULL);
+    id = semget(bakery_ftok_or_die(0x42), 0, IPC_PERMS_MIN);
+    if (id != -1) semctl(id, 0, IPC_RMID);
+    for (int i = 0; i < CASHIERS_MAX; ++i) {
+        id = msgget(bakery_ftok_or_die(0x50 + i), IPC_PERMS_MIN);
+        if (id != -1) msgctl(id, IPC_RMID, NULL);
+    }
+}
+
+/* Jeden przebieg ./manager; 0 = zakończył się z kodem 0 przed limitem czasu */
+static int run_manager(char* const argv[], int timeout_s) {
+    pid_t pid = fork();
+    if (pid == -1) DIE_PERROR("fork");
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd != -1) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execv(argv[0], argv);
+        DIE_PERROR("execv(./manager)");
+    }
+
+    int status = 0;
+    for (int waited_ms = 0;; waited_ms += 50) {
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid) break;
+        if (r == -1) DIE_PERROR("waitpid(manager)");
+        if (waited_ms >= timeout_s * 1000) {
+            /* kierownik ma własną grupę procesów (setpgid) - zabij całą symulację */
+            kill(-pid, SIGKILL);
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            ipc_cleanup();
+            return -1;
+        }
+        msleep_real(50);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ipc_cleanup();
+        return -1;
+    }
+    return 0;
+}
+
+/* Ostatnia linia pliku od pozycji from (raport dopisany przez przebieg) */
+static int read_report(const char* path, long from, char* line, size_t n) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    int found = 0;
+    if (fseek(f, from, SEEK_SET) == 0) {
+        while (fgets(line, (int)n, f)) found = 1;
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+static long file_size(const char* path) {
+    struct stat sb;
+    return stat(path, &sb) == 0 ? (long)sb.st_size : 0;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    SweepList axes[AX_COUNT] = {
+        [AX_STORE]    = { 1, { 30 } },
+        [AX_PRODUCTS] = { 1, { DEFAULT_P } },
+        [AX_KI]       = { 1, { 0 } },
+        [AX_CASHIERS] = { 1, { DEFAULT_CASHIERS } },
+        [AX_CLIENTS]  = { 1, { 200 } },
+        [AX_TILL]     = { 1, { TILL_WORK } },
+        [AX_BAKE]     = { 1, { BAKE_RANDOM } },
+    };
+    int reps = SWEEP_DEFAULT_REPS;
+    unsigned long long seed = SWEEP_DEFAULT_SEED;
+    double speed = SWEEP_DEFAULT_SPEED;
+    int timeout_s = SWEEP_TIMEOUT_S;
+    const char* tag = "local";
+    const char* out_path = NULL;
+    const char* raw_path = "bench_runs.jsonl";
+
+    static const struct option long_opts[] = {
+        { "store",    required_argument, NULL, AX_STORE },
+        { "products", required_argument, NULL, AX_PRODUCTS },
+        { "ki",       required_argument, NULL, AX_KI },
+        { "cashiers", required_argument, NULL, AX_CASHIERS },
+        { "clients",  required_argument, NULL, AX_CLIENTS },
+        { "till",     required_argument, NULL, AX_TILL },
+        { "bake",     required_argument, NULL, AX_BAKE },
+        { "reps",     required_argument, NULL, 'r' },
+        { "seed",     required_argument, NULL, 'S' },
+        { "speed",    required_argument, NULL, 's' },
+        { "timeout",  required_argument, NULL, 'T' },
+        { "tag",      required_argument, NULL, 't' },
+        { "out",      required_argument, NULL, 'o' },
+        { "raw",      required_argument, NULL, 'w' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case AX_STORE: case AX_PRODUCTS: case AX_KI: case AX_CASHIERS: case AX_CLIENTS: case AX_TILL: case AX_BAKE: {
+            int rc = opt == AX_TILL ? parse_name_list(optarg, g_till_names, 2, &axes[opt])
+                   : opt == AX_BAKE ? parse_name_list(optarg, g_bake_names, 2, &axes[opt])
+                   : parse_list(optarg, &axes[opt]);
+            if (rc == -1) {
+                fprintf(stderr, "Błędna lista --%s: %s (do %d wartosci po przecinku)\n", g_axis_opt[opt], optarg,
+                        SWEEP_MAX_VALUES);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        case 'r': reps = atoi(optarg); break;
+        case 'S': seed = strtoull(optarg, NULL, 0); break;
+        case 's': speed = atof(optarg); break;
+        case 'T': timeout_s = atoi(optarg); break;
+        case 't': tag = optarg; break;
+        case 'o': out_path = optarg; break;
+        case 'w': raw_path = optarg; break;
+        default:
+            fprintf(stderr, "Użycie: %s [--store=L] [--products=L] [--ki=L] [--cashiers=L] [--clients=L] [--till=L] [--bake=L]"
+                            " [--reps=R]"
+                            " [--seed=S] [--speed=X] [--timeout=SEK] [--tag=T] [--out=PLIK] [--raw=PLIK]"
+                            " [-- opcje ./manager]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (reps <= 0 || speed <= 0.0 || timeout_s <= 0) {
+        fprintf(stderr, "Błędne --reps/--speed/--timeout\n");
+        return EXIT_FAILURE;
+    }
+    int extra_n = argc - optind;
+    if (extra_n > SWEEP_MAX_EXTRA) {
+        fprintf(stderr, "Za duzo opcji ./manager (max %d)\n", SWEEP_MAX_EXTRA);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = stdout;
+    if (out_path && !(out = fopen(out_path, "w"))) DIE_PERROR("fopen(--out)");
+
+    fprintf(out, "tag,N,P,ki,cashiers,clients,till,bake,speed,reps,ok");
+    for (int m = 0; m < SWEEP_METRICS; ++m) {
+        if (g_metrics[m].median) fprintf(out, ",%s_median", g_metrics[m].column);
+        else fprintf(out, ",%s_mean,%s_sd", g_metrics[m].column, g_metrics[m].column);
+    }
+    fprintf(out, "\n");
+    fflush(out);
+
+    int total = 1;
+    for (int a = 0; a < AX_COUNT; ++a) total *= axes[a].n;
+    double* vals = malloc(sizeof(double) * (size_t)reps * SWEEP_METRICS);
+    if (!vals) DIE_PERROR("malloc(bench_sweep)");
+    ipc_cleanup();
+
+    for (int k = 0; k < total; ++k) {
+        int cfg[AX_COUNT];
+        for (int a = AX_COUNT - 1, rest = k; a >= 0; --a) {
+            cfg[a] = axes[a].v[rest % axes[a].n];
+            rest /= axes[a].n;
+        }
+
+        int ok = 0;
+        double run_speed = speed;   /* z raportu - opcje po "--" mogą nadpisać --speed */
+        for (int r = 0; r < reps; ++r) {
+            char args[AX_COUNT + 6][48];
+            int na = 0;
+            snprintf(args[na++], sizeof(args[0]), "%d", cfg[AX_CLIENTS]);
+            snprintf(args[na++], sizeof(args[0]), "--store=%d", cfg[AX_STORE]);
+            snprintf(args[na++], sizeof(args[0]), "--products=%d", cfg[AX_PRODUCTS]);
+            snprintf(args[na++], sizeof(args[0]), "--cashiers=%d", cfg[AX_CASHIERS]);
+            snprintf(args[na++], sizeof(args[0]), "--seed=%llu", seed + (unsigned long long)r);
+            snprintf(args[na++], sizeof(args[0]), "--speed=%g", speed);
+            snprintf(args[na++], sizeof(args[0]), "--till=%s", g_till_names[cfg[AX_TILL]]);
+            snprintf(args[na++], sizeof(args[0]), "--bake=%s", g_bake_names[cfg[AX_BAKE]]);
+            if (cfg[AX_KI] > 0) snprintf(args[na++], sizeof(args[0]), "--ki=%d", cfg[AX_KI]);
+
+            char report_opt[512];
+            snprintf(report_opt, sizeof(report_opt), "--report=%s", raw_path);
+            char* argv_m[4 + AX_COUNT + 6 + SWEEP_MAX_EXTRA + 1];
+            int n = 0;
+            argv_m[n++] = "./manager";
+            argv_m[n++] = "test";
+            for (int i = 0; i < na; ++i) argv_m[n++] = args[i];
+            argv_m[n++] = report_opt;
+            /* domyślnie silnik klientów i przyjścia bez limitu (przepustowość przy nasyceniu) */
+            argv_m[n++] = "--engine";
+            argv_m[n++] = "--rate=0";
+            for (int i = 0; i < extra_n; ++i) argv_m[n++] = argv[optind + i];
+            argv_m[n] = NULL;
+
+            long before = file_size(raw_path);
+            char line[2048];
+            if (run_manager(argv_m, timeout_s) == -1 || read_report(raw_path, before, line, sizeof(line)) == -1) {
+                fprintf(stderr, "bench_sweep: N=%d P=%d ki=%d kasy=%d klienci=%d kasa=%s piekarz=%s powtorzenie %d - blad/timeout\n",
+                        cfg[AX_STORE], cfg[AX_PRODUCTS], cfg[AX_KI], cfg[AX_CASHIERS], cfg[AX_CLIENTS],
+                        g_till_names[cfg[AX_TILL]], g_bake_names[cfg[AX_BAKE]], r);
+                continue;
+            }
+            /* raport bez którejś metryki (np. starszy ./manager) nie wchodzi do agregatów -
+               brak klucza nie może stać się próbką 0.0 */
+            int m = 0;
+            for (; m < SWEEP_METRICS; ++m) {
+                if (json_number(line, g_metrics[m].key, &vals[m * reps + ok]) == -1) break;
+            }
+            if (m < SWEEP_METRICS) {
+                fprintf(stderr, "bench_sweep: powtorzenie %d - raport bez klucza \"%s\", pomijam\n",
+                        r, g_metrics[m].key);
+                continue;
+            }
+            json_number(line, "speed", &run_speed);
+            ok++;
+        }
+
+        fprintf(out, "%s,%d,%d,%d,%d,%d,%s,%s,%g,%d,%d", tag, cfg[AX_STORE], cfg[AX_PRODUCTS], cfg[AX_KI],
+                cfg[AX_CASHIERS], cfg[AX_CLIENTS], g_till_names[cfg[AX_TILL]],
+                g_bake_names[cfg[AX_BAKE]], run_speed, reps, ok);
+        for (int m = 0; m < SWEEP_METRICS; ++m) {
+            double* v = &vals[m * reps];
+            if (ok == 0) {
+                fprintf(out, g_metrics[m].median ? "," : ",,");
+                continue;
+            }
+            if (g_metrics[m].median) {
+                qsort(v, (size_t)ok, sizeof(double), cmp_double);
+                double med = ok % 2 ? v[ok / 2] : (v[ok / 2 - 1] + v[ok / 2]) / 2.0;
+                fprintf(out, ",%.1f", med);
+            } else {
+                double sum = 0.0, sq = 0.0;
+                for (int i = 0; i < ok; ++i) sum += v[i];
+                double mean = sum / ok;
+                for (int i = 0; i < ok; ++i) sq += (v[i] - mean) * (v[i] - mean);
+                fprintf(out, ",%.3f,%.3f", mean, ok > 1 ? sqrt(sq / (ok - 1)) : 0.0);
+            }
+        }
+        fprintf(out, "\n");
+        fflush(out);
+        fprintf(stderr, "bench_sweep: %d/%d konfiguracji\n", k + 1, total);
+    }
+
+    free(vals);
+    if (out != stdout) fclose(out);
+    return 0;
+}
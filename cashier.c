@@ -1,15 +1,33 @@
 #include "common.h"
+#include "latency.h"
+#include "log_ring.h"
 
 /*
  * cashier.c – proces kasjera:
- *  - odbiera wiadomości klientów z kolejki przypisanej do tej kasy
- *  - aktualizuje sold_by_cashier[cashier_id][Pi]
- *  - reaguje na zamykanie kasy: cashier_accepting=0 -> nie przyjmuje nowych, ale obsługuje kolejkę
+ *  - odbiera koszyki klientów z kolejki przypisanej do tej kasy (albo z pierścienia
+ *    kanału kasowego w SHM przy --checkout=shm)
+ *  - aktualizuje wiersz sprzedaży kasy (bakery_sold)[Pi]
+ *  - reaguje na zamykanie kasy: accepting=0 -> nie przyjmuje nowych, ale obsługuje kolejkę
+ *  - przy cashier_batch > 1 zdejmuje naraz wszystkie czekające koszyki (do limitu)
+ *    i zmniejsza queue_len całej partii w jednej sekcji krytycznej
  *  - przy inventory_mode wypisuje podsumowanie sprzedaży
  */
 
+/* Maks. czas uśpienia na pustym pierścieniu SHM (ms) - potem ponowne sprawdzenie flag */
+#define CASHIER_WAIT_MS 200
+
 static volatile sig_atomic_t g_stop = 0;
 static volatile sig_atomic_t g_evac = 0;
+
+/* Liczniki tej kasy do podsumowania na koniec pracy */
+static int g_sales = 0;
+static int g_batches = 0;
+static int g_locks = 0;           /* wejścia do SEM_SHM_GLOBAL */
+
+static void cashier_lock(int sem_id) {
+    g_locks++;
+    shm_lock(sem_id);
+}
 static void handler(int sig) {
     if (sig == SIG_EVAC) { g_evac = 1; g_stop = 1; }
     else if (sig == SIG_INV) {
@@ -31,11 +49,11 @@ static void print_summary(const BakeryState* st, int cashier_id) {
     double total_value = 0.0;
     
     for (int i = 0; i < st->P; ++i) {
-        int qty = st->sold_by_cashier[cashier_id][i];
+        int qty = atomic_load_explicit(&bakery_sold(st, cashier_id)[i], memory_order_relaxed);
         if (qty > 0) {
-            double value = qty * st->produkty[i].cena;
+            double value = qty * bakery_product(st, i)->cena;
             fprintf(stdout, COLOR_KASJER "║" ANSI_RESET "  P%02d: %-25s %4d × %6.2f = " ANSI_BOLD "%8.2f zł" ANSI_RESET " " COLOR_KASJER "║" ANSI_RESET "\n", 
-                    i, st->produkty[i].nazwa, qty, st->produkty[i].cena, value);
+                    i, bakery_product(st, i)->nazwa, qty, bakery_product(st, i)->cena, value);
             total_items += qty;
             total_value += value;
         }
@@ -51,10 +69,60 @@ static void print_summary(const BakeryState* st, int cashier_id) {
     fprintf(stdout, COLOR_KASJER "╚══════════════════════════════════════════════════════════╝" ANSI_RESET "\n");
 }
 
+/* Koszyk odebrany z kolejki komunikatów albo ze skrzynki SHM (czytany na miejscu) */
+typedef struct Basket {
+    long client_id;
+    long long sent_us;       /* lat_now_us() wysłania przez klienta */
+    int item_count;
+    const BasketItem* items;
+    int slot;                /* skrzynka SHM albo -1 (kolejka komunikatów) */
+    ClientMsg* msg;          /* bufor dla kolejki komunikatów (basket_max pozycji) */
+} Basket;
+
+/*
+ * 0 = odebrano, -1 = brak/przerwane (errno: ENOMSG brak przy nowait, EAGAIN upłynął
+ * czas albo pobudka od kierownika - zmiana stanu sterującego, EINTR)
+ */
+static int recv_basket(const IpcHandles* h, BakeryState* st, int cashier_id, int nowait, Basket* b) {
+    if (st->checkout_mode == CHECKOUT_SHM) {
+        int slot = checkout_take(st, cashier_id, nowait ? 0 : CASHIER_WAIT_MS);
+        if (slot < 0) {
+            if (errno == EAGAIN && nowait) errno = ENOMSG;
+            return -1;
+        }
+        const CheckoutSlot* sl = bakery_checkout_slot(st, slot);
+        b->slot = slot;
+        b->client_id = sl->client_id;
+        b->sent_us = sl->sent_us;
+        b->item_count = sl->item_count;
+        b->items = sl->items;
+        return 0;
+    }
+
+    ssize_t r;
+    for (;;) {
+        r = msgrcv(h->msg_id[cashier_id], b->msg, client_msg_size(st->basket_max) - sizeof(long),
+                   CLIENT_MSG_TYPE, nowait ? IPC_NOWAIT : 0);
+        if (r == -1) return -1;
+        if (b->msg->client_id != CONTROL_WAKE_ID) break;
+        /* wiadomość budząca (control_wake_cashiers): bez czekania - szukaj dalej koszyka */
+        if (!nowait) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    b->slot = -1;
+    b->client_id = b->msg->client_id;
+    b->sent_us = b->msg->sent_us;
+    b->item_count = b->msg->item_count;
+    b->items = b->msg->items;
+    return 0;
+}
+
 /* Wysyła potwierdzenie do klienta że kasowanie zakończone */
-static void send_reply(int msg_id, pid_t client_pid, int cashier_id, double total_price, int success) {
+static void send_reply(int msg_id, long client_id, int cashier_id, double total_price, int success) {
     CashierReply reply;
-    reply.mtype = (long)client_pid;  /* klient odbiera po swoim PID */
+    reply.mtype = client_id;  /* klient odbiera po swoim identyfikatorze (PID) */
     reply.cashier_id = cashier_id;
     reply.total_price = total_price;
     reply.success = success;
@@ -64,78 +132,147 @@ static void send_reply(int msg_id, pid_t client_pid, int cashier_id, double tota
     }
 }
 
-static double process_sale(BakeryState* st, int sem_id, int cashier_id, const ClientMsg* msg) {
+static void reply_basket(const IpcHandles* h, BakeryState* st, int cashier_id, const Basket* b,
+                         double total_price, int success) {
+    if (b->slot >= 0) checkout_reply(st, b->slot, cashier_id, total_price, success);
+    else send_reply(h->msg_id[cashier_id], b->client_id, cashier_id, total_price, success);
+}
+
+/* Koszyk zdjęty z pracy kasy (TILL_WORK): kasowanie się zaczyna albo koszyk jest odrzucany */
+static void till_work_take(BakeryState* st, int cashier_id, const Basket* msg) {
+    atomic_fetch_sub_explicit(&st->cashiers[cashier_id].queue_work_ms, basket_scan_ms(msg->item_count),
+                              memory_order_relaxed);
+}
+
+static double process_sale(BakeryState* st, int cashier_id, const Basket* msg) {
+    long long start_us = lat_now_us();
+    CashierBlock* cb = &st->cashiers[cashier_id];
+    int kasowanie_ms = basket_scan_ms(msg->item_count);
+    till_work_take(st, cashier_id, msg);
+    atomic_store_explicit(&cb->scan_end_ms, vclock_now_ms() + kasowanie_ms, memory_order_relaxed);
+    lat_record(st, LAT_TILL_QUEUE, cashier_id, start_us - msg->sent_us);
+
     /* Księgowanie zakupów kasjera (sztuki per produkt) */
-    LOGF("kasjer", "KASUJĘ: klient_pid=%d, pozycji=%d (kasa=%d)",
-        (int)msg->client_pid, msg->item_count, cashier_id);
+    LOGE(KASJER, LOG_INFO, EV_KA_SALE, msg->client_id, msg->item_count, cashier_id);
     
     double total_price = 0.0;
     
-    shm_lock(sem_id);
+    /* wiersz sold tej kasy pisze tylko ona - wystarczy atomowe dodanie, bez shm_lock */
     for (int i = 0; i < msg->item_count; ++i) {
         int pid = msg->items[i].product_id;
         int qty = msg->items[i].quantity;
         if (pid >= 0 && pid < st->P && qty > 0) {
-            st->sold_by_cashier[cashier_id][pid] += qty;
-            total_price += qty * st->produkty[pid].cena;
+            atomic_fetch_add_explicit(&bakery_sold(st, cashier_id)[pid], qty, memory_order_relaxed);
+            total_price += qty * bakery_product(st, pid)->cena;
         }
     }
-    shm_unlock(sem_id);
 
     /* Symulacja kasowania - czas proporcjonalny do liczby pozycji */
-    int kasowanie_ms = 300 + msg->item_count * 150;
     msleep(kasowanie_ms);
-    
+    atomic_store_explicit(&cb->scan_end_ms, 0, memory_order_relaxed);
+    lat_record(st, LAT_TILL_SCAN, cashier_id, lat_now_us() - start_us);
+    atomic_fetch_add_explicit(&st->cashiers[cashier_id].baskets, 1, memory_order_relaxed);
+
     return total_price;
 }
 
+/* Partia koszyków zdjętych z kolejki kasy (przy cashier_batch = 1 zawsze jeden) */
+static Basket g_batch[CASHIER_BATCH_MAX];
+
+/* Dobiera bez czekania koszyki czekające w kolejce, aż do max; zwraca rozmiar partii */
+static int fill_batch(const IpcHandles* h, BakeryState* st, int cashier_id, int n, int max) {
+    while (n < max) {
+        if (recv_basket(h, st, cashier_id, 1, &g_batch[n]) == -1) {
+            if (errno == EINTR) continue;
+            if (errno != ENOMSG) perror("recv_basket (batch)");
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Kasuje partię po kolei; każdy klient dostaje odpowiedź zaraz po swoim
+ * kasowaniu, a queue_len całej partii spada w jednej sekcji krytycznej.
+ * Przy ewakuacji reszta partii dostaje odmowę. Zwraca 1 gdy była ewakuacja.
+ */
+static int serve_batch(const IpcHandles* h, BakeryState* st, int cashier_id, int n) {
+    int evac = 0;
+    for (int i = 0; i < n; ++i) {
+        if (g_evac) {
+            evac = 1;
+            till_work_take(st, cashier_id, &g_batch[i]);
+            reply_basket(h, st, cashier_id, &g_batch[i], 0.0, 0);
+            continue;
+        }
+        double price = process_sale(st, cashier_id, &g_batch[i]);
+        reply_basket(h, st, cashier_id, &g_batch[i], price, 1);
+        g_sales++;
+    }
+
+    /* koszyki zdjęte z kolejki (także odrzucone), więc licznik zmniejszamy o całą partię */
+    cashier_lock(h->sem_id);
+    int q = st->cashiers[cashier_id].queue_len;
+    st->cashiers[cashier_id].queue_len = q > n ? q - n : 0;
+    shm_unlock(h->sem_id);
+    g_batches++;
+    return evac;
+}
+
 int main(int argc, char** argv) {
     setvbuf(stdout, NULL, _IOLBF, 0);
     if (argc < 2) {
-        fprintf(stderr, "Użycie: cashier <id 0..2>\n");
+        fprintf(stderr, "Użycie: cashier <id 0..%d>\n", CASHIERS_MAX - 1);
         return EXIT_FAILURE;
     }
     int cashier_id = atoi(argv[1]);
-    if (cashier_id < 0 || cashier_id >= CASHIERS) {
+    if (cashier_id < 0 || cashier_id >= CASHIERS_MAX) {
         fprintf(stderr, "Błędny id kasjera.\n");
         return EXIT_FAILURE;
     }
 
-    srand((unsigned)time(NULL) ^ (unsigned)getpid());
     install_signal_handlers_or_die(handler);
 
     ensure_ipc_key_file_or_die();
     IpcHandles h;
     memset(&h, 0, sizeof(h));
 
-    h.shm_id = shmget(bakery_ftok_or_die(0x41), sizeof(BakeryState), IPC_PERMS_MIN);
+    h.shm_id = shmget(bakery_ftok_or_die(0x41), 0, IPC_PERMS_MIN);
     if (h.shm_id == -1) DIE_PERROR("shmget(cashier)");
 
     
     h.sem_id = semget(bakery_ftok_or_die(0x42), 0, IPC_PERMS_MIN);
     if (h.sem_id == -1) DIE_PERROR("semget(cashier)");
 
-    for (int i = 0; i < CASHIERS; ++i) {
-        h.msg_id[i] = msgget(bakery_ftok_or_die(0x50 + i), IPC_PERMS_MIN);
-        if (h.msg_id[i] == -1) DIE_PERROR("msgget(cashier)");
-    }
-
     BakeryState* st = NULL;
     ipc_attach_or_die(&h, &st);
+    ipc_open_queues_or_die(&h, st);
+    if (cashier_id >= st->cashier_count) {
+        fprintf(stderr, "Błędny id kasjera (kas: %d).\n", st->cashier_count);
+        return EXIT_FAILURE;
+    }
+    rng_thread_seed(rng_derive(st->seed, RNG_ROLE_CASHIER, cashier_id));
+
+    /* Bufory kolejki komunikatów na całą partię - rozmiar koszyka z konfiguracji w SHM */
+    for (int i = 0; i < CASHIER_BATCH_MAX; ++i) {
+        g_batch[i].msg = malloc(client_msg_size(st->basket_max));
+        if (!g_batch[i].msg) DIE_PERROR("malloc(ClientMsg)");
+    }
 
     LOGF("kasjer", "Start pracy. Stanowisko: %d", cashier_id);
 
     int prev_store_open = -1, prev_opened = -1, prev_accepting = -1, prev_evacuated = -1;
     int said_not_accepting = 0;
+    ControlView ctl = {0};
 
     while (!g_stop) {
-        /* Czy sklep nadal działa? */
-        shm_lock(h.sem_id);
-        int store_open = st->store_open;
-        int accepting = st->cashier_accepting[cashier_id];
-        int opened = st->cashier_open[cashier_id];
-        int evacuated = st->evacuated;
-        shm_unlock(h.sem_id);
+        /* Czy sklep nadal działa? (shm_lock tylko po zmianie generacji stanu) */
+        g_locks += control_refresh(st, h.sem_id, cashier_id, &ctl);
+        int store_open = ctl.store_open;
+        int accepting = ctl.cashier_accepting;
+        int opened = ctl.cashier_open;
+        int evacuated = ctl.evacuated;
         if (store_open != prev_store_open || opened != prev_opened ||
             accepting != prev_accepting || evacuated != prev_evacuated) {
 
@@ -154,38 +291,39 @@ int main(int argc, char** argv) {
         if (!store_open) {
             LOGF("kasjer", "Sklep zamknięty – opróżniam kolejkę i kończę pracę.");
             while (1) {
-                ClientMsg msg;
-                ssize_t r = msgrcv(h.msg_id[cashier_id], &msg, sizeof(ClientMsg) - sizeof(long), 0, IPC_NOWAIT);
-                if (r == -1) {
+                Basket* msg = &g_batch[0];
+                if (recv_basket(&h, st, cashier_id, 1, msg) == -1) {
                     if (errno == ENOMSG) break;
                     if (errno == EINTR) continue;
-                    perror("msgrcv (drain on store close)");
+                    perror("recv_basket (drain on store close)");
                     break;
                 }
                 
                 if (g_evac) {
                     /* wiadomość zdjęta z kolejki MQ, więc licznik też zmniejszamy */
-                    shm_lock(h.sem_id);
-                    if (st->cashier_queue_len[cashier_id] > 0) st->cashier_queue_len[cashier_id]--;
+                    cashier_lock(h.sem_id);
+                    if (st->cashiers[cashier_id].queue_len > 0) st->cashiers[cashier_id].queue_len--;
                     shm_unlock(h.sem_id);
+                    till_work_take(st, cashier_id, msg);
+                    reply_basket(&h, st, cashier_id, msg, 0.0, 0);
                     break;
                 }
-                LOGF("kasjer", "Obsługuję klienta pid=%d (pozycji: %d)", (int)msg.client_pid, msg.item_count);
-                for (int i = 0; i < msg.item_count; ++i) {
-                    int pid = msg.items[i].product_id;
-                    int qty = msg.items[i].quantity;
+                LOGE(KASJER, LOG_DEBUG, EV_KA_SERVE, msg->client_id, msg->item_count);
+                for (int i = 0; i < msg->item_count; ++i) {
+                    int pid = msg->items[i].product_id;
+                    int qty = msg->items[i].quantity;
                     if (pid >= 0 && pid < st->P && qty > 0) {
-                        LOGF("kasjer", "  - %s x%d", st->produkty[pid].nazwa, qty);
+                        LOGE(KASJER, LOG_DEBUG, EV_KA_ITEM, pid, qty);
                     } else {
-                        LOGF("kasjer", "  - (BŁĘDNY PRODUKT pid=%d, qty=%d)", pid, qty);
+                        LOGE(KASJER, LOG_DEBUG, EV_KA_BAD_ITEM, pid, qty);
                     }
                 }
-                double price1 = process_sale(st, h.sem_id, cashier_id, &msg);
-                send_reply(h.msg_id[cashier_id], msg.client_pid, cashier_id, price1, 1);
-                LOGF("kasjer", "Zakończyłem obsługę klienta pid=%d (kasa=%d, suma=%.2f zł)",
-                    (int)msg.client_pid, cashier_id, price1);
-                shm_lock(h.sem_id);
-                if (st->cashier_queue_len[cashier_id] > 0) st->cashier_queue_len[cashier_id]--;
+                double price1 = process_sale(st, cashier_id, msg);
+                reply_basket(&h, st, cashier_id, msg, price1, 1);
+                g_sales++;
+                LOGE(KASJER, LOG_INFO, EV_KA_SERVED, msg->client_id, cashier_id, LOG_F(price1));
+                cashier_lock(h.sem_id);
+                if (st->cashiers[cashier_id].queue_len > 0) st->cashiers[cashier_id].queue_len--;
                 shm_unlock(h.sem_id);
             }
             break;
@@ -193,9 +331,9 @@ int main(int argc, char** argv) {
 
         /* Sklep otwarty */
 
-        /* Kasa fizycznie zamknięta: czekaj na ponowne otwarcie */
+        /* Kasa fizycznie zamknięta: czekaj na ponowne otwarcie (pobudka od kierownika) */
         if (!opened) {
-            msleep(200);
+            control_wait(st, &ctl, 200);
             continue;
         }
 
@@ -207,86 +345,56 @@ int main(int argc, char** argv) {
             }
             int processed_any = 0;
             while (1) {
-                ClientMsg msg;
-                ssize_t r = msgrcv(h.msg_id[cashier_id], &msg, sizeof(ClientMsg) - sizeof(long), 0, IPC_NOWAIT);
-                if (r == -1) {
-                    if (errno == ENOMSG) break;
-                    if (errno == EINTR) continue;
-                    perror("msgrcv (drain on close-for-new)");
-                    break;
-                }
+                int n = fill_batch(&h, st, cashier_id, 0, st->cashier_batch);
+                if (n == 0) break;
                 processed_any = 1;
-                if (g_evac) {
-                    /* wiadomość zdjęta z kolejki MQ, więc licznik też zmniejszamy */
-                    shm_lock(h.sem_id);
-                    if (st->cashier_queue_len[cashier_id] > 0) st->cashier_queue_len[cashier_id]--;
-                    shm_unlock(h.sem_id);
-                    /* Wyślij odpowiedź że przerwano (ewakuacja) */
-                    send_reply(h.msg_id[cashier_id], msg.client_pid, cashier_id, 0.0, 0);
-                    break;
-                }
-                double price2 = process_sale(st, h.sem_id, cashier_id, &msg);
-                send_reply(h.msg_id[cashier_id], msg.client_pid, cashier_id, price2, 1);
-                shm_lock(h.sem_id);
-                if (st->cashier_queue_len[cashier_id] > 0) st->cashier_queue_len[cashier_id]--;
-                shm_unlock(h.sem_id);
+                if (serve_batch(&h, st, cashier_id, n)) break;
             }
 
             /* Jeżeli kolejka pusta -> po prostu czekaj na ponowne accepting=1 (manager) */
-            shm_lock(h.sem_id);
-            int q = st->cashier_queue_len[cashier_id];
+            cashier_lock(h.sem_id);
+            int q = st->cashiers[cashier_id].queue_len;
             shm_unlock(h.sem_id);
 
-            if (q == 0) {
-                /* nic nie rób, nie zamykaj cashier_open — tylko manager steruje */
-                msleep(100);
-            }
-
-            if (!processed_any) msleep(100);
+            /*
+             * Kolejka pusta: śpij do zmiany stanu (accepting=1, zamknięcie) -
+             * limit czasu tylko dla koszyka klienta, który zdążył przed accepting=0.
+             * Nie zamykaj cashiers[].open — tylko manager steruje.
+             */
+            if (q == 0 || !processed_any) control_wait(st, &ctl, q == 0 && !processed_any ? 200 : 100);
             continue;
         } else {
             said_not_accepting = 0;
         }
 
-        ClientMsg msg;
-        ssize_t r = msgrcv(h.msg_id[cashier_id], &msg, sizeof(ClientMsg) - sizeof(long), 0, 0);
-        if (r == -1) {
-            if (errno == EINTR) continue;
-            perror("msgrcv");
-            break;
-        }
-
-        if (g_evac) {
-            /* wiadomość zdjęta z kolejki MQ, więc licznik też zmniejszamy */
-            shm_lock(h.sem_id);
-            if (st->cashier_queue_len[cashier_id] > 0) st->cashier_queue_len[cashier_id]--;
-            shm_unlock(h.sem_id);
-            /* Wyślij odpowiedź że przerwano (ewakuacja) */
-            send_reply(h.msg_id[cashier_id], msg.client_pid, cashier_id, 0.0, 0);
+        /* Czekaj na pierwszy koszyk, resztę partii dobierz bez czekania */
+        if (recv_basket(&h, st, cashier_id, 0, &g_batch[0]) == -1) {
+            if (errno == EINTR || errno == EAGAIN) continue;   /* sygnał / upłynął czas czekania w SHM */
+            perror("recv_basket");
             break;
         }
-
-        double price3 = process_sale(st, h.sem_id, cashier_id, &msg);
-        send_reply(h.msg_id[cashier_id], msg.client_pid, cashier_id, price3, 1);
-        shm_lock(h.sem_id);
-        if (st->cashier_queue_len[cashier_id] > 0) st->cashier_queue_len[cashier_id]--;
-        shm_unlock(h.sem_id);
+        int n = fill_batch(&h, st, cashier_id, 1, st->cashier_batch);
+        if (serve_batch(&h, st, cashier_id, n)) break;
     }
 
     /* Inwentaryzacja: jeśli inventory_mode, wypisac podsumowanie */
-    shm_lock(h.sem_id);
+    cashier_lock(h.sem_id);
     int inv = st->inventory_mode;
     shm_unlock(h.sem_id);
 
     if (inv) {
-        shm_lock(h.sem_id);
         print_summary(st, cashier_id);
-        shm_unlock(h.sem_id);
+    }
+
+    if (g_sales > 0) {
+        LOGF("kasjer", "Skasowano %d koszyków w %d partiach, shm_lock: %d (%.2f na koszyk)",
+             g_sales, g_batches, g_locks, (double)g_locks / g_sales);
     }
 
     if (g_evac) LOGF("kasjer", "Kończę pracę (ewakuacja).");
     else        LOGF("kasjer", "Kończę pracę.");
 
+    for (int i = 0; i < CASHIER_BATCH_MAX; ++i) free(g_batch[i].msg);
     ipc_detach_or_die(st);
     return 0;
 }
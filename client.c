@@ -1,14 +1,19 @@
-#include "common.h"
+#include "client_core.h"
 
 /*
- * client.c – proces klienta:
- *  - czeka na wolne miejsce w sklepie (SEM_STORE_SLOTS)
- *  - robi zakupy: losuje liste min. 2 rozne produkty, probuje zdjac z podajnikow FIFO
- *  - jesli produkt niedostepny, nie kupuje
- *  - idzie do kasy i wysyla koszyk (msgsnd)
- *  - reaguje na ewakuacje: przerywa i odklada do kosza przy kasach (st->wasted[Pi])
+ * client.c – proces klienta: jeden klient na proces, kroki blokujace.
+ * Logika cyklu zycia (wejscie, zakupy, kasa, wyjscie, ewakuacja) jest w client_core.c
+ * - te sama wykonuje silnik ./client_engine dla wielu klientow w jednym procesie.
+ *
+ * Użycie:
+ *   client                                   - jeden klient
+ *   client --zygote <liczba> <klientow_na_s> - zygota: raz dolacza IPC, potem fork()
+ *                                              klientow bez execv (0 = bez limitu tempa)
  */
 
+#include <sys/mman.h>
+#include <sys/wait.h>
+
 static volatile sig_atomic_t g_evac = 0;
 static volatile sig_atomic_t g_stop = 0;
 
@@ -22,341 +27,151 @@ static void handler(int sig) {
     }
 }
 
-static int choose_cashier(const BakeryState* st) {
-    int best = -1;
-    int best_len = 0x7fffffff;
-    
-    for (int i = 0; i < CASHIERS; ++i) {
-        if (st->cashier_open[i] && st->cashier_accepting[i]) {
-            int len = st->cashier_queue_len[i];
-            if (len < best_len) {
-                best_len = len;
-                best = i;
-            }
+static long long now_ns(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/* Percentyl z posortowanej tablicy (metoda najbliższej rangi) */
+static long long percentile(const long long* sorted, int n, double p) {
+    int idx = (int)(p / 100.0 * n + 0.999999) - 1;
+    if (idx < 0) idx = 0;
+    if (idx >= n) idx = n - 1;
+    return sorted[idx];
+}
+
+static void run_client(const IpcHandles* h, BakeryState* st, long seq) {
+    /* Caly cykl zycia klienta: client_core.c (odpowiedz kasjera przychodzi z mtype = PID) */
+    ClientCtx ctx;
+    client_init(&ctx, h, st, (long)getpid(), seq, &g_stop, &g_evac, 0);
+    client_run(&ctx);
+    client_destroy(&ctx);
+}
+
+static void reap_clients(int options) {
+    while (waitpid(-1, NULL, options) > 0) { }
+}
+
+/*
+ * Zygota: IPC jest juz dolaczone, kazdy klient to sam fork() do run_client().
+ * Latencja spawnu = od wywolania fork() w zygocie do startu run_client()
+ * w dziecku (dziecko wpisuje swoja chwile gotowosci do wspolnej tablicy
+ * ready_ns); osobno czas samego wywolania fork() w zygocie.
+ */
+static void run_zygote(const IpcHandles* h, BakeryState* st, int count, double rate) {
+    long long* fork_ns = calloc((size_t)count, sizeof(long long));    /* chwila fork() */
+    long long* lat_ns = calloc((size_t)count, sizeof(long long));     /* czas wywolania fork() */
+    if (!fork_ns || !lat_ns) DIE_PERROR("calloc(zygote)");
+    size_t ready_size = (size_t)count * sizeof(_Atomic long long);
+    _Atomic long long* ready_ns = mmap(NULL, ready_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ready_ns == MAP_FAILED) DIE_PERROR("mmap(zygote)");
+
+    long long t0 = now_ns();
+    long long late_max_ns = 0;
+    int spawned = 0;
+
+    LOGF("klient", "Zygota: %d klientow, %.1f klientow/s (0 = bez limitu)", count, rate);
+
+    while (spawned < count && !g_stop && st->store_open && !st->evacuated) {
+        /* tempo w klientach na sekunde czasu symulowanego */
+        long long due = t0 + (rate > 0.0 ? (long long)(spawned * 1e9 / rate / vclock_speed()) : 0);
+        long long now = now_ns();
+        if (now < due) {
+            reap_clients(WNOHANG);
+            long long wait_ms = (due - now) / 1000000LL;
+            msleep_real(wait_ms > 10 ? 10 : (int)(wait_ms > 0 ? wait_ms : 1));
+            continue;
         }
-    }
-    
-    if (best != -1) {
-        /* jesli kolejka > 2, sprobuj inna kase accepting z kolejka <=2 */
-        if (best_len > 2) {
-            for (int i = 0; i < CASHIERS; ++i) {
-                if (i == best) continue;
-                if (st->cashier_open[i] && st->cashier_accepting[i]) {
-                    int len = st->cashier_queue_len[i];
-                    if (len <= 2) return i;
-                }
+        if (now - due > late_max_ns) late_max_ns = now - due;
+
+        fflush(stdout);
+        long long t = now_ns();
+        pid_t pid = fork();
+        if (pid == -1) {
+            if (errno == EAGAIN) {
+                /* limit procesow - poczekaj az ktorys klient wyjdzie (limit dotyczy tez innych procesow) */
+                if (waitpid(-1, NULL, 0) == -1 && errno == ECHILD) msleep_real(10);
+                continue;
             }
+            DIE_PERROR("fork(zygote)");
         }
-        return best;
+        if (pid == 0) {
+            atomic_store_explicit(&ready_ns[spawned], now_ns(), memory_order_relaxed);
+            free(fork_ns);
+            free(lat_ns);
+            run_client(h, st, spawned);
+            _exit(0);
+        }
+        fork_ns[spawned] = t;
+        lat_ns[spawned++] = now_ns() - t;
+        reap_clients(WNOHANG);
     }
 
-    for (int i = 0; i < CASHIERS; ++i) {
-        if (st->cashier_open[i]) return i;
-    }
-    return 0;
-}
+    long long spawn_ms = (now_ns() - t0) / 1000000LL;
+    reap_clients(0);
 
-/* Proba wejscia z przerwaniem przez sygnal - zwraca 0 jesli sukces, -1 jesli sygnal */
-static int sem_P_interruptible(int sem_id, int sem_num) {
-    struct sembuf op;
-    op.sem_num = (unsigned short)sem_num;
-    op.sem_op  = -1;
-    op.sem_flg = 0; /* blokujace, ale przerywane przez sygnaly */
-    
-    while (semop(sem_id, &op, 1) == -1) {
-        if (errno == EINTR) {
-            /* Sprawdz czy to sygnal zamykajacy */
-            if (g_stop || g_evac) return -1;
-            continue; /* inne przerwanie - kontynuuj czekanie */
-        }
-        perror("semop(SEM_STORE_SLOTS)");
-        return -1;
+    /* po zebraniu dzieci kazde (ktore zdazylo wystartowac) wpisalo chwile gotowosci */
+    int ready = 0;
+    for (int i = 0; i < spawned; ++i) {
+        long long r = atomic_load_explicit(&ready_ns[i], memory_order_relaxed);
+        if (r > 0) fork_ns[ready++] = r - fork_ns[i];
     }
-    return 0;
-}
 
-static int wait_before_store(int sem_id, BakeryState* st) {
-    /* Najpierw sprawdz czy jest sens czekac */
-    int current_val = semctl(sem_id, SEM_STORE_SLOTS, GETVAL);
-    
-    if (current_val == 0) {
-        /* Zwiększ licznik czekających */
-        __sync_fetch_and_add(&st->waiting_before_store, 1);
-        int waiting = st->waiting_before_store;
-        LOGF("klient", "Czekam przed sklepem - brak wolnych miejsc (w sklepie: %d/%d, w kolejce: %d).", 
-             st->N, st->N, waiting);
-        
-        /* Blokujace oczekiwanie na semafor - przerywane przez sygnaly */
-        if (sem_P_interruptible(sem_id, SEM_STORE_SLOTS) == -1) {
-            __sync_fetch_and_sub(&st->waiting_before_store, 1);
-            if (g_stop || g_evac) {
-                LOGF("klient", "Przerywam oczekiwanie przed sklepem (sygnal).");
-                return -1;
-            }
-            return -1;
-        }
-        /* Zmniejsz licznik po wejściu */
-        __sync_fetch_and_sub(&st->waiting_before_store, 1);
-    } else {
-        /* Blokujace oczekiwanie na semafor - przerywane przez sygnaly */
-        if (sem_P_interruptible(sem_id, SEM_STORE_SLOTS) == -1) {
-            if (g_stop || g_evac) {
-                LOGF("klient", "Przerywam oczekiwanie przed sklepem (sygnal).");
-                return -1;
-            }
-            return -1;
+    if (spawned > 0) {
+        qsort(lat_ns, (size_t)spawned, sizeof(long long), cmp_ll);
+        LOGF("klient", "Zygota: utworzono %d klientow w %lld ms", spawned, spawn_ms);
+        if (ready > 0) {
+            qsort(fork_ns, (size_t)ready, sizeof(long long), cmp_ll);
+            LOGF("klient", "Zygota: latencja fork->gotowosc [us] p50=%lld p90=%lld p99=%lld max=%lld (%d klientow)",
+                 percentile(fork_ns, ready, 50) / 1000, percentile(fork_ns, ready, 90) / 1000,
+                 percentile(fork_ns, ready, 99) / 1000, fork_ns[ready - 1] / 1000, ready);
         }
+        LOGF("klient", "Zygota: wywolanie fork() [us] p50=%lld p90=%lld p99=%lld max=%lld, max spoznienie=%lld ms",
+             percentile(lat_ns, spawned, 50) / 1000, percentile(lat_ns, spawned, 90) / 1000,
+             percentile(lat_ns, spawned, 99) / 1000, lat_ns[spawned - 1] / 1000,
+             late_max_ns / 1000000LL);
     }
-    
-    return 0; /* sukces - mamy slot */
+    CHECK_SYS(munmap(ready_ns, ready_size), "munmap(zygote)");
+    free(fork_ns);
+    free(lat_ns);
 }
 
-
-int main(void) {
+int main(int argc, char** argv) {
     setvbuf(stdout, NULL, _IOLBF, 0);
-    srand((unsigned)time(NULL) ^ (unsigned)getpid());
     install_signal_handlers_or_die(handler);
 
+    int zygote = argc >= 2 && strcmp(argv[1], "--zygote") == 0;
+    long seq = !zygote && argc >= 2 ? atol(argv[1]) : (long)getpid();   /* numer kolejny od kierownika */
+    int count = zygote && argc >= 3 ? atoi(argv[2]) : 0;
+    double rate = zygote && argc >= 4 ? atof(argv[3]) : 0.0;
+    if (zygote && (count <= 0 || rate < 0.0)) {
+        fprintf(stderr, "Użycie: client [numer_kolejny | --zygote <liczba_klientow> <klientow_na_s>]\n");
+        return EXIT_FAILURE;
+    }
+
     ensure_ipc_key_file_or_die();
 
     IpcHandles h;
     memset(&h, 0, sizeof(h));
 
-    h.shm_id = shmget(bakery_ftok_or_die(0x41), sizeof(BakeryState), IPC_PERMS_MIN);
+    h.shm_id = shmget(bakery_ftok_or_die(0x41), 0, IPC_PERMS_MIN);
     if (h.shm_id == -1) DIE_PERROR("shmget(client)");
 
     h.sem_id = semget(bakery_ftok_or_die(0x42), 0, IPC_PERMS_MIN);
     if (h.sem_id == -1) DIE_PERROR("semget(client)");
 
-    for (int i = 0; i < CASHIERS; ++i) {
-        h.msg_id[i] = msgget(bakery_ftok_or_die(0x50 + i), IPC_PERMS_MIN);
-        if (h.msg_id[i] == -1) DIE_PERROR("msgget(client)");
-    }
-
     BakeryState* st = NULL;
     ipc_attach_or_die(&h, &st);
+    ipc_open_queues_or_die(&h, st);
 
-    /* Czy sklep jeszcze otwarty? */
-    shm_lock(h.sem_id);
-    int open = st->store_open;
-    int P = st->P;
-    shm_unlock(h.sem_id);
-
-    if (!open) {
-        ipc_detach_or_die(st);
-        return 0;
-    }
-
-    /* Wejscie do sklepu (limit N) - blokujace oczekiwanie z obsluga sygnalow */
-    if (wait_before_store(h.sem_id, st) == -1) {
-        /* Sygnal przerwal oczekiwanie lub blad */
-        if (g_evac || g_stop) {
-            LOGF("klient", "Nie wszedlem do sklepu - ewakuacja/zamkniecie.");
-        }
-        ipc_detach_or_die(st);
-        return 0;
-    }
-    
-    /* Zwieksz customers_in_store atomowo */
-    shm_lock(h.sem_id);
-    st->customers_in_store++;
-    int curr_count = st->customers_in_store;
-    LOGF("klient", "Wchodze do sklepu (klientow w sklepie: %d/%d)", curr_count, st->N);
-    shm_unlock(h.sem_id);
-
-    /* czas wejscia/rozejrzenia sie */
-    LOGF("klient", "Rozgladam sie po sklepie...");
-    msleep(rand_between(500, 1000));
-
-    /* Losowa lista zakupow: min 2 rozne produkty */
-    int want_count = 2 + (rand_between(0, 100) < 40 ? 1 : 0); /* 2 lub 3 */
-    if (want_count > MAX_BASKET_ITEMS) want_count = MAX_BASKET_ITEMS;
-
-    ClientMsg msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.mtype = 1;
-    msg.client_pid = getpid();
-
-    /* wybierz losowe produkty i ilosci */
-    int used[MAX_P] = {0};
-
-    for (int i = 0; i < want_count; ++i) {
-        /* poruszanie sie po sklepie miedzy podajnikami */
-        msleep(rand_between(50, 150));
-        if (g_stop) break;
-        int pid;
-        do { pid = rand_between(0, P - 1); } while (used[pid]);
-        used[pid] = 1;
-
-        int qty = rand_between(1, 3);
-
-        /* Pobierz z podajnika, ale jesli brak - nie kupuj */
-        int bought = 0;
-        for (int k = 0; k < qty; ++k) {
-            /* czas na znalezienie produktu / siegniecie po kolejna sztuke */
-            msleep(rand_between(50, 150));
-            if (g_evac || g_stop) break;
-
-            /* sprobowac nowait na FULL */
-            if (sem_P_nowait(h.sem_id, SEM_CONV_FULL(pid)) == -1) {
-                if (errno == EAGAIN) {
-                    /* brak towaru */
-                    if (k == 0) {
-                        LOGF("klient", "Brak produktu %d na podajniku - pomijam", pid);
-                    }
-                    break;
-                } else {
-                    perror("semop NOWAIT FULL");
-                    break;
-                }
-            }
-
-            sem_P(h.sem_id, SEM_CONV_MUTEX(pid));
-
-            /* Zdejmij z head (FIFO) */
-            Conveyor* cv = &st->conveyors[pid];
-
-            /* Sprawdzenie poprawnosci capacity (Ki) - bezpieczenstwo przed modulo przez 0 */
-            if (cv->capacity <= 0 || cv->capacity > MAX_KI) {
-                fprintf(stderr, "[client %d] ERROR: invalid capacity=%d for product %d (MAX_KI=%d)\n", (int)getpid(), cv->capacity, pid, MAX_KI);
-                /* Cofnij pobranie z FULL (bo nie zdejmujemy faktycznie towaru) */
-                sem_V(h.sem_id, SEM_CONV_MUTEX(pid));
-                sem_V(h.sem_id, SEM_CONV_FULL(pid));
-                g_stop = 1;
-                break;
-            }
-
-            int removed = 0;
-
-            if (cv->count > 0) {
-                int pos = cv->head;
-                (void)cv->items[pos]; /* placeholder */
-                cv->items[pos] = 0;
-                cv->head = (cv->head + 1) % cv->capacity;
-                cv->count--;
-                bought++;
-                removed = 1;
-            } else {
-                fprintf(stderr,
-                    "[client %d] WARN: inconsistency on pid=%d: FULL taken but count==0 (head=%d tail=%d cap=%d)\n",
-                    (int)getpid(), pid, cv->head, cv->tail, cv->capacity);
-                removed = 0;
-            }
-
-            sem_V(h.sem_id, SEM_CONV_MUTEX(pid));
-            if (removed) {
-                sem_V(h.sem_id, SEM_CONV_EMPTY(pid));
-            } else {
-                sem_V(h.sem_id, SEM_CONV_FULL(pid));
-            }
-            
-        }
-
-        if (bought > 0 && msg.item_count < MAX_BASKET_ITEMS) {
-            msg.items[msg.item_count].product_id = pid;
-            msg.items[msg.item_count].quantity = bought;
-            msg.item_count++;
-        }
-    }
-
-    /* Ewakuacja: odkladamy do kosza i wychodzimy */
-    if (g_evac) {
-        LOGF("klient", "EWAKUACJA! Odkladam towar do kosza i wychodze.");
-        shm_lock(h.sem_id); 
-        LOGF("klient", "Zakonczono zakupy, liczba pozycji w koszyku: %d", msg.item_count);
-        for (int i = 0; i < msg.item_count; ++i) {
-            int pid = msg.items[i].product_id;
-            int qty = msg.items[i].quantity;
-            if (pid >= 0 && pid < st->P && qty > 0) st->wasted[pid] += qty;
-        }
-        shm_unlock(h.sem_id);
-
-        /* Wyjscie */
-        shm_lock(h.sem_id);
-        st->customers_in_store--;
-        shm_unlock(h.sem_id);
-        sem_V(h.sem_id, SEM_STORE_SLOTS);
-
-        ipc_detach_or_die(st);
-        return 0;
-    }
-
-    /* Wybierz kase i wyslij koszyk */
-    int cashier = 0;
-    shm_lock(h.sem_id);
-    cashier = choose_cashier(st);
-    shm_unlock(h.sem_id);
-
-    int sent_to_cashier = 0;  /* czy wyslano do kasy i trzeba czekac na odpowiedz */
-
-    /* Jesli koszyk pusty, klient moze isc prosto do wyjscia */
-    if (msg.item_count > 0) {
-        /* zanim wysle, upewnij sie ze kasa nadal przyjmuje */
-        shm_lock(h.sem_id);
-        int ok = st->cashier_open[cashier] && st->cashier_accepting[cashier] && !st->evacuated && st->store_open;
-        if (ok) st->cashier_queue_len[cashier]++;  /* klient "staje w kolejce" */
-        shm_unlock(h.sem_id);
-
-        if (ok) {
-            LOGF("klient", "Wysylam koszyk do kasy %d, item_count=%d", cashier, msg.item_count);
-            if (msgsnd(h.msg_id[cashier], &msg, sizeof(ClientMsg) - sizeof(long), 0) == -1) {
-                perror("msgsnd(client)");
-                /* cofnij licznik kolejki jesli sie nie udalo */
-                shm_lock(h.sem_id);
-                if (st->cashier_queue_len[cashier] > 0) st->cashier_queue_len[cashier]--;
-                shm_unlock(h.sem_id);
-            } else {
-                LOGF("klient", "Wybralem kase %d (dlugosc kolejki: %d), czekam na kasowanie...", cashier, st->cashier_queue_len[cashier]);
-                sent_to_cashier = 1;
-            }
-        } else {
-            LOGF("klient", "Sklep zamkniety - nie moge wyslac koszyka (%d produktow)", msg.item_count);
-        }
-    } else {
-        LOGF("klient", "Koszyk pusty - nie znalazlem zadnych produktow");
-    }
-
-    /* Czekaj na odpowiedz od kasjera (potwierdzenie zakonczenia kasowania) */
-    if (sent_to_cashier) {
-        CashierReply reply;
-        int got_reply = 0;
-        
-        /* Czekaj na wiadomosc z mtype = nasz PID */
-        while (!got_reply && !g_stop && !g_evac) {
-            ssize_t r = msgrcv(h.msg_id[cashier], &reply, sizeof(CashierReply) - sizeof(long), 
-                              (long)getpid(), 0);
-            if (r == -1) {
-                if (errno == EINTR) {
-                    /* Sprawdz czy sygnal zamykajacy */
-                    if (g_stop || g_evac) break;
-                    continue;
-                }
-                perror("msgrcv(wait for cashier reply)");
-                break;
-            }
-            got_reply = 1;
-        }
-        
-        if (got_reply) {
-            if (reply.success) {
-                LOGF("klient", "Zaplacono %.2f zl przy kasie %d", reply.total_price, reply.cashier_id);
-                msleep(rand_between(200, 400)); /* czas pakowania zakupow */
-            } else {
-                LOGF("klient", "Kasowanie przerwane (ewakuacja/zamkniecie)");
-            }
-        } else if (g_evac) {
-            LOGF("klient", "Ewakuacja podczas oczekiwania na kase - wychodze");
-        }
-    }
-
-    /* Wyjscie */
-    LOGF("klient", "Wychodze ze sklepu.");
-
-    shm_lock(h.sem_id);
-    st->customers_in_store--;
-    shm_unlock(h.sem_id);
-
-    sem_V(h.sem_id, SEM_STORE_SLOTS);
+    if (zygote) run_zygote(&h, st, count, rate);
+    else run_client(&h, st, seq);
 
     ipc_detach_or_die(st);
     return 0;
@@ -0,0 +1,426 @@
+#include "client_core.h"
+#include "latency.h"
+#include "log_ring.h"
+
+/*
+ * client_core.c – cykl życia klienta:
+ *  - czeka na wolne miejsce w sklepie (SEM_STORE_SLOTS)
+ *  - robi zakupy: losuje liste min. 2 rozne produkty, probuje zdjac z podajnikow FIFO
+ *  - jesli produkt niedostepny, nie kupuje
+ *  - idzie do kasy i wysyla koszyk (msgsnd), czeka na potwierdzenie
+ *  - reaguje na ewakuacje: przerywa i odklada do kosza przy kasach (wasted[Pi] w swoim shardzie)
+ */
+
+#define CLIENT_POLL_MIN_MS  5
+#define CLIENT_POLL_MAX_MS  50
+
+static int stopping(const ClientCtx* c) {
+    return *c->stop || *c->evac;
+}
+
+/* Proba wejscia z przerwaniem przez sygnal - zwraca 0 jesli sukces, -1 jesli sygnal */
+static int sem_P_interruptible(ClientCtx* c, int sem_num) {
+    while (sem_P_intr(c->h->sem_id, sem_num) == -1) {
+        if (errno == EINTR) {
+            /* Sprawdz czy to sygnal zamykajacy */
+            if (stopping(c)) return -1;
+            continue; /* inne przerwanie - kontynuuj czekanie */
+        }
+        perror("semop(SEM_STORE_SLOTS)");
+        return -1;
+    }
+    return 0;
+}
+
+static int next_poll_ms(ClientCtx* c) {
+    int d = c->poll_ms;
+    c->poll_ms = c->poll_ms * 2 > CLIENT_POLL_MAX_MS ? CLIENT_POLL_MAX_MS : c->poll_ms * 2;
+    return d;
+}
+
+/* Wejscie do sklepu (limit N). 0 = mamy slot, 1 = zaparkuj u odzwiernego (nieblokujaco), -1 = rezygnacja */
+static int wait_before_store(ClientCtx* c) {
+    BakeryState* st = c->st;
+    int sem_id = c->h->sem_id;
+
+    if (c->nonblocking) {
+        /* Odpowiedz odzwiernego silnika po zaparkowaniu przed wejsciem */
+        if (c->door != CLIENT_DOOR_NONE) {
+            if (c->counted_waiting) __sync_fetch_and_sub(&st->waiting_before_store, 1);
+            c->counted_waiting = 0;
+            return c->door == CLIENT_DOOR_GRANTED ? 0 : -1;
+        }
+        if (sem_P_nowait(sem_id, SEM_STORE_SLOTS) == 0) return 0;
+        if (stopping(c) || !st->store_open) return -1;
+
+        c->counted_waiting = 1;
+        __sync_fetch_and_add(&st->waiting_before_store, 1);
+        int waiting = st->waiting_before_store;
+        LOGE(KLIENT, LOG_DEBUG, EV_KL_DOOR_WAIT, st->N, st->N, waiting);
+        return 1;
+    }
+
+    /* Najpierw sprawdz czy jest sens czekac */
+    int current_val = sem_getval(sem_id, SEM_STORE_SLOTS);
+
+    if (current_val == 0) {
+        /* Zwiększ licznik czekających */
+        __sync_fetch_and_add(&st->waiting_before_store, 1);
+        int waiting = st->waiting_before_store;
+        LOGE(KLIENT, LOG_DEBUG, EV_KL_DOOR_WAIT, st->N, st->N, waiting);
+
+        /* Blokujace oczekiwanie na semafor - przerywane przez sygnaly */
+        if (sem_P_interruptible(c, SEM_STORE_SLOTS) == -1) {
+            __sync_fetch_and_sub(&st->waiting_before_store, 1);
+            if (stopping(c)) {
+                LOGE(KLIENT, LOG_DEBUG, EV_KL_DOOR_ABORT);
+                return -1;
+            }
+            return -1;
+        }
+        /* Zmniejsz licznik po wejściu */
+        __sync_fetch_and_sub(&st->waiting_before_store, 1);
+    } else {
+        /* Blokujace oczekiwanie na semafor - przerywane przez sygnaly */
+        if (sem_P_interruptible(c, SEM_STORE_SLOTS) == -1) {
+            if (stopping(c)) {
+                LOGE(KLIENT, LOG_DEBUG, EV_KL_DOOR_ABORT);
+                return -1;
+            }
+            return -1;
+        }
+    }
+
+    return 0; /* sukces - mamy slot */
+}
+
+void client_init(ClientCtx* c, const IpcHandles* h, BakeryState* st, long id, long seq,
+                 volatile sig_atomic_t* stop, volatile sig_atomic_t* evac, int nonblocking) {
+    memset(c, 0, sizeof(*c));
+    c->h = h;
+    c->st = st;
+    c->stop = stop;
+    c->evac = evac;
+    c->nonblocking = nonblocking;
+    c->id = id;
+    c->stage = CLIENT_ARRIVE;
+    c->shard = stats_client_shard(st, id);
+    c->wasted = bakery_wasted(st, stats_shard_of(id));
+    c->stockouts = bakery_stockouts(st, stats_shard_of(id));
+    c->lost = bakery_lost(st, stats_shard_of(id));
+    c->poll_ms = CLIENT_POLL_MIN_MS;
+    rng_seed(&c->rng, rng_derive(st->seed, RNG_ROLE_CLIENT, seq));
+
+    c->msg = malloc(client_msg_size(st->basket_max));
+    if (!c->msg) DIE_PERROR("malloc(ClientMsg)");
+    c->msg->mtype = CLIENT_MSG_TYPE;
+    c->msg->client_id = id;
+    c->msg->item_count = 0;
+}
+
+void client_destroy(ClientCtx* c) {
+    free(c->msg);
+    c->msg = NULL;
+}
+
+/* Pobierz z podajnika wybrany produkt, ale jesli brak - nie kupuj */
+static void take_from_conveyor(ClientCtx* c) {
+    BakeryState* st = c->st;
+    int pid = c->cur_pid;
+    int qty = c->cur_qty;
+
+    /* Zdejmij "do qty" sztuk z head (FIFO) jednym wywolaniem - jesli brak, nie kupuj */
+    long long t0 = lat_now_us();
+    int bought = conveyor_pop_up_to_n(st, c->h->sem_id, pid, qty, NULL);
+    lat_record(st, LAT_CONVEYOR, -1, lat_now_us() - t0);
+    if (bought == -1) {
+        bought = 0;
+        if (errno == EAGAIN) {
+            /* brak towaru; cały popyt utracony - sygnał dla piekarza (--bake=demand) */
+            atomic_fetch_add_explicit(&c->stockouts[pid], 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&c->lost[pid], qty, memory_order_relaxed);
+            LOGE(KLIENT, LOG_DEBUG, EV_KL_NO_PRODUCT, pid);
+        } else if (errno == EINVAL) {
+            /* Sprawdzenie poprawnosci capacity (Ki) - bezpieczenstwo przed modulo przez 0 */
+            fprintf(stderr, "[client %ld] ERROR: invalid capacity=%d for product %d (KI_LIMIT=%d)\n",
+                    c->id, bakery_conveyor(st, pid)->capacity, pid, KI_LIMIT);
+            *c->stop = 1;
+        } else {
+            perror("conveyor_pop_up_to_n");
+        }
+    } else if (bought < qty) {
+        atomic_fetch_add_explicit(&c->lost[pid], qty - bought, memory_order_relaxed);
+        LOGE(KLIENT, LOG_DEBUG, EV_KL_PARTIAL, pid, bought, qty);
+    }
+
+    if (bought > 0 && c->msg->item_count < st->basket_max) {
+        c->msg->items[c->msg->item_count].product_id = pid;
+        c->msg->items[c->msg->item_count].quantity = bought;
+        c->msg->item_count++;
+    }
+}
+
+/* Wybierz kase i wyslij koszyk. Nastepny etap: AWAIT_REPLY albo LEAVE. */
+static void checkout(ClientCtx* c) {
+    BakeryState* st = c->st;
+    const IpcHandles* h = c->h;
+
+    shm_lock(h->sem_id);
+    c->cashier = cashier_choose(st, c->id, vclock_now_ms());
+    shm_unlock(h->sem_id);
+    int cashier = c->cashier;
+
+    c->stage = CLIENT_LEAVE;
+
+    /* Jesli koszyk pusty, klient moze isc prosto do wyjscia */
+    if (c->msg->item_count <= 0) {
+        LOGE(KLIENT, LOG_DEBUG, EV_KL_EMPTY_BASKET);
+        return;
+    }
+
+    /* zanim wysle, upewnij sie ze kasa nadal przyjmuje */
+    shm_lock(h->sem_id);
+    int ok = st->cashiers[cashier].open && st->cashiers[cashier].accepting && !st->evacuated && st->store_open;
+    if (ok) cashier_queue_join(st, cashier, c->msg->item_count);  /* klient "staje w kolejce" */
+    shm_unlock(h->sem_id);
+
+    if (!ok) {
+        LOGE(KLIENT, LOG_DEBUG, EV_KL_STORE_CLOSED, c->msg->item_count);
+        return;
+    }
+
+    LOGE(KLIENT, LOG_DEBUG, EV_KL_SEND, cashier, c->msg->item_count);
+    int sent;
+    if (st->checkout_mode == CHECKOUT_SHM) {
+        c->ck_slot = checkout_submit(st, cashier, c->id, c->msg->items, c->msg->item_count);
+        sent = c->ck_slot >= 0;
+        if (!sent) perror("checkout_submit(client)");
+    } else {
+        c->msg->sent_us = lat_now_us();
+        sent = msgsnd(h->msg_id[cashier], c->msg, client_msg_size(c->msg->item_count) - sizeof(long), 0) != -1;
+        if (!sent) perror("msgsnd(client)");
+    }
+    if (!sent) {
+        /* cofnij licznik kolejki jesli sie nie udalo */
+        shm_lock(h->sem_id);
+        cashier_queue_leave(st, cashier, c->msg->item_count);
+        shm_unlock(h->sem_id);
+        return;
+    }
+    LOGE(KLIENT, LOG_DEBUG, EV_KL_CHOSE, cashier, st->cashiers[cashier].queue_len);
+    c->stage_us = lat_now_us();
+    c->poll_ms = CLIENT_POLL_MIN_MS;
+    c->stage = CLIENT_AWAIT_REPLY;
+}
+
+/* Odpowiedz w skrzynce SHM: futex na slowie state, bez przeszukiwania kolejki */
+static int await_reply_shm(ClientCtx* c, CashierReply* reply) {
+    while (!stopping(c)) {
+        if (checkout_wait(c->st, c->ck_slot, c->nonblocking, reply) == 0) return 1;
+        if (errno == EAGAIN) return 0;      /* nieblokujaco: jeszcze kasuje */
+        if (errno != EINTR) break;
+    }
+    /* sygnal zamykajacy - skrzynke zwolni kasjer */
+    checkout_abandon(c->st, c->ck_slot);
+    return -1;
+}
+
+/* Czekaj na odpowiedz od kasjera. Zwraca czas ponowienia (nieblokujaco) albo 0. */
+static int await_reply(ClientCtx* c) {
+    CashierReply reply;
+    int got_reply = 0;
+    int flags = c->nonblocking ? IPC_NOWAIT : 0;
+
+    if (c->st->checkout_mode == CHECKOUT_SHM) {
+        int r = await_reply_shm(c, &reply);
+        if (r == 0) return next_poll_ms(c);
+        got_reply = r == 1;
+    }
+
+    /* Czekaj na wiadomosc z mtype = nasz identyfikator */
+    while (c->st->checkout_mode == CHECKOUT_MQ && !got_reply && !stopping(c)) {
+        ssize_t r = msgrcv(c->h->msg_id[c->cashier], &reply, sizeof(CashierReply) - sizeof(long),
+                          c->id, flags);
+        if (r == -1) {
+            if (errno == ENOMSG) return next_poll_ms(c);   /* jeszcze kasuje */
+            if (errno == EINTR) {
+                /* Sprawdz czy sygnal zamykajacy */
+                if (stopping(c)) break;
+                continue;
+            }
+            perror("msgrcv(wait for cashier reply)");
+            break;
+        }
+        got_reply = 1;
+    }
+
+    c->stage = CLIENT_LEAVE;
+    if (got_reply) {
+        if (reply.success) {
+            lat_record(c->st, LAT_CHECKOUT, -1, lat_now_us() - c->stage_us);
+            LOGE(KLIENT, LOG_INFO, EV_KL_PAID, LOG_F(reply.total_price), reply.cashier_id);
+            c->stage = CLIENT_PACKING;
+            return rng_between(&c->rng, 200, 400); /* czas pakowania zakupow */
+        }
+        LOGE(KLIENT, LOG_INFO, EV_KL_CHECKOUT_ABORT);
+    } else if (*c->evac) {
+        LOGE(KLIENT, LOG_INFO, EV_KL_CHECKOUT_EVAC);
+    }
+    return 0;
+}
+
+int client_step(ClientCtx* c) {
+    BakeryState* st = c->st;
+    const IpcHandles* h = c->h;
+
+    switch (c->stage) {
+    case CLIENT_ARRIVE: {
+        /* Czy sklep jeszcze otwarty? */
+        shm_lock(h->sem_id);
+        int open = st->store_open;
+        c->P = st->P;
+        shm_unlock(h->sem_id);
+
+        atomic_fetch_add_explicit(&c->shard->arrivals, 1, memory_order_relaxed);
+        if (!open) {
+            atomic_fetch_add_explicit(&c->shard->rejected, 1, memory_order_relaxed);
+            c->stage = CLIENT_DONE;
+            return CLIENT_STEP_DONE;
+        }
+        c->stage = CLIENT_AT_ENTRANCE;
+        c->stage_us = lat_now_us();
+        return 0;
+    }
+
+    case CLIENT_AT_ENTRANCE: {
+        /* Wejscie do sklepu (limit N) - oczekiwanie z obsluga sygnalow */
+        int r = wait_before_store(c);
+        if (r == 1) return CLIENT_STEP_PARK;
+        if (r == -1) {
+            /* Sygnal przerwal oczekiwanie lub blad */
+            if (stopping(c) || c->nonblocking) {
+                LOGE(KLIENT, LOG_INFO, EV_KL_NOT_ENTERED);
+            }
+            atomic_fetch_add_explicit(&c->shard->rejected, 1, memory_order_relaxed);
+            c->stage = CLIENT_DONE;
+            return CLIENT_STEP_DONE;
+        }
+
+        long long now_us = lat_now_us();
+        lat_record(st, LAT_DOOR, -1, now_us - c->stage_us);
+        c->stage_us = now_us;
+
+        /* Zwieksz customers_in_store atomowo we wlasnym shardzie (bez SEM_SHM_GLOBAL) */
+        atomic_fetch_add_explicit(&c->shard->in_store, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->shard->entries, 1, memory_order_relaxed);
+        int curr_count = stats_customers_in_store(st);
+        LOGE(KLIENT, LOG_INFO, EV_KL_ENTER, curr_count, st->N);
+
+        /* czas wejscia/rozejrzenia sie */
+        LOGE(KLIENT, LOG_DEBUG, EV_KL_LOOK);
+        c->stage = CLIENT_LOOK_AROUND;
+        return rng_between(&c->rng, 500, 1000);
+    }
+
+    case CLIENT_LOOK_AROUND:
+        /* Losowa lista zakupow: min 2 rozne produkty */
+        c->want_count = 2 + (rng_between(&c->rng, 0, 100) < 40 ? 1 : 0); /* 2 lub 3 */
+        if (c->want_count > st->basket_max) c->want_count = st->basket_max;
+        if (c->want_count > c->P) c->want_count = c->P;
+        c->picked = 0;
+        c->shop_phase = 0;
+        c->stage = CLIENT_SHOPPING;
+        return 0;
+
+    case CLIENT_SHOPPING:
+        if (c->picked >= c->want_count) {
+            c->stage = *c->evac ? CLIENT_EVACUATE : CLIENT_CHECKOUT;
+            return 0;
+        }
+        if (c->shop_phase == 0) {
+            /* poruszanie sie po sklepie miedzy podajnikami */
+            c->shop_phase = 1;
+            return rng_between(&c->rng, 50, 150);
+        }
+        if (c->shop_phase == 1) {
+            if (*c->stop) {
+                c->stage = *c->evac ? CLIENT_EVACUATE : CLIENT_CHECKOUT;
+                return 0;
+            }
+            int pid, dup;
+            do {
+                pid = rng_between(&c->rng, 0, c->P - 1);
+                dup = 0;
+                for (int i = 0; i < c->picked; ++i) dup |= c->chosen[i] == pid;
+            } while (dup);
+            c->chosen[c->picked] = pid;
+            c->cur_pid = pid;
+            c->cur_qty = rng_between(&c->rng, 1, 3);
+
+            /* czas na znalezienie produktu / siegniecie po towar */
+            c->shop_phase = 2;
+            return rng_between(&c->rng, 50, 150);
+        }
+        if (stopping(c)) {
+            c->stage = *c->evac ? CLIENT_EVACUATE : CLIENT_CHECKOUT;
+            return 0;
+        }
+        take_from_conveyor(c);
+        c->picked++;
+        c->shop_phase = 0;
+        return 0;
+
+    case CLIENT_CHECKOUT:
+        if (*c->evac) {
+            c->stage = CLIENT_EVACUATE;
+            return 0;
+        }
+        lat_record(st, LAT_SHOPPING, -1, lat_now_us() - c->stage_us);
+        checkout(c);
+        return 0;
+
+    case CLIENT_AWAIT_REPLY:
+        return await_reply(c);
+
+    case CLIENT_PACKING:
+        c->stage = CLIENT_LEAVE;
+        return 0;
+
+    case CLIENT_LEAVE:
+        /* Wyjscie */
+        LOGE(KLIENT, LOG_INFO, EV_KL_EXIT);
+        atomic_fetch_sub_explicit(&c->shard->in_store, 1, memory_order_relaxed);
+        sem_V(h->sem_id, SEM_STORE_SLOTS);
+        c->stage = CLIENT_DONE;
+        return CLIENT_STEP_DONE;
+
+    case CLIENT_EVACUATE:
+        /* Ewakuacja: odkladamy do kosza i wychodzimy */
+        LOGE(KLIENT, LOG_INFO, EV_KL_EVAC);
+        LOGE(KLIENT, LOG_INFO, EV_KL_FINISHED, c->msg->item_count);
+        for (int i = 0; i < c->msg->item_count; ++i) {
+            int pid = c->msg->items[i].product_id;
+            int qty = c->msg->items[i].quantity;
+            if (pid >= 0 && pid < st->P && qty > 0) {
+                atomic_fetch_add_explicit(&c->wasted[pid], qty, memory_order_relaxed);
+            }
+        }
+
+        /* Wyjscie */
+        atomic_fetch_sub_explicit(&c->shard->in_store, 1, memory_order_relaxed);
+        sem_V(h->sem_id, SEM_STORE_SLOTS);
+        c->stage = CLIENT_DONE;
+        return CLIENT_STEP_DONE;
+
+    case CLIENT_DONE:
+    default:
+        return CLIENT_STEP_DONE;
+    }
+}
+
+void client_run(ClientCtx* c) {
+    int d;
+    while ((d = client_step(c)) >= 0) {
+        msleep(d);
+    }
+}
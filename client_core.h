@@ -0,0 +1,84 @@
+#ifndef BAKERY_CLIENT_CORE_H
+#define BAKERY_CLIENT_CORE_H
+
+/*
+ * Cykl życia klienta jako maszyna stanów - wspólny dla procesu ./client
+ * (jeden klient, kroki blokujące) i silnika ./client_engine (tysiące
+ * klientów w puli wątków, kroki nieblokujące).
+ *
+ * client_step() wykonuje jeden krok i zwraca, po ilu ms wykonać następny
+ * (0 = od razu, CLIENT_STEP_DONE = klient zakończył). Czas "chodzenia po
+ * sklepie" nie jest przesypiany w środku kroku - decyduje o nim wołający.
+ *
+ * W trybie nieblokującym klient bez wolnego miejsca zwraca CLIENT_STEP_PARK:
+ * silnik odkłada go do kolejki przed wejściem, zdobywa dla niego
+ * SEM_STORE_SLOTS (albo odmawia) i ustawia pole door przed kolejnym krokiem.
+ */
+
+#include "common.h"
+
+#define CLIENT_STEP_DONE    (-1)
+#define CLIENT_STEP_PARK    (-2)
+
+#define CLIENT_DOOR_NONE     0
+#define CLIENT_DOOR_GRANTED  1
+#define CLIENT_DOOR_REFUSED  2
+
+#define CLIENT_MAX_WANT      3   /* różnych produktów na liście zakupów */
+
+typedef enum ClientStage {
+    CLIENT_ARRIVE,          /* czy sklep jeszcze otwarty */
+    CLIENT_AT_ENTRANCE,     /* czeka na SEM_STORE_SLOTS */
+    CLIENT_LOOK_AROUND,     /* wszedł - rozgląda się */
+    CLIENT_SHOPPING,        /* zdejmuje produkty z podajników */
+    CLIENT_CHECKOUT,        /* wybór kasy i wysłanie koszyka */
+    CLIENT_AWAIT_REPLY,     /* czeka na CashierReply */
+    CLIENT_PACKING,         /* pakuje zakupy po zapłacie */
+    CLIENT_LEAVE,           /* wychodzi (zwalnia miejsce w sklepie) */
+    CLIENT_EVACUATE,        /* odkłada towar do kosza i wychodzi */
+    CLIENT_DONE
+} ClientStage;
+
+typedef struct ClientCtx {
+    const IpcHandles* h;
+    BakeryState* st;
+    volatile sig_atomic_t* stop;   /* flagi z handlera sygnałów procesu */
+    volatile sig_atomic_t* evac;
+    int nonblocking;               /* 1 = silnik: zamiast blokować zwróć czas ponowienia */
+
+    long id;                       /* mtype odpowiedzi kasjera (PID albo id z silnika) */
+    Rng rng;                       /* losowania klienta: ziarno z st->seed i numeru kolejnego */
+    ClientStage stage;
+    ClientShard* shard;
+    _Atomic int* wasted;           /* wiersz wasted shardu klienta */
+    _Atomic int* stockouts;        /* wiersz stockouts shardu klienta */
+    _Atomic int* lost;             /* wiersz lost shardu klienta (sztuki, których zabrakło) */
+    int P;
+    long long stage_us;            /* lat_now_us() początku etapu (przed sklepem / zakupy / kasa) */
+
+    /* zakupy */
+    int want_count;
+    int picked;
+    int shop_phase;                /* 0=idzie do podajnika, 1=sięga po towar */
+    int cur_pid;
+    int cur_qty;
+    int chosen[CLIENT_MAX_WANT];   /* wybrane już produkty (bez powtórzeń) */
+
+    /* kasa */
+    int counted_waiting;           /* czy zwiększył waiting_before_store */
+    int door;                      /* CLIENT_DOOR_* - decyzja odźwiernego silnika */
+    int cashier;
+    int ck_slot;                   /* skrzynka kanału kasowego w SHM (CHECKOUT_SHM) */
+    int poll_ms;                   /* backoff odpytywania w trybie nieblokującym */
+    ClientMsg* msg;                /* koszyk: do basket_max pozycji */
+} ClientCtx;
+
+void client_init(ClientCtx* c, const IpcHandles* h, BakeryState* st, long id, long seq,
+                 volatile sig_atomic_t* stop, volatile sig_atomic_t* evac, int nonblocking);
+void client_destroy(ClientCtx* c);
+int  client_step(ClientCtx* c);
+
+/* Cały cykl życia w bieżącym wątku (msleep między krokami) */
+void client_run(ClientCtx* c);
+
+#endif /* BAKERY_CLIENT_CORE_H */
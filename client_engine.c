@@ -0,0 +1,279 @@
+#include "client_core.h"
+
+#include <pthread.h>
+
+/*
+ * client_engine.c – silnik klientów: jeden proces, tysiące klientów.
+ *
+ * Każdy klient to maszyna stanów z client_core.c (ten sam cykl życia co
+ * ./client). Pula wątków wykonuje kroki klientów w kolejności terminów
+ * (kopiec min po czasie następnego kroku) - "chodzenie po sklepie" to wpis
+ * w kopcu, nie uśpiony wątek. Klienci czekający przed wejściem parkują w
+ * kolejce FIFO, a jeden wątek "odźwierny" zdobywa dla nich SEM_STORE_SLOTS.
+ * Silnik współpracuje z prawdziwym piekarzem i kasjerami przez te same SHM,
+ * semafory i kolejki komunikatów.
+ *
+ * Użycie: client_engine <liczba_klientow> [watki=8] [klientow_na_s=0 (bez limitu)]
+ */
+
+#define ENGINE_DEFAULT_THREADS  8
+#define ENGINE_MAX_THREADS      256
+#define ENGINE_DOOR_WAIT_MS     50   /* ms rzeczywiste: najdłuższe czekanie przed sprawdzeniem zamknięcia */
+
+static volatile sig_atomic_t g_stop = 0;
+static volatile sig_atomic_t g_evac = 0;
+
+static void handler(int sig) {
+    if (sig == SIG_EVAC) { g_evac = 1; g_stop = 1; }
+    else if (sig == SIG_INV) {
+        /* inwentaryzacja: nie zatrzymuje procesow */
+        return;
+    } else {
+        g_stop = 1; /* SIGINT / SIGTERM */
+    }
+}
+
+typedef struct HeapEntry {
+    long long due_us;             /* CLOCK_MONOTONIC, us */
+    int idx;
+} HeapEntry;
+
+typedef struct Engine {
+    pthread_mutex_t mu;
+    pthread_cond_t  work_cv;      /* nowy wpis w kopcu / koniec */
+    pthread_cond_t  door_cv;      /* ktoś zaparkował przed wejściem / koniec */
+
+    ClientCtx* clients;
+    int count;
+    int active;                   /* klienci jeszcze nie zakończeni */
+    int finished;
+
+    HeapEntry* heap;              /* kopiec min po due_us */
+    int heap_n;
+
+    int* door;                    /* kolejka FIFO czekających przed wejściem */
+    int door_head;
+    int door_n;
+} Engine;
+
+static Engine g_eng;
+
+static long long now_us(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+/* Kroki klientow podaja ms czasu symulowanego - przelicz na us rzeczywiste */
+static long long sim_ms_to_us(double ms) {
+    return (long long)(ms * 1000.0 / vclock_speed());
+}
+
+/* =========================
+ *  Kopiec terminów (pod g_eng.mu)
+ * ========================= */
+
+static void heap_push(long long due_us, int idx) {
+    int i = g_eng.heap_n++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (g_eng.heap[parent].due_us <= due_us) break;
+        g_eng.heap[i] = g_eng.heap[parent];
+        i = parent;
+    }
+    g_eng.heap[i].due_us = due_us;
+    g_eng.heap[i].idx = idx;
+}
+
+static HeapEntry heap_pop(void) {
+    HeapEntry top = g_eng.heap[0];
+    HeapEntry last = g_eng.heap[--g_eng.heap_n];
+    int i = 0;
+    for (;;) {
+        int l = 2 * i + 1;
+        if (l >= g_eng.heap_n) break;
+        int m = (l + 1 < g_eng.heap_n && g_eng.heap[l + 1].due_us < g_eng.heap[l].due_us) ? l + 1 : l;
+        if (last.due_us <= g_eng.heap[m].due_us) break;
+        g_eng.heap[i] = g_eng.heap[m];
+        i = m;
+    }
+    if (g_eng.heap_n > 0) g_eng.heap[i] = last;
+    return top;
+}
+
+static void client_finished_locked(void) {
+    g_eng.active--;
+    g_eng.finished++;
+    if (g_eng.finished % 1000 == 0) {
+        LOGF("silnik", "Obsluzono %d/%d klientow", g_eng.finished, g_eng.count);
+    }
+    if (g_eng.active == 0) {
+        pthread_cond_broadcast(&g_eng.work_cv);
+        pthread_cond_broadcast(&g_eng.door_cv);
+    }
+}
+
+/* =========================
+ *  Wątki
+ * ========================= */
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_eng.mu);
+    for (;;) {
+        if (g_eng.active == 0) break;
+        if (g_eng.heap_n == 0) {
+            pthread_cond_wait(&g_eng.work_cv, &g_eng.mu);
+            continue;
+        }
+        long long due = g_eng.heap[0].due_us;
+        if (due > now_us()) {
+            struct timespec ts = { (time_t)(due / 1000000), (long)(due % 1000000) * 1000L };
+            pthread_cond_timedwait(&g_eng.work_cv, &g_eng.mu, &ts);
+            continue;
+        }
+        HeapEntry e = heap_pop();
+        pthread_mutex_unlock(&g_eng.mu);
+
+        int d = client_step(&g_eng.clients[e.idx]);
+
+        pthread_mutex_lock(&g_eng.mu);
+        if (d >= 0) {
+            heap_push(now_us() + sim_ms_to_us(d), e.idx);
+            pthread_cond_signal(&g_eng.work_cv);
+        } else if (d == CLIENT_STEP_PARK) {
+            g_eng.door[(g_eng.door_head + g_eng.door_n) % g_eng.count] = e.idx;
+            g_eng.door_n++;
+            pthread_cond_signal(&g_eng.door_cv);
+        } else {
+            client_finished_locked();
+        }
+    }
+    pthread_mutex_unlock(&g_eng.mu);
+    return NULL;
+}
+
+/* Odźwierny: zdobywa SEM_STORE_SLOTS dla kolejnych klientów z kolejki przed wejściem */
+static void* door_main(void* arg) {
+    const IpcHandles* h = (const IpcHandles*)arg;
+    BakeryState* st = g_eng.clients[0].st;
+
+    pthread_mutex_lock(&g_eng.mu);
+    for (;;) {
+        if (g_eng.active == 0) break;
+        if (g_eng.door_n == 0) {
+            pthread_cond_wait(&g_eng.door_cv, &g_eng.mu);
+            continue;
+        }
+        int idx = g_eng.door[g_eng.door_head];
+        g_eng.door_head = (g_eng.door_head + 1) % g_eng.count;
+        g_eng.door_n--;
+        pthread_mutex_unlock(&g_eng.mu);
+
+        /*
+         * Jeden czekający zamiast tysięcy: śpi na semaforze miejsc, a co
+         * ENGINE_DOOR_WAIT_MS sprawdza zamknięcie sklepu i sygnał.
+         */
+        int result = CLIENT_DOOR_REFUSED;
+        while (!g_stop && st->store_open) {
+            if (sem_P_timed(h->sem_id, SEM_STORE_SLOTS, ENGINE_DOOR_WAIT_MS) == 0) {
+                result = CLIENT_DOOR_GRANTED;
+                break;
+            }
+            if (errno != EAGAIN && errno != EINTR) DIE_PERROR("sem_P_timed(door)");
+        }
+        g_eng.clients[idx].door = result;
+
+        pthread_mutex_lock(&g_eng.mu);
+        heap_push(now_us(), idx);
+        pthread_cond_signal(&g_eng.work_cv);
+    }
+    pthread_mutex_unlock(&g_eng.mu);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (argc < 2) {
+        fprintf(stderr, "Użycie: client_engine <liczba_klientow> [watki] [klientow_na_s]\n");
+        return EXIT_FAILURE;
+    }
+    int count = atoi(argv[1]);
+    int threads = argc >= 3 ? atoi(argv[2]) : ENGINE_DEFAULT_THREADS;
+    double rate = argc >= 4 ? atof(argv[3]) : 0.0;
+    if (count <= 0 || threads <= 0 || threads > ENGINE_MAX_THREADS || rate < 0.0) {
+        fprintf(stderr, "Błędne parametry silnika klientów.\n");
+        return EXIT_FAILURE;
+    }
+
+    install_signal_handlers_or_die(handler);
+
+    ensure_ipc_key_file_or_die();
+
+    IpcHandles h;
+    memset(&h, 0, sizeof(h));
+
+    h.shm_id = shmget(bakery_ftok_or_die(0x41), 0, IPC_PERMS_MIN);
+    if (h.shm_id == -1) DIE_PERROR("shmget(client_engine)");
+
+    h.sem_id = semget(bakery_ftok_or_die(0x42), 0, IPC_PERMS_MIN);
+    if (h.sem_id == -1) DIE_PERROR("semget(client_engine)");
+
+    BakeryState* st = NULL;
+    ipc_attach_or_die(&h, &st);
+    ipc_open_queues_or_die(&h, st);
+
+    memset(&g_eng, 0, sizeof(g_eng));
+    g_eng.count = count;
+    g_eng.active = count;
+    g_eng.clients = calloc((size_t)count, sizeof(ClientCtx));
+    g_eng.heap = calloc((size_t)count, sizeof(HeapEntry));
+    g_eng.door = calloc((size_t)count, sizeof(int));
+    if (!g_eng.clients || !g_eng.heap || !g_eng.door) DIE_PERROR("calloc(client_engine)");
+
+    CHECK_SYS(-(pthread_mutex_init(&g_eng.mu, NULL) != 0), "pthread_mutex_init");
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    CHECK_SYS(-(pthread_cond_init(&g_eng.work_cv, &ca) != 0), "pthread_cond_init");
+    CHECK_SYS(-(pthread_cond_init(&g_eng.door_cv, &ca) != 0), "pthread_cond_init");
+    pthread_condattr_destroy(&ca);
+
+    /* Przyjścia: co 1/rate s symulowanych (rate=0 -> wszyscy od razu, wejście i tak ogranicza N) */
+    long long t0 = now_us();
+    for (int i = 0; i < count; ++i) {
+        /* id > dowolny PID: (pid silnika << 32) | numer klienta */
+        long id = ((long)getpid() << 32) | (long)(i + 1);
+        client_init(&g_eng.clients[i], &h, st, id, i, &g_stop, &g_evac, 1);
+        long long due = t0 + (rate > 0.0 ? sim_ms_to_us(i * 1000.0 / rate) : 0);
+        heap_push(due, i);
+    }
+
+    LOGF("silnik", "Start: %d klientow, %d watkow, %.1f klientow/s", count, threads,
+         rate > 0.0 ? rate : 0.0);
+
+    pthread_t* tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!tids) DIE_PERROR("calloc(threads)");
+    for (int i = 0; i < threads; ++i) {
+        if (pthread_create(&tids[i], NULL, worker_main, NULL) != 0) DIE_PERROR("pthread_create");
+    }
+    pthread_t door_tid;
+    if (pthread_create(&door_tid, NULL, door_main, &h) != 0) DIE_PERROR("pthread_create(door)");
+
+    for (int i = 0; i < threads; ++i) pthread_join(tids[i], NULL);
+    pthread_join(door_tid, NULL);
+
+    LOGF("silnik", "Koniec: obsluzono %d klientow w %lld ms", g_eng.finished, (now_us() - t0) / 1000);
+
+    free(tids);
+    for (int i = 0; i < count; ++i) client_destroy(&g_eng.clients[i]);
+    free(g_eng.clients);
+    free(g_eng.heap);
+    free(g_eng.door);
+    pthread_cond_destroy(&g_eng.work_cv);
+    pthread_cond_destroy(&g_eng.door_cv);
+    pthread_mutex_destroy(&g_eng.mu);
+
+    ipc_detach_or_die(st);
+    return 0;
+}
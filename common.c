@@ -1,4 +1,14 @@
 #include "common.h"
+#include "latency.h"
+#include "log_ring.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* SHM podłączona w tym procesie - backend futex trzyma w niej semafory */
+static BakeryState* g_attached_state = NULL;
 
 /* =========================
  *  ftok() i plik klucza
@@ -24,21 +34,120 @@ key_t bakery_ftok_or_die(int proj_id) {
  *  IPC create/attach/destroy
  * ========================= */
 
-static void init_state_defaults(BakeryState* st) {
-    memset(st, 0, sizeof(*st));
+/* Wyrównanie regionów segmentu: pełne linie cache (PACKED: tylko wyrównanie typów) */
+#ifdef BAKERY_PACKED_LAYOUT
+#define REGION_ALIGN        ((size_t)_Alignof(max_align_t))
+#else
+#define REGION_ALIGN        ((size_t)CACHE_LINE)
+#endif
+
+static size_t region_round(size_t n) {
+    return (n + REGION_ALIGN - 1) / REGION_ALIGN * REGION_ALIGN;
+}
+
+size_t bakery_layout(BakeryState* st, const ShmConfig* cfg) {
+    int P = cfg->P;
+    const int* Ki = cfg->Ki;
+    size_t off = region_round(sizeof(BakeryState));
+    size_t row = region_round((size_t)P * sizeof(_Atomic int));
+
+    size_t off_products = off;
+    off += region_round((size_t)P * sizeof(Product));
+
+    size_t off_table = off;
+    off += region_round((size_t)P * sizeof(size_t));
+    for (int i = 0; i < P; ++i) {
+        if (st) {
+            ((size_t*)BAKERY_REGION(st, off_table))[i] = off;
+            ((Conveyor*)BAKERY_REGION(st, off))->capacity = Ki[i];
+        }
+        off += region_round(sizeof(Conveyor) + (size_t)Ki[i] * sizeof(ConveyorSlot));
+    }
+
+    size_t off_sold = off;
+    off += (size_t)cfg->cashiers * row;
+    size_t off_wasted = off;
+    off += CLIENT_SHARDS * row;
+    size_t off_stockouts = off;
+    off += CLIENT_SHARDS * row;
+    size_t off_lost = off;
+    off += CLIENT_SHARDS * row;
+    size_t off_owner = off;
+    off += row;
+    size_t off_lat = off;
+    off += region_round(lat_region_size(cfg->cashiers));
+
+    /* Semafory futex tylko w backendzie SYNC=futex */
+    size_t off_sems = 0;
+#ifdef BAKERY_SYNC_FUTEX
+    off_sems = off;
+    off += region_round((size_t)sem_count_for_P(P) * sizeof(FutexSem));
+#endif
+
+    /* Kanał kasowy tylko przy CHECKOUT_SHM: skrzynka na każde miejsce w sklepie */
+    size_t off_rings = 0, ring_size = 0, off_used = 0, off_slots = 0, slot_size = 0;
+    int slots = 0;
+    if (cfg->checkout_mode == CHECKOUT_SHM) {
+        int words = cfg->store_n > 0 ? (cfg->store_n + CHECKOUT_SLOT_BITS - 1) / CHECKOUT_SLOT_BITS : 1;
+        slots = words * CHECKOUT_SLOT_BITS;
+        ring_size = region_round(sizeof(CheckoutRing) + (size_t)slots * sizeof(CheckoutCell));
+        off_rings = off;
+        off += (size_t)cfg->cashiers * ring_size;
+        off_used = off;
+        off += region_round((size_t)words * sizeof(_Atomic uint64_t));
+        slot_size = region_round(sizeof(CheckoutSlot) + (size_t)cfg->basket_max * sizeof(BasketItem));
+        off_slots = off;
+        off += (size_t)slots * slot_size;
+    }
+
+    /* Pierścień logu binarnego tylko przy --log=ring */
+    size_t off_log = 0;
+    if (cfg->log_records > 0) {
+        off_log = off;
+        off += region_round(log_ring_size(cfg->log_records));
+    }
+
+    if (st) {
+        st->P = P;
+        st->shm_size = off;
+        st->basket_max = cfg->basket_max;
+        st->cashier_count = cfg->cashiers;
+        st->off_products = off_products;
+        st->off_conveyor_table = off_table;
+        st->off_sold = off_sold;
+        st->off_wasted = off_wasted;
+        st->off_stockouts = off_stockouts;
+        st->off_lost = off_lost;
+        st->off_baker_owner = off_owner;
+        st->counter_row = row;
+        st->off_sync_sems = off_sems;
+        st->off_checkout_rings = off_rings;
+        st->checkout_ring_size = ring_size;
+        st->off_checkout_used = off_used;
+        st->off_checkout_slots = off_slots;
+        st->checkout_slot_size = slot_size;
+        st->checkout_slots = slots;
+        st->off_log_ring = off_log;
+        st->off_latency = off_lat;
+    }
+    return off;
+}
+
+static void init_state_defaults(BakeryState* st, size_t size) {
+    memset(st, 0, size);
     st->store_open = 1;
     st->inventory_mode = 0;
     st->evacuated = 0;
 
-    for (int c = 0; c < CASHIERS; ++c) {
-        st->cashier_open[c] = (c == 0) ? 1 : 0;     /* zawsze min. 1 działa */
-        st->cashier_accepting[c] = st->cashier_open[c];
+    for (int c = 0; c < CASHIERS_MAX; ++c) {
+        st->cashiers[c].open = (c == 0) ? 1 : 0;     /* zawsze min. 1 działa */
+        st->cashiers[c].accepting = st->cashiers[c].open;
     }
 }
 
-/* Uwaga: tworzymy segment SHM o stałej wielkości BakeryState (wstępna wersja). */
-void ipc_create_or_die(IpcHandles* out, int P) {
-    if (!out) {
+/* Segment SHM ma rozmiar z bakery_layout - pozostałe procesy dołączają go bez znajomości rozmiaru */
+void ipc_create_or_die(IpcHandles* out, const ShmConfig* cfg) {
+    if (!out || !cfg || cfg->cashiers < CASHIERS_MIN || cfg->cashiers > CASHIERS_MAX) {
         errno = EINVAL;
         DIE_PERROR("ipc_create_or_die(out==NULL)");
     }
@@ -47,17 +156,20 @@ void ipc_create_or_die(IpcHandles* out, int P) {
 
     /* SHM */
     key_t shm_key = bakery_ftok_or_die(0x41);
-    int shm_id = shmget(shm_key, sizeof(BakeryState), IPC_CREAT | IPC_EXCL | IPC_PERMS_MIN);
+    size_t shm_size = bakery_layout(NULL, cfg);
+    int shm_id = shmget(shm_key, shm_size, IPC_CREAT | IPC_EXCL | IPC_PERMS_MIN);
     if (shm_id == -1) DIE_PERROR("shmget");
 
     /* SEM */
     key_t sem_key = bakery_ftok_or_die(0x42);
+    int P = cfg->P;
     int sem_n = sem_count_for_P(P);
     int sem_id = semget(sem_key, sem_n, IPC_CREAT | IPC_EXCL | IPC_PERMS_MIN);
     if (sem_id == -1) DIE_PERROR("semget");
 
-    /* MSG (3 kolejki) */
-    for (int i = 0; i < CASHIERS; ++i) {
+    /* MSG (kolejka na kasę) */
+    for (int i = 0; i < CASHIERS_MAX; ++i) out->msg_id[i] = -1;
+    for (int i = 0; i < cfg->cashiers; ++i) {
         key_t msg_key = bakery_ftok_or_die(0x50 + i);
         int msg_id = msgget(msg_key, IPC_CREAT | IPC_EXCL | IPC_PERMS_MIN);
         if (msg_id == -1) DIE_PERROR("msgget");
@@ -71,7 +183,8 @@ void ipc_create_or_die(IpcHandles* out, int P) {
     BakeryState* st = (BakeryState*)shmat(shm_id, NULL, 0);
     CHECK_PTR(st, "shmat (create)");
 
-    init_state_defaults(st);
+    init_state_defaults(st, shm_size);
+    bakery_layout(st, cfg);
 
     /* Zainicjalizuj semafory */
     union semun arg;
@@ -92,6 +205,16 @@ void ipc_create_or_die(IpcHandles* out, int P) {
     arg.array = vals;
     CHECK_SYS(semctl(sem_id, 0, SETALL, arg), "semctl(SETALL)");
 
+    /* Te same wartości początkowe dla backendu futex */
+#ifdef BAKERY_SYNC_FUTEX
+    for (int i = 0; i < sem_n; ++i) {
+        FutexSem* fs = bakery_sync_sem(st, i);
+        atomic_init(&fs->value, vals[i]);
+        atomic_init(&fs->waiters, 0);
+        atomic_init(&fs->spin, FUTEX_SPIN_MIN);
+    }
+#endif
+
     free(vals);
 
     CHECK_SYS(shmdt(st), "shmdt (create)");
@@ -104,11 +227,27 @@ void ipc_attach_or_die(const IpcHandles* h, BakeryState** out_state) {
     }
     BakeryState* st = (BakeryState*)shmat(h->shm_id, NULL, 0);
     CHECK_PTR(st, "shmat (attach)");
+    g_attached_state = st;
     *out_state = st;
 }
 
+/* Kolejki kas istniejących w segmencie - liczba kas jest znana dopiero po dołączeniu */
+void ipc_open_queues_or_die(IpcHandles* h, const BakeryState* st) {
+    for (int i = 0; i < CASHIERS_MAX; ++i) {
+        h->msg_id[i] = -1;
+        if (i >= st->cashier_count) continue;
+        h->msg_id[i] = msgget(bakery_ftok_or_die(0x50 + i), IPC_PERMS_MIN);
+        if (h->msg_id[i] == -1) DIE_PERROR("msgget");
+    }
+}
+
+BakeryState* bakery_attached_state(void) {
+    return g_attached_state;
+}
+
 void ipc_detach_or_die(BakeryState* state) {
     if (!state) return;
+    if (state == g_attached_state) g_attached_state = NULL;
     CHECK_SYS(shmdt(state), "shmdt");
 }
 
@@ -116,8 +255,8 @@ void ipc_destroy_or_die(const IpcHandles* h, int P) {
     (void)P; 
     if (!h) return;
 
-    /* Kolejki */
-    for (int i = 0; i < CASHIERS; ++i) {
+    /* Kolejki (nieutworzone mają -1) */
+    for (int i = 0; i < CASHIERS_MAX; ++i) {
         if (h->msg_id[i] != -1) {
             CHECK_SYS(msgctl(h->msg_id[i], IPC_RMID, NULL), "msgctl(IPC_RMID)");
         }
@@ -135,10 +274,171 @@ void ipc_destroy_or_die(const IpcHandles* h, int P) {
 
 }
 
+/* =========================
+ *  Futex (współdzielony między procesami)
+ * ========================= */
+
+int futex_wait(_Atomic uint32_t* addr, uint32_t expected, const struct timespec* timeout) {
+    /* Bez FUTEX_PRIVATE_FLAG - słowo leży w SHM wielu procesów */
+    return (int)syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+int futex_wake(_Atomic uint32_t* addr, int count) {
+    return (int)syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
 /* =========================
  *  Semafory: P/V
  * ========================= */
 
+static long long monotonic_ns(void);
+
+#ifdef BAKERY_SYNC_FUTEX
+
+static FutexSem* fsem_get(int sem_num) {
+    if (!g_attached_state || sem_num < 0 || sem_num >= sem_count_for_P(g_attached_state->P)) {
+        errno = EINVAL;
+        DIE_PERROR("futex sem (brak podłączonej SHM)");
+    }
+    return bakery_sync_sem(g_attached_state, sem_num);
+}
+
+static int fsem_try_down(FutexSem* s, uint32_t n) {
+    uint32_t v = atomic_load_explicit(&s->value, memory_order_relaxed);
+    while (v >= n) {
+        if (atomic_compare_exchange_weak_explicit(&s->value, &v, v - n,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * P(n): kręć się do s->spin razy (limit adaptuje się jak w glibc - średnia
+ * krocząca liczby obrotów, które wystarczyły), potem śpij w FUTEX_WAIT.
+ * interruptible=1 -> EINTR przerywa oczekiwanie (zwraca -1).
+ */
+static int fsem_down(FutexSem* s, uint32_t n, int interruptible) {
+    if (fsem_try_down(s, n) == 0) return 0;
+
+    int32_t limit = atomic_load_explicit(&s->spin, memory_order_relaxed);
+    int32_t spins = 0;
+    while (spins < limit) {
+        cpu_relax();
+        ++spins;
+        if (fsem_try_down(s, n) == 0) {
+            int32_t grown = limit + (spins * 2 - limit) / 8;
+            if (grown > FUTEX_SPIN_MAX) grown = FUTEX_SPIN_MAX;
+            if (grown < FUTEX_SPIN_MIN) grown = FUTEX_SPIN_MIN;
+            atomic_store_explicit(&s->spin, grown, memory_order_relaxed);
+            return 0;
+        }
+    }
+    /* kręcenie się nie pomogło - następnym razem krócej */
+    int32_t shrunk = limit - limit / 8;
+    atomic_store_explicit(&s->spin, shrunk < FUTEX_SPIN_MIN ? FUTEX_SPIN_MIN : shrunk, memory_order_relaxed);
+
+    for (;;) {
+        if (fsem_try_down(s, n) == 0) return 0;
+
+        /* Dekker z fsem_up: najpierw zgłoś się jako czekający, potem sprawdź wartość */
+        atomic_fetch_add_explicit(&s->waiters, 1, memory_order_seq_cst);
+        uint32_t v = atomic_load_explicit(&s->value, memory_order_seq_cst);
+        int rc = 0;
+        if (v < n) rc = futex_wait(&s->value, v, NULL);
+        int err = errno;
+        atomic_fetch_sub_explicit(&s->waiters, 1, memory_order_relaxed);
+
+        if (rc == -1 && err == EINTR && interruptible) {
+            errno = EINTR;
+            return -1;
+        }
+        /* EAGAIN (wartość się zmieniła) / wybudzenie -> spróbuj ponownie */
+    }
+}
+
+static void fsem_up(FutexSem* s, uint32_t n) {
+    atomic_fetch_add_explicit(&s->value, n, memory_order_seq_cst);
+    uint32_t w = atomic_load_explicit(&s->waiters, memory_order_seq_cst);
+    if (w > 0) futex_wake(&s->value, (int)(w < n ? w : n));
+}
+
+void sem_P(int sem_id, int sem_num) {
+    (void)sem_id;
+    fsem_down(fsem_get(sem_num), 1, 0);
+}
+
+int sem_P_intr(int sem_id, int sem_num) {
+    (void)sem_id;
+    return fsem_down(fsem_get(sem_num), 1, 1);
+}
+
+int sem_P_nowait(int sem_id, int sem_num) {
+    (void)sem_id;
+    if (fsem_try_down(fsem_get(sem_num), 1) == -1) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+/* P z terminem: bez kręcenia się - czekający z limitem czasu i tak woli spać */
+int sem_P_timed(int sem_id, int sem_num, int timeout_ms) {
+    (void)sem_id;
+    FutexSem* s = fsem_get(sem_num);
+    long long deadline = monotonic_ns() + (long long)timeout_ms * 1000000LL;
+    for (;;) {
+        if (fsem_try_down(s, 1) == 0) return 0;
+        long long left = deadline - monotonic_ns();
+        if (left <= 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        struct timespec ts = { .tv_sec = (time_t)(left / 1000000000LL), .tv_nsec = (long)(left % 1000000000LL) };
+
+        atomic_fetch_add_explicit(&s->waiters, 1, memory_order_seq_cst);
+        uint32_t v = atomic_load_explicit(&s->value, memory_order_seq_cst);
+        int rc = 0;
+        if (v < 1) rc = futex_wait(&s->value, v, &ts);
+        int err = errno;
+        atomic_fetch_sub_explicit(&s->waiters, 1, memory_order_relaxed);
+
+        if (rc == -1 && err == EINTR) {
+            errno = EINTR;
+            return -1;
+        }
+        /* ETIMEDOUT -> termin sprawdzi kolejny obrót, EAGAIN / wybudzenie -> ponów */
+    }
+}
+
+void sem_V(int sem_id, int sem_num) {
+    (void)sem_id;
+    fsem_up(fsem_get(sem_num), 1);
+}
+
+int sem_getval(int sem_id, int sem_num) {
+    (void)sem_id;
+    return (int)atomic_load_explicit(&fsem_get(sem_num)->value, memory_order_relaxed);
+}
+
+void sem_setval(int sem_id, int sem_num, int val) {
+    (void)sem_id;
+    FutexSem* s = fsem_get(sem_num);
+    atomic_store_explicit(&s->value, (uint32_t)val, memory_order_seq_cst);
+    if (atomic_load_explicit(&s->waiters, memory_order_seq_cst) > 0) futex_wake(&s->value, INT_MAX);
+}
+
+#else /* System V */
+
 static void semop_or_die(int sem_id, unsigned short sem_num, short delta, int flags) {
     struct sembuf op;
     op.sem_num = sem_num;
@@ -155,6 +455,16 @@ void sem_P(int sem_id, int sem_num) {
     semop_or_die(sem_id, (unsigned short)sem_num, -1, 0);
 }
 
+int sem_P_intr(int sem_id, int sem_num) {
+    struct sembuf op;
+    op.sem_num = (unsigned short)sem_num;
+    op.sem_op  = -1;
+    op.sem_flg = 0; /* blokujace, ale przerywane przez sygnaly */
+
+    if (semop(sem_id, &op, 1) == -1) return -1;
+    return 0;
+}
+
 int sem_P_nowait(int sem_id, int sem_num) {
     struct sembuf op;
     op.sem_num = (unsigned short)sem_num;
@@ -168,10 +478,34 @@ int sem_P_nowait(int sem_id, int sem_num) {
     return 0;
 }
 
+int sem_P_timed(int sem_id, int sem_num, int timeout_ms) {
+    struct sembuf op;
+    op.sem_num = (unsigned short)sem_num;
+    op.sem_op  = -1;
+    op.sem_flg = 0;
+
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+    return semtimedop(sem_id, &op, 1, &ts) == -1 ? -1 : 0;   /* EAGAIN = upłynął czas */
+}
+
 void sem_V(int sem_id, int sem_num) {
     semop_or_die(sem_id, (unsigned short)sem_num, +1, 0);
 }
 
+int sem_getval(int sem_id, int sem_num) {
+    return semctl(sem_id, sem_num, GETVAL);
+}
+
+void sem_setval(int sem_id, int sem_num, int val) {
+    union semun arg;
+    arg.val = val;
+    CHECK_SYS(semctl(sem_id, sem_num, SETVAL, arg), "semctl(SETVAL)");
+}
+
+#endif /* BAKERY_SYNC_FUTEX */
+
 void shm_lock(int sem_id) {
     sem_P(sem_id, SEM_SHM_GLOBAL);
 }
@@ -179,33 +513,815 @@ void shm_unlock(int sem_id) {
     sem_V(sem_id, SEM_SHM_GLOBAL);
 }
 
+/* =========================
+ *  Podajniki (FIFO)
+ * ========================= */
+
+void conveyor_init(BakeryState* st, int pid) {
+    Conveyor* cv = bakery_conveyor(st, pid);
+    cv->head = 0;
+    cv->tail = 0;
+    cv->count = 0;
+    atomic_init(&cv->produced, 0);
+    atomic_init(&cv->next_item, 1);
+    /* slots[].item zostaje 0 */
+
+    atomic_init(&cv->enq_pos, 0);
+    atomic_init(&cv->deq_pos, 0);
+    for (int k = 0; k < cv->capacity; ++k) atomic_init(&cv->slots[k].seq, (uint64_t)k);
+}
+
+static int conveyor_capacity_ok(const Conveyor* cv) {
+    /* bezpieczeństwo przed dzieleniem modulo przez 0 */
+    return cv->capacity > 0 && cv->capacity <= KI_LIMIT;
+}
+
+/*
+ * Pierścień bez blokad: rezerwacja do n kolejnych slotów.
+ * ready_off=0 -> sloty wolne do zapisu (seq==pos), ready_off=1 -> sztuki
+ * gotowe do odczytu (seq==pos+1). all=1 -> tylko całe n albo nic.
+ * Zwraca liczbę zarezerwowanych slotów (0 = brak), *out_pos = pierwszy numer.
+ */
+static int lf_claim(Conveyor* cv, _Atomic uint64_t* posp, int n, uint64_t ready_off, int all, uint64_t* out_pos) {
+    uint64_t cap = (uint64_t)cv->capacity;
+    uint64_t pos = atomic_load_explicit(posp, memory_order_relaxed);
+    for (;;) {
+        int k = 0;
+        int64_t dif = 0;
+        while (k < n) {
+            uint64_t seq = atomic_load_explicit(&cv->slots[(pos + (uint64_t)k) % cap].seq, memory_order_acquire);
+            dif = (int64_t)(seq - (pos + (uint64_t)k + ready_off));
+            if (dif != 0) break;
+            ++k;
+        }
+        if (k == 0 && dif > 0) {
+            /* inny proces przesunął pozycję - weź świeżą */
+            pos = atomic_load_explicit(posp, memory_order_relaxed);
+            continue;
+        }
+        if (k == 0 || (all && k < n)) return 0;   /* pełny / pusty */
+
+        if (atomic_compare_exchange_weak_explicit(posp, &pos, pos + (uint64_t)k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *out_pos = pos;
+            return k;
+        }
+        /* CAS nieudany - pos zaktualizowany, próbuj dalej */
+    }
+}
+
+static void lf_write(Conveyor* cv, uint64_t pos, int k, int first_item) {
+    uint64_t cap = (uint64_t)cv->capacity;
+    for (int i = 0; i < k; ++i) {
+        ConveyorSlot* slot = &cv->slots[(pos + (uint64_t)i) % cap];
+        slot->item = first_item + i;
+        atomic_store_explicit(&slot->seq, pos + (uint64_t)i + 1, memory_order_release);
+    }
+}
+
+static void lf_read(Conveyor* cv, uint64_t pos, int k, int* out_items) {
+    uint64_t cap = (uint64_t)cv->capacity;
+    for (int i = 0; i < k; ++i) {
+        ConveyorSlot* slot = &cv->slots[(pos + (uint64_t)i) % cap];
+        if (out_items) out_items[i] = slot->item;
+        atomic_store_explicit(&slot->seq, pos + (uint64_t)i + cap, memory_order_release);
+    }
+}
+
+/*
+ * Tryb SEM: rezerwacja n jednostek semafora licznikowego (EMPTY/FULL) razem
+ * z wejściem do SEM_CONV_MUTEX - w System V jednym semop() na dwóch sembuf,
+ * w backendzie futex dwiema operacjami na słowach w SHM.
+ */
+static int conv_reserve_lock(int sem_id, int count_sem, int mutex_sem, int n, int nowait) {
+#ifdef BAKERY_SYNC_FUTEX
+    (void)sem_id;
+    FutexSem* cnt = fsem_get(count_sem);
+    if (nowait) {
+        if (fsem_try_down(cnt, (uint32_t)n) == -1) {
+            errno = EAGAIN;
+            return -1;
+        }
+    } else if (fsem_down(cnt, (uint32_t)n, 1) == -1) {
+        return -1;
+    }
+    fsem_down(fsem_get(mutex_sem), 1, 0);
+    return 0;
+#else
+    struct sembuf ops[2] = {
+        { .sem_num = (unsigned short)count_sem, .sem_op = (short)-n, .sem_flg = (short)(nowait ? IPC_NOWAIT : 0) },
+        { .sem_num = (unsigned short)mutex_sem, .sem_op = -1,        .sem_flg = 0 },
+    };
+    return semop(sem_id, ops, 2);   /* EINTR/EAGAIN -> decyzja po stronie wołającego */
+#endif
+}
+
+/* Jak conv_reserve_lock, ale bierze "do max" dostępnych jednostek (bez czekania). Zwraca k>0 lub -1. */
+static int conv_reserve_up_to_lock(int sem_id, int count_sem, int mutex_sem, int max) {
+#ifdef BAKERY_SYNC_FUTEX
+    (void)sem_id;
+    FutexSem* cnt = fsem_get(count_sem);
+    uint32_t v = atomic_load_explicit(&cnt->value, memory_order_relaxed);
+    uint32_t k = 0;
+    while (v > 0) {
+        k = v < (uint32_t)max ? v : (uint32_t)max;
+        if (atomic_compare_exchange_weak_explicit(&cnt->value, &v, v - k,
+                                                  memory_order_acquire, memory_order_relaxed)) break;
+        k = 0;
+    }
+    if (k == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    fsem_down(fsem_get(mutex_sem), 1, 0);
+    return (int)k;
+#else
+    for (;;) {
+        int v = semctl(sem_id, count_sem, GETVAL);
+        if (v == -1) return -1;
+        if (v == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        int k = v < max ? v : max;
+        if (conv_reserve_lock(sem_id, count_sem, mutex_sem, k, 1) == 0) return k;
+        if (errno != EAGAIN && errno != EINTR) return -1;
+        /* ktoś nas uprzedził - odczytaj wartość ponownie */
+    }
+#endif
+}
+
+/* Tryb SEM: wyjście z SEM_CONV_MUTEX i podniesienie semafora licznikowego o n (jeden semop) */
+static void conv_unlock_post(int sem_id, int mutex_sem, int post_sem, int n) {
+#ifdef BAKERY_SYNC_FUTEX
+    (void)sem_id;
+    fsem_up(fsem_get(mutex_sem), 1);
+    if (n > 0) fsem_up(fsem_get(post_sem), (uint32_t)n);
+#else
+    struct sembuf ops[2] = {
+        { .sem_num = (unsigned short)mutex_sem, .sem_op = 1,        .sem_flg = 0 },
+        { .sem_num = (unsigned short)post_sem,  .sem_op = (short)n, .sem_flg = 0 },
+    };
+    while (semop(sem_id, ops, n > 0 ? 2 : 1) == -1) {
+        if (errno == EINTR) continue;
+        DIE_PERROR("semop(conveyor unlock)");
+    }
+#endif
+}
+
+int conveyor_push_n(BakeryState* st, int sem_id, int pid, int first_item, int n, int nowait) {
+    Conveyor* cv = bakery_conveyor(st, pid);
+    if (!conveyor_capacity_ok(cv) || n <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (n > cv->capacity) n = cv->capacity;   /* więcej niż Ki nigdy się nie zmieści naraz */
+
+    if (st->conveyor_mode == CONVEYOR_LOCKFREE) {
+        /* Za mało miejsca: krótko kręcimy się, potem śpimy po 1 ms (jak sem_P przerywalny) */
+        int spins = 0;
+        uint64_t pos = 0;
+        int k;
+        while ((k = lf_claim(cv, &cv->enq_pos, n, 0, !nowait, &pos)) == 0) {
+            if (nowait) {
+                errno = EAGAIN;
+                return -1;
+            }
+            if (++spins < 64) continue;
+            struct timespec ts = { 0, 1000000L };
+            if (nanosleep(&ts, NULL) == -1 && errno == EINTR) return -1;
+        }
+        lf_write(cv, pos, k, first_item);
+        return k;
+    }
+
+    /* CONVEYOR_SEM: zarezerwuj miejsca i mutex jedną operacją */
+    int k = n;
+    if (nowait) {
+        k = conv_reserve_up_to_lock(sem_id, SEM_CONV_EMPTY(pid), SEM_CONV_MUTEX(pid), n);
+        if (k == -1) return -1;
+    } else if (conv_reserve_lock(sem_id, SEM_CONV_EMPTY(pid), SEM_CONV_MUTEX(pid), n, 0) == -1) {
+        return -1;   /* EINTR -> decyzja po stronie wołającego */
+    }
+
+    /* Sekcja krytyczna: dopisac k sztuk na tail (FIFO) */
+    for (int i = 0; i < k; ++i) {
+        cv->slots[cv->tail].item = first_item + i;
+        cv->tail = (cv->tail + 1) % cv->capacity;
+    }
+    cv->count += k;
+    conv_unlock_post(sem_id, SEM_CONV_MUTEX(pid), SEM_CONV_FULL(pid), k);
+    return k;
+}
+
+int conveyor_pop_up_to_n(BakeryState* st, int sem_id, int pid, int max, int* out_items) {
+    Conveyor* cv = bakery_conveyor(st, pid);
+    if (!conveyor_capacity_ok(cv) || max <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (st->conveyor_mode == CONVEYOR_LOCKFREE) {
+        uint64_t pos = 0;
+        int k = lf_claim(cv, &cv->deq_pos, max, 1, 0, &pos);
+        if (k == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        lf_read(cv, pos, k, out_items);
+        return k;
+    }
+
+    /* CONVEYOR_SEM: weź do max dostępnych sztuk i mutex */
+    int k = conv_reserve_up_to_lock(sem_id, SEM_CONV_FULL(pid), SEM_CONV_MUTEX(pid), max);
+    if (k == -1) return -1;
+
+    /* Zdejmij z head (FIFO) */
+    int removed = k <= cv->count ? k : cv->count;
+    if (removed < k) {
+        fprintf(stderr,
+            "[conveyor] WARN: inconsistency on pid=%d: FULL taken %d but count==%d (head=%d tail=%d cap=%d)\n",
+            pid, k, cv->count, cv->head, cv->tail, cv->capacity);
+    }
+    for (int i = 0; i < removed; ++i) {
+        int pos = cv->head;
+        if (out_items) out_items[i] = cv->slots[pos].item;
+        cv->slots[pos].item = 0;
+        cv->head = (cv->head + 1) % cv->capacity;
+    }
+    cv->count -= removed;
+
+    conv_unlock_post(sem_id, SEM_CONV_MUTEX(pid), SEM_CONV_EMPTY(pid), removed);
+    if (removed < k) {
+        /* oddaj nadmiarowo zdjęte FULL */
+        for (int i = removed; i < k; ++i) sem_V(sem_id, SEM_CONV_FULL(pid));
+    }
+    if (removed == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return removed;
+}
+
+int conveyor_push(BakeryState* st, int sem_id, int pid, int item, int nowait) {
+    return conveyor_push_n(st, sem_id, pid, item, 1, nowait) == 1 ? 0 : -1;
+}
+
+int conveyor_pop(BakeryState* st, int sem_id, int pid, int* out_item) {
+    return conveyor_pop_up_to_n(st, sem_id, pid, 1, out_item) == 1 ? 0 : -1;
+}
+
+int conveyor_count(const BakeryState* st, int pid) {
+    const Conveyor* cv = bakery_conveyor(st, pid);
+    if (st->conveyor_mode == CONVEYOR_LOCKFREE) {
+        uint64_t enq = atomic_load_explicit(&cv->enq_pos, memory_order_acquire);
+        uint64_t deq = atomic_load_explicit(&cv->deq_pos, memory_order_acquire);
+        return enq > deq ? (int)(enq - deq) : 0;
+    }
+    return cv->count;
+}
+
+/* =========================
+ *  Kanał kasowy w SHM (skrzynki + pierścienie MPSC kas)
+ * ========================= */
+
+void checkout_init(BakeryState* st) {
+    if (st->off_checkout_slots == 0) return;   /* segment bez kanału kasowego (CHECKOUT_MQ) */
+    for (int c = 0; c < st->cashier_count; ++c) {
+        CheckoutRing* r = bakery_checkout_ring(st, c);
+        atomic_init(&r->enq_pos, 0);
+        r->deq_pos = 0;
+        atomic_init(&r->doorbell, 0);
+        atomic_init(&r->sleeping, 0);
+        for (int k = 0; k < st->checkout_slots; ++k) atomic_init(&r->cells[k].seq, (uint64_t)k);
+    }
+    _Atomic uint64_t* used = bakery_checkout_used(st);
+    for (int w = 0; w < st->checkout_slots / CHECKOUT_SLOT_BITS; ++w) atomic_init(&used[w], 0);
+    for (int i = 0; i < st->checkout_slots; ++i) atomic_init(&bakery_checkout_slot(st, i)->state, CK_FREE);
+}
+
+/* Zajęcie wolnej skrzynki (bit w checkout_used), start od miejsca zależnego od klienta */
+static int checkout_slot_alloc(BakeryState* st, long client_id) {
+    int words = st->checkout_slots / CHECKOUT_SLOT_BITS;
+    int first = (int)((unsigned long)client_id % (unsigned long)words);
+    for (int i = 0; i < words; ++i) {
+        _Atomic uint64_t* w = &bakery_checkout_used(st)[(first + i) % words];
+        uint64_t used = atomic_load_explicit(w, memory_order_relaxed);
+        while (~used != 0) {
+            int bit = __builtin_ctzll(~used);
+            if (atomic_compare_exchange_weak_explicit(w, &used, used | (1ULL << bit),
+                                                      memory_order_acquire, memory_order_relaxed)) {
+                return ((first + i) % words) * CHECKOUT_SLOT_BITS + bit;
+            }
+        }
+    }
+    return -1;
+}
+
+static void checkout_slot_free(BakeryState* st, int slot) {
+    atomic_store_explicit(&bakery_checkout_slot(st, slot)->state, CK_FREE, memory_order_relaxed);
+    atomic_fetch_and_explicit(&bakery_checkout_used(st)[slot / CHECKOUT_SLOT_BITS],
+                              ~(1ULL << (slot % CHECKOUT_SLOT_BITS)), memory_order_release);
+}
+
+int checkout_submit(BakeryState* st, int cashier, long client_id, const BasketItem* items, int n) {
+    if (cashier < 0 || cashier >= st->cashier_count || n < 0 || n > st->basket_max) {
+        errno = EINVAL;
+        return -1;
+    }
+    int slot = checkout_slot_alloc(st, client_id);
+    if (slot == -1) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /* Koszyk trafia do skrzynki raz (tylko item_count pozycji); kasjer czyta go na miejscu */
+    CheckoutSlot* sl = bakery_checkout_slot(st, slot);
+    atomic_store_explicit(&sl->state, CK_CLAIMED, memory_order_relaxed);
+    sl->client_id = client_id;
+    sl->sent_us = lat_now_us();
+    sl->cashier_id = cashier;
+    sl->item_count = n;
+    memcpy(sl->items, items, sizeof(BasketItem) * (size_t)n);
+    atomic_store_explicit(&sl->state, CK_POSTED, memory_order_relaxed);
+
+    /* Wstawienie numeru skrzynki (Vyukov MPSC: seq==pos -> komórka wolna) */
+    CheckoutRing* r = bakery_checkout_ring(st, cashier);
+    uint64_t pos = atomic_load_explicit(&r->enq_pos, memory_order_relaxed);
+    CheckoutCell* cell;
+    for (;;) {
+        cell = &r->cells[pos % (uint64_t)st->checkout_slots];
+        uint64_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        int64_t dif = (int64_t)(seq - pos);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->enq_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            checkout_slot_free(st, slot);
+            errno = EAGAIN;   /* pierścień pełny */
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&r->enq_pos, memory_order_relaxed);
+        }
+    }
+    cell->slot = slot;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    /* Dzwonek: budź kasjera tylko gdy śpi */
+    atomic_fetch_add_explicit(&r->doorbell, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&r->sleeping, memory_order_seq_cst)) futex_wake(&r->doorbell, 1);
+    return slot;
+}
+
+static int checkout_try_take(CheckoutRing* r, uint64_t cells) {
+    CheckoutCell* cell = &r->cells[r->deq_pos % cells];
+    uint64_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (seq != r->deq_pos + 1) return -1;
+    int slot = cell->slot;
+    atomic_store_explicit(&cell->seq, r->deq_pos + cells, memory_order_release);
+    r->deq_pos++;
+    return slot;
+}
+
+int checkout_take(BakeryState* st, int cashier, int timeout_ms) {
+    CheckoutRing* r = bakery_checkout_ring(st, cashier);
+    uint64_t cells = (uint64_t)st->checkout_slots;
+    int slot = checkout_try_take(r, cells);
+    if (slot >= 0 || timeout_ms == 0) {
+        if (slot < 0) errno = EAGAIN;
+        return slot;
+    }
+
+    struct timespec ts, *tsp = NULL;
+    if (timeout_ms > 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    /* Dekker z checkout_submit: najpierw sleeping=1, potem ponowne sprawdzenie */
+    uint32_t bell = atomic_load_explicit(&r->doorbell, memory_order_seq_cst);
+    atomic_store_explicit(&r->sleeping, 1, memory_order_seq_cst);
+    slot = checkout_try_take(r, cells);
+    int rc = 0, err = 0;
+    if (slot < 0) {
+        rc = futex_wait(&r->doorbell, bell, tsp);
+        err = errno;
+    }
+    atomic_store_explicit(&r->sleeping, 0, memory_order_relaxed);
+    if (slot >= 0) return slot;
+    slot = checkout_try_take(r, cells);
+    if (slot >= 0) return slot;
+    /* upłynął czas albo dzwonek bez koszyka (control_wake_cashiers) - wywołujący sprawdza stan */
+    errno = rc == -1 && err == EINTR ? EINTR : EAGAIN;
+    return -1;
+}
+
+void checkout_reply(BakeryState* st, int slot, int cashier, double total_price, int success) {
+    CheckoutSlot* sl = bakery_checkout_slot(st, slot);
+    sl->cashier_id = cashier;
+    sl->total_price = total_price;
+    sl->success = success;
+    uint32_t expected = CK_POSTED;
+    if (atomic_compare_exchange_strong_explicit(&sl->state, &expected, CK_DONE,
+                                                memory_order_release, memory_order_relaxed)) {
+        futex_wake(&sl->state, 1);
+    } else {
+        /* klient już nie czeka (CK_ABANDONED) */
+        checkout_slot_free(st, slot);
+    }
+}
+
+int checkout_wait(BakeryState* st, int slot, int nowait, CashierReply* out) {
+    CheckoutSlot* sl = bakery_checkout_slot(st, slot);
+    uint32_t state;
+    while ((state = atomic_load_explicit(&sl->state, memory_order_acquire)) != CK_DONE) {
+        if (nowait) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (futex_wait(&sl->state, state, NULL) == -1 && errno == EINTR) return -1;
+    }
+    out->mtype = sl->client_id;
+    out->cashier_id = sl->cashier_id;
+    out->total_price = sl->total_price;
+    out->success = sl->success;
+    checkout_slot_free(st, slot);
+    return 0;
+}
+
+void checkout_abandon(BakeryState* st, int slot) {
+    uint32_t expected = CK_POSTED;
+    if (!atomic_compare_exchange_strong_explicit(&bakery_checkout_slot(st, slot)->state, &expected, CK_ABANDONED,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        /* odpowiedź zdążyła przyjść - zwolnij sam */
+        checkout_slot_free(st, slot);
+    }
+}
+
+/* =========================
+ *  Stan sterujący (generacja + futex)
+ * ========================= */
+
+/* Po zapisie pól pod shm_lock: nowa generacja i pobudka wszystkich śpiących w control_wait */
+void control_publish(BakeryState* st) {
+    atomic_fetch_add_explicit(&st->control_gen, 1, memory_order_seq_cst);
+    futex_wake(&st->control_gen, INT_MAX);
+}
+
+/* Pobudka kasjerów czekających na koszyk; bez czekania - pełna kolejka i tak ma co kasować */
+void control_wake_cashiers(BakeryState* st, const IpcHandles* h) {
+    for (int c = 0; c < st->cashier_count; ++c) {
+        if (st->checkout_mode == CHECKOUT_SHM) {
+            CheckoutRing* r = bakery_checkout_ring(st, c);
+            atomic_fetch_add_explicit(&r->doorbell, 1, memory_order_seq_cst);
+            if (atomic_load_explicit(&r->sleeping, memory_order_seq_cst)) futex_wake(&r->doorbell, 1);
+        } else {
+            ClientMsg wake = { .mtype = CLIENT_MSG_TYPE, .client_id = CONTROL_WAKE_ID };
+            if (msgsnd(h->msg_id[c], &wake, client_msg_size(0) - sizeof(long), IPC_NOWAIT) == -1 && errno != EAGAIN) {
+                perror("msgsnd(control_wake_cashiers)");
+            }
+        }
+    }
+}
+
+/*
+ * Bez zmiany generacji migawka jest aktualna - tylko odczyt atomowy.
+ * Generacja czytana przed blokadą: zmiana w trakcie odczytu da jeszcze
+ * jedną (zbędną) migawkę przy następnym wywołaniu, nigdy przeoczenie.
+ */
+int control_refresh(BakeryState* st, int sem_id, int cashier, ControlView* v) {
+    uint32_t gen = atomic_load_explicit(&st->control_gen, memory_order_acquire);
+    if (v->valid && gen == v->gen) return 0;
+
+    shm_lock(sem_id);
+    v->store_open = st->store_open;
+    v->evacuated = st->evacuated;
+    v->inventory_mode = st->inventory_mode;
+    v->cashier_open = cashier >= 0 ? st->cashiers[cashier].open : 0;
+    v->cashier_accepting = cashier >= 0 ? st->cashiers[cashier].accepting : 0;
+    shm_unlock(sem_id);
+    v->gen = gen;
+    v->valid = 1;
+    return 1;
+}
+
+int control_wait(BakeryState* st, const ControlView* v, int timeout_ms) {
+    if (atomic_load_explicit(&st->control_gen, memory_order_acquire) != v->gen) return 0;
+
+    struct timespec ts, *tsp = NULL;
+    if (timeout_ms >= 0) {
+        long long ns = (long long)((double)timeout_ms * 1000000.0 / vclock_speed());
+        ts.tv_sec = ns / 1000000000LL;
+        ts.tv_nsec = ns % 1000000000LL;
+        tsp = &ts;
+    }
+    if (futex_wait(&st->control_gen, v->gen, tsp) == -1 && errno != EAGAIN) return -1;
+    return 0;   /* pobudka albo generacja zmieniła się przed uśpieniem (EAGAIN) */
+}
+
+/* =========================
+ *  Statystyki (liczniki shardowane)
+ * ========================= */
+
+int stats_shard_of(long client_id) {
+    return (int)((unsigned long)client_id % CLIENT_SHARDS);
+}
+
+ClientShard* stats_client_shard(BakeryState* st, long client_id) {
+    return &st->client_shards[stats_shard_of(client_id)];
+}
+
+/* Suma pola ClientShard (offsetof) po wszystkich shardach */
+static int client_shard_sum(const BakeryState* st, size_t field) {
+    int sum = 0;
+    for (int s = 0; s < CLIENT_SHARDS; ++s) {
+        const _Atomic int* v = (const _Atomic int*)((const char*)&st->client_shards[s] + field);
+        sum += atomic_load_explicit(v, memory_order_relaxed);
+    }
+    return sum;
+}
+
+int stats_customers_in_store(const BakeryState* st) {
+    return client_shard_sum(st, offsetof(ClientShard, in_store));
+}
+
+int stats_arrivals(const BakeryState* st) {
+    return client_shard_sum(st, offsetof(ClientShard, arrivals));
+}
+
+int stats_entries(const BakeryState* st) {
+    return client_shard_sum(st, offsetof(ClientShard, entries));
+}
+
+int stats_rejected(const BakeryState* st) {
+    return client_shard_sum(st, offsetof(ClientShard, rejected));
+}
+
+int stats_baskets(const BakeryState* st, int cashier) {
+    return atomic_load_explicit(&st->cashiers[cashier].baskets, memory_order_relaxed);
+}
+
+int stats_produced(const BakeryState* st, int pid) {
+    return atomic_load_explicit(&bakery_conveyor(st, pid)->produced, memory_order_relaxed);
+}
+
+int stats_sold(const BakeryState* st, int pid) {
+    int sum = 0;
+    for (int c = 0; c < st->cashier_count; ++c) {
+        sum += atomic_load_explicit(&bakery_sold(st, c)[pid], memory_order_relaxed);
+    }
+    return sum;
+}
+
+int stats_wasted(const BakeryState* st, int pid) {
+    int sum = 0;
+    for (int s = 0; s < CLIENT_SHARDS; ++s) {
+        sum += atomic_load_explicit(&bakery_wasted(st, s)[pid], memory_order_relaxed);
+    }
+    return sum;
+}
+
+int stats_stockouts(const BakeryState* st, int pid) {
+    int sum = 0;
+    for (int s = 0; s < CLIENT_SHARDS; ++s) {
+        sum += atomic_load_explicit(&bakery_stockouts(st, s)[pid], memory_order_relaxed);
+    }
+    return sum;
+}
+
+int stats_lost(const BakeryState* st, int pid) {
+    int sum = 0;
+    for (int s = 0; s < CLIENT_SHARDS; ++s) {
+        sum += atomic_load_explicit(&bakery_lost(st, s)[pid], memory_order_relaxed);
+    }
+    return sum;
+}
+
+/* =========================
+ *  Raport układu pamięci
+ * ========================= */
+
+#define LAYOUT_ROW(out, type, field) \
+    fprintf((out), "  %-14s %-22s off=%6zu  linia=%4zu\n", #type, #field, \
+            offsetof(type, field), offsetof(type, field) / CACHE_LINE)
+
+#define REGION_ROW(out, name, off, size) \
+    fprintf((out), "  %-22s off=%9zu  rozmiar=%9zu\n", (name), (size_t)(off), (size_t)(size))
+
+void bakery_layout_report(FILE* out, const ShmConfig* cfg) {
+    int P = cfg->P;
+#ifdef BAKERY_PACKED_LAYOUT
+    fprintf(out, "Układ BakeryState: PACKED (bez wyrównania do linii cache)\n");
+#else
+    fprintf(out, "Układ BakeryState: wyrównany do %d B\n", CACHE_LINE);
+#endif
+    fprintf(out, "  sizeof: BakeryState=%zu Conveyor=%zu CashierBlock=%zu ClientShard=%zu\n",
+            sizeof(BakeryState), sizeof(Conveyor), sizeof(CashierBlock), sizeof(ClientShard));
+    LAYOUT_ROW(out, BakeryState, P);
+    LAYOUT_ROW(out, BakeryState, store_open);
+    LAYOUT_ROW(out, BakeryState, control_gen);
+    LAYOUT_ROW(out, BakeryState, waiting_before_store);
+    LAYOUT_ROW(out, BakeryState, cashiers);
+    LAYOUT_ROW(out, BakeryState, client_shards);
+    LAYOUT_ROW(out, BakeryState, bakers);
+    LAYOUT_ROW(out, Conveyor, capacity);
+    LAYOUT_ROW(out, Conveyor, enq_pos);
+    LAYOUT_ROW(out, Conveyor, produced);
+    LAYOUT_ROW(out, Conveyor, deq_pos);
+    LAYOUT_ROW(out, Conveyor, slots);
+    LAYOUT_ROW(out, CashierBlock, open);
+    LAYOUT_ROW(out, CashierBlock, queue_len);
+    LAYOUT_ROW(out, CashierBlock, queue_work_ms);
+    LAYOUT_ROW(out, ClientShard, in_store);
+
+    /* Regiony segmentu dla bieżącej konfiguracji */
+    size_t size = bakery_layout(NULL, cfg);
+    BakeryState* st = calloc(1, size);
+    if (!st) DIE_PERROR("calloc(layout)");
+    bakery_layout(st, cfg);
+    fprintf(out, "Segment SHM: P=%d, kasy=%d, koszyk=%d, kanał kasowy=%s -> %zu B\n", P, cfg->cashiers,
+            cfg->basket_max, cfg->checkout_mode == CHECKOUT_SHM ? "shm" : "mq", size);
+    REGION_ROW(out, "produkty", st->off_products, (size_t)P * sizeof(Product));
+    REGION_ROW(out, "tablica podajnikow", st->off_conveyor_table, (size_t)P * sizeof(size_t));
+    REGION_ROW(out, "podajniki", P > 0 ? st->off_conveyor_table + region_round((size_t)P * sizeof(size_t)) : 0,
+               st->off_sold - st->off_conveyor_table - region_round((size_t)P * sizeof(size_t)));
+    REGION_ROW(out, "sold (kasy)", st->off_sold, (size_t)st->cashier_count * st->counter_row);
+    REGION_ROW(out, "wasted (shardy)", st->off_wasted, CLIENT_SHARDS * st->counter_row);
+    REGION_ROW(out, "stockouts (shardy)", st->off_stockouts, CLIENT_SHARDS * st->counter_row);
+    REGION_ROW(out, "lost (shardy)", st->off_lost, CLIENT_SHARDS * st->counter_row);
+    REGION_ROW(out, "wlasciciele produktow", st->off_baker_owner, st->counter_row);
+    REGION_ROW(out, "histogramy opoznien", st->off_latency, lat_region_size(st->cashier_count));
+    if (st->off_sync_sems) {
+        REGION_ROW(out, "semafory futex", st->off_sync_sems, (size_t)sem_count_for_P(P) * sizeof(FutexSem));
+    }
+    if (st->off_checkout_slots) {
+        REGION_ROW(out, "pierscienie kas", st->off_checkout_rings,
+                   (size_t)st->cashier_count * st->checkout_ring_size);
+        REGION_ROW(out, "bitmapa skrzynek", st->off_checkout_used,
+                   (size_t)st->checkout_slots / CHECKOUT_SLOT_BITS * sizeof(uint64_t));
+        REGION_ROW(out, "skrzynki kasowe", st->off_checkout_slots, (size_t)st->checkout_slots * st->checkout_slot_size);
+    }
+    if (st->off_log_ring) {
+        REGION_ROW(out, "pierscien logu", st->off_log_ring, log_ring_size(cfg->log_records));
+    }
+    free(st);
+}
+
 /* =========================
  *  Losowanie / czas
  * ========================= */
 
-int rand_between(int a, int b) {
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(Rng* r, uint64_t seed) {
+    /* splitmix64 rozprowadza ziarno - stan nigdy nie jest samymi zerami */
+    for (int i = 0; i < 4; ++i) r->s[i] = splitmix64(&seed);
+}
+
+uint64_t rng_next(Rng* r) {
+    uint64_t* s = r->s;
+    uint64_t result = rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
+int rng_between(Rng* r, int a, int b) {
     if (a > b) { int t = a; a = b; b = t; }
     if (a == b) return a;
-    int r = rand();
-    return a + (r % (b - a + 1));
+    uint64_t range = (uint64_t)((int64_t)b - a) + 1;
+    /* odrzucenie końcówki zakresu, która nie dzieli się przez range */
+    uint64_t limit = UINT64_MAX - UINT64_MAX % range;
+    uint64_t x;
+    do {
+        x = rng_next(r);
+    } while (x >= limit);
+    return (int)((int64_t)a + (int64_t)(x % range));
 }
 
-void msleep(int ms) {
-    if (ms <= 0) return;
+uint64_t rng_derive(uint64_t master, int role, long index) {
+    uint64_t x = master ^ ((uint64_t)role << 56);
+    uint64_t h = splitmix64(&x);
+    x = h ^ (uint64_t)index;
+    return splitmix64(&x);
+}
+
+uint64_t rng_time_seed(void) {
     struct timespec ts;
-    ts.tv_sec = ms / 1000;
-    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    CHECK_SYS(clock_gettime(CLOCK_REALTIME, &ts), "clock_gettime");
+    return ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+}
+
+static _Thread_local Rng t_rng;
+static _Thread_local int t_rng_ready;
+
+void rng_thread_seed(uint64_t seed) {
+    rng_seed(&t_rng, seed);
+    t_rng_ready = 1;
+}
+
+int rand_between(int a, int b) {
+    if (!t_rng_ready) rng_thread_seed(rng_time_seed() ^ (uint64_t)gettid());
+    return rng_between(&t_rng, a, b);
+}
+
+static void sleep_ns(long long ns) {
+    if (ns <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000LL);
+    ts.tv_nsec = (long)(ns % 1000000000LL);
     while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
         /* Przerwane sygnałem - kontynuuj jeśli jeszcze został czas */
     }
 }
 
+void msleep(int ms) {
+    if (ms <= 0) return;
+    sleep_ns((long long)((double)ms * 1000000.0 / vclock_speed()));
+}
+
+void msleep_real(int ms) {
+    if (ms <= 0) return;
+    sleep_ns((long long)ms * 1000000LL);
+}
+
+/* =========================
+ *  Zegar symulacji
+ * ========================= */
+
+#define MS_PER_HOUR (3600LL * 1000LL)
+#define MS_PER_DAY  (24LL * MS_PER_HOUR)
+
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void vclock_init(BakeryState* st, double speed, long long start_ms_of_day) {
+    st->clock_speed = speed > 0.0 ? speed : 1.0;
+    st->clock_start_ms = start_ms_of_day;
+    st->clock_start_ns = monotonic_ns();
+}
+
+double vclock_speed(void) {
+    return g_attached_state && g_attached_state->clock_speed > 0.0 ? g_attached_state->clock_speed : 1.0;
+}
+
+long long vclock_now_ms(void) {
+    const BakeryState* st = g_attached_state;
+    if (!st || st->clock_speed <= 0.0) return monotonic_ns() / 1000000LL;
+    double elapsed_ms = (double)(monotonic_ns() - st->clock_start_ns) / 1000000.0;
+    return st->clock_start_ms + (long long)(elapsed_ms * st->clock_speed);
+}
+
+int vclock_hour(void) {
+    /* bez modulo 24: godzina zamknięcia 24 jest osiągalna */
+    return (int)(vclock_now_ms() / MS_PER_HOUR);
+}
+
+void vclock_stamp(char* buf, size_t n) {
+    vclock_stamp_at(buf, n, g_attached_state && g_attached_state->clock_speed > 0.0 ? vclock_now_ms() : -1);
+}
+
+void vclock_stamp_at(char* buf, size_t n, long long t_ms) {
+    if (t_ms < 0) {
+        if (n > 0) buf[0] = '\0';
+        return;
+    }
+    long long t = t_ms % MS_PER_DAY;
+    snprintf(buf, n, "%02lld:%02lld:%02lld.%03lld ", t / MS_PER_HOUR, t / 60000 % 60,
+             t / 1000 % 60, t % 1000);
+}
+
+long long clock_local_ms_of_day(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_REALTIME, &ts), "clock_gettime");
+    struct tm lt;
+    localtime_r(&ts.tv_sec, &lt);
+    return ((lt.tm_hour * 60LL + lt.tm_min) * 60LL + lt.tm_sec) * 1000LL + ts.tv_nsec / 1000000L;
+}
+
 /* =========================
  *  Walidacja konfiguracji
  * ========================= */
 
 int validate_config(int P, int N, int open_hour, int close_hour, const int* Ki, const Product* produkty) {
-    if (P < 10 || P > MAX_P) return 0;
+    if (P < 10 || P > P_LIMIT) return 0;
     if (N <= 0) return 0;
     //if (N % 3 != 0) return 0;
     if (open_hour < 0 || open_hour > 23) return 0;
@@ -214,12 +1330,323 @@ int validate_config(int P, int N, int open_hour, int close_hour, const int* Ki,
     if (!Ki || !produkty) return 0;
 
     for (int i = 0; i < P; ++i) {
-        if (Ki[i] <= 0 || Ki[i] > MAX_KI) return 0;
+        if (Ki[i] <= 0 || Ki[i] > KI_LIMIT) return 0;
         if (produkty[i].cena <= 0.0) return 0;
     }
     return 1;
 }
 
+/* =========================
+ *  Polityka sklepu (kierownik, klienci i symulacja zdarzeniowa)
+ * ========================= */
+
+void bakery_default_products(Product* produkty, int* Ki, int P, int ki) {
+    static const struct { const char* nazwa; double cena; } defaults[] = {
+        { "Bułka kajzerka", 3.0 },          { "Bułka grahamka", 4.0 },
+        { "Chleb pszenny", 6.0 },           { "Chleb pełnoziarnisty", 7.0 },
+        { "Chleb żytni", 8.0 },             { "Bagietka", 9.0 },
+        { "Chleb na zakwasie", 10.0 },      { "Pieczywo bezglutenowe", 11.0 },
+        { "Pączek", 2.0 },                  { "Rogalik", 12.0 },
+        { "Ciastko kruche", 1.0 },          { "Strucla", 13.0 },
+        { "Zapiekanka", 14.0 },             { "Focaccia", 15.0 },
+        { "Rogal świętomarciński", 16.0 },
+    };
+    int n = (int)(sizeof(defaults) / sizeof(defaults[0]));
+
+    /* Katalog większy niż lista domyślna: kolejne warianty tych samych wyrobów */
+    memset(produkty, 0, sizeof(Product) * (size_t)P);
+    for (int i = 0; i < P; ++i) {
+        int v = i / n;
+        if (v == 0) snprintf(produkty[i].nazwa, sizeof(produkty[i].nazwa), "%s", defaults[i % n].nazwa);
+        else snprintf(produkty[i].nazwa, sizeof(produkty[i].nazwa), "%s #%d", defaults[i % n].nazwa, v + 1);
+        produkty[i].cena = defaults[i % n].cena + 0.5 * v;
+        Ki[i] = ki > 0 ? ki : 10 + (i % 5);
+    }
+}
+
+int cashier_policy_desired(int customers, int N, int cashiers, int last) {
+    /* Zasada: jedna kasa na K = N/cashiers klientów (min 1, max cashiers).
+     * Kolejna kasa rusza powyżej progu last*K, zamyka się poniżej (last-1)*K;
+     * histereza ±1 wokół progów, jak dla trzech kas. */
+    int K = N / cashiers;
+    if (K < 1) K = 1;
+    if (last < 1) last = 1;
+    if (last > cashiers) last = cashiers;
+
+    while (last < cashiers && customers >= last * K + 1) last++;
+    while (last > 1 && customers <= (last - 1) * K - 1) last--;
+    return last;
+}
+
+void staffing_init(StaffingPolicy* sp, int policy) {
+    memset(sp, 0, sizeof(*sp));
+    sp->policy = policy;
+    sp->last = 1;
+}
+
+int staffing_policy_parse(const char* name) {
+    if (strcmp(name, "threshold") == 0) return POLICY_THRESHOLD;
+    if (strcmp(name, "ewma") == 0) return POLICY_EWMA;
+    return -1;
+}
+
+const char* staffing_policy_name(int policy) {
+    return policy == POLICY_EWMA ? "ewma" : "threshold";
+}
+
+/* Średni czas kasowania kasy od poprzedniej próbki (histogram LAT_TILL_SCAN) -> EWMA w ms symulacji */
+static void staffing_track_service(StaffingPolicy* sp, const BakeryState* st, int c) {
+    const LatHist* h = bakery_lat(st, LAT_TILL_SCAN, c);
+    uint64_t count = lat_count(h);
+    uint64_t sum = atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+    if (count > sp->scan_count[c] && sum >= sp->scan_sum_us[c]) {
+        double mean_us = (double)(sum - sp->scan_sum_us[c]) / (double)(count - sp->scan_count[c]);
+        /* procesy mierzą czas rzeczywisty, ./sim - symulowany */
+        double ms = mean_us / 1000.0 * (st->clock_speed > 0.0 ? st->clock_speed : 1.0);
+        sp->service_ms[c] = sp->service_ms[c] > 0.0 ? STAFF_ALPHA * ms + (1.0 - STAFF_ALPHA) * sp->service_ms[c] : ms;
+    }
+    sp->scan_count[c] = count;
+    sp->scan_sum_us[c] = sum;
+}
+
+static int staffing_ewma(StaffingPolicy* sp, const BakeryState* st, long long now_ms) {
+    int n = st->cashier_count;
+    long long arrivals = 0;
+    int queued = 0;
+    double known = 0.0;
+    int measured = 0;
+    for (int c = 0; c < n; ++c) {
+        staffing_track_service(sp, st, c);
+        arrivals += (long long)sp->scan_count[c];
+        queued += st->cashiers[c].queue_len;
+        if (sp->service_ms[c] > 0.0) {
+            known += sp->service_ms[c];
+            measured++;
+        }
+    }
+    /* koszyk w trakcie kasowania jest jeszcze w queue_len - przejściowo liczony dwa razy */
+    arrivals += queued;
+
+    /* pierwsza próbka albo zegar cofnięty (północ) - tylko punkt odniesienia */
+    if (!sp->primed || now_ms <= sp->t_ms) {
+        sp->primed = 1;
+        sp->t_ms = now_ms;
+        sp->arrivals = arrivals;
+        return sp->last;
+    }
+    double dt = (double)(now_ms - sp->t_ms) / 1000.0;
+
+    double inst = (double)(arrivals - sp->arrivals) / dt;
+    if (inst < 0.0) inst = 0.0;
+    double prev = sp->rate;
+    sp->rate = STAFF_ALPHA * inst + (1.0 - STAFF_ALPHA) * (sp->rate + sp->trend * dt);
+    sp->trend = STAFF_BETA * (sp->rate - prev) / dt + (1.0 - STAFF_BETA) * sp->trend;
+    sp->t_ms = now_ms;
+    sp->arrivals = arrivals;
+
+    /* Prognoza na horyzont: tempo z trendem + rozładowanie obecnych kolejek */
+    double horizon_s = STAFF_HORIZON_MS / 1000.0;
+    double demand = sp->rate + sp->trend * horizon_s;
+    if (demand < 0.0) demand = 0.0;
+    demand += queued / horizon_s;
+    sp->demand = demand;
+
+    /* Kasa bez pomiaru: średnia zmierzonych albo STAFF_SERVICE_MS */
+    double fallback = measured ? known / measured : STAFF_SERVICE_MS;
+    double capacity[CASHIERS_MAX + 1];   /* capacity[k] = przepustowość kas 0..k-1 [koszyki/s] */
+    capacity[0] = 0.0;
+    for (int c = 0; c < n; ++c) {
+        double ms = sp->service_ms[c] > 0.0 ? sp->service_ms[c] : fallback;
+        capacity[c + 1] = capacity[c] + 1000.0 / ms;
+    }
+
+    int want = 1;
+    while (want < n && demand > STAFF_UTIL * capacity[want]) want++;
+
+    int last = sp->last < 1 ? 1 : (sp->last > n ? n : sp->last);
+    if (want > last) {
+        last = want;                                  /* przed narastaniem kolejki - od razu */
+    } else if (last > 1 && demand <= STAFF_SLACK * STAFF_UTIL * capacity[last - 1]) {
+        last--;                                       /* zapas: po jednej kasie na decyzję */
+    }
+    return last;
+}
+
+int staffing_desired(StaffingPolicy* sp, const BakeryState* st, int customers, long long now_ms) {
+    if (sp->policy == POLICY_EWMA && st->off_latency) sp->last = staffing_ewma(sp, st, now_ms);
+    else sp->last = cashier_policy_desired(customers, st->N, st->cashier_count, sp->last);
+    return sp->last;
+}
+
+/* Oczekiwana praca kasy w ms: koszyki w kolejce + reszta kasowania w toku */
+static long long cashier_work_ms(const BakeryState* st, int i, long long now_ms) {
+    const CashierBlock* cb = &st->cashiers[i];
+    long long work = atomic_load_explicit(&cb->queue_work_ms, memory_order_relaxed);
+    long long end = atomic_load_explicit(&cb->scan_end_ms, memory_order_relaxed);
+    if (work < 0) work = 0;   /* kasjer odjął przed dodaniem przez klienta */
+    if (end > now_ms) {
+        /* zegar po północy cofa się - reszta nie dłuższa niż najdłuższe kasowanie */
+        long long rest = end - now_ms;
+        long long cap = basket_scan_ms(st->basket_max);
+        work += rest < cap ? rest : cap;
+    }
+    return work;
+}
+
+void bake_demand_init(BakeDemand* bd, int P) {
+    memset(bd, 0, sizeof(*bd));
+    bd->P = P;
+    bd->seen = calloc((size_t)P, sizeof(int));
+    bd->rate = calloc((size_t)P, sizeof(double));
+    if (!bd->seen || !bd->rate) DIE_PERROR("calloc(BakeDemand)");
+}
+
+void bake_demand_free(BakeDemand* bd) {
+    free(bd->seen);
+    free(bd->rate);
+    bd->seen = NULL;
+    bd->rate = NULL;
+}
+
+void bake_demand_update(BakeDemand* bd, const BakeryState* st, const int* stock, long long now_ms) {
+    /* pierwsza próbka albo zegar cofnięty (północ) - tylko punkt odniesienia */
+    int reset = !bd->primed || now_ms <= bd->t_ms;
+    double dt = (double)(now_ms - bd->t_ms) / 1000.0;
+    for (int pid = 0; pid < bd->P; ++pid) {
+        /* zdjęte z podajnika = wypieczone - zapas; piekarz dolicza produced po wstawieniu, więc chwilowo mniej */
+        int demand = stats_produced(st, pid) - stock[pid] + stats_lost(st, pid);
+        int d = demand > bd->seen[pid] ? demand - bd->seen[pid] : 0;
+        if (demand > bd->seen[pid]) bd->seen[pid] = demand;
+        if (!reset) bd->rate[pid] = BAKE_ALPHA * (d / dt) + (1.0 - BAKE_ALPHA) * bd->rate[pid];
+    }
+    bd->primed = 1;
+    bd->t_ms = now_ms;
+}
+
+double bake_demand_score(const BakeDemand* bd, int pid, int stock) {
+    return bd->rate[pid] * (BAKE_HORIZON_MS / 1000.0) - stock;
+}
+
+int bake_mode_parse(const char* name) {
+    if (strcmp(name, "random") == 0) return BAKE_RANDOM;
+    if (strcmp(name, "demand") == 0) return BAKE_DEMAND;
+    return -1;
+}
+
+const char* bake_mode_name(int mode) {
+    return mode == BAKE_DEMAND ? "demand" : "random";
+}
+
+int cashier_choose(const BakeryState* st, long client_id, long long now_ms) {
+    /* Najmniej pracy (TILL_WORK) albo najkrótsza kolejka wśród przyjmujących; skan
+     * zaczyna się od kasy zależnej od klienta, więc remisy rozkładają się po kasach
+     * zamiast trafiać zawsze do 0 */
+    int n = st->cashier_count;
+    int first = (int)((unsigned long)client_id % (unsigned long)n);
+    int best = -1;
+    long long best_work = 0;
+    int best_len = 0x7fffffff;
+
+    for (int k = 0; k < n; ++k) {
+        int i = (first + k) % n;
+        if (st->cashiers[i].open && st->cashiers[i].accepting) {
+            int len = st->cashiers[i].queue_len;
+            long long work = st->till_choice == TILL_WORK ? cashier_work_ms(st, i, now_ms) : 0;
+            if (best == -1 || work < best_work || (work == best_work && len < best_len)) {
+                best_work = work;
+                best_len = len;
+                best = i;
+            }
+        }
+    }
+    if (best != -1) return best;
+
+    for (int i = 0; i < n; ++i) {
+        if (st->cashiers[i].open) return i;
+    }
+    return 0;
+}
+
+void cashier_queue_join(BakeryState* st, int cashier, int item_count) {
+    st->cashiers[cashier].queue_len++;
+    atomic_fetch_add_explicit(&st->cashiers[cashier].queue_work_ms, basket_scan_ms(item_count), memory_order_relaxed);
+}
+
+void cashier_queue_leave(BakeryState* st, int cashier, int item_count) {
+    if (st->cashiers[cashier].queue_len > 0) st->cashiers[cashier].queue_len--;
+    atomic_fetch_sub_explicit(&st->cashiers[cashier].queue_work_ms, basket_scan_ms(item_count), memory_order_relaxed);
+}
+
+void print_test_stats(const BakeryState* st, const TestStats* ts) {
+    printf("\n========== STATYSTYKI TESTU ==========\n");
+    printf("Klientow wygenerowanych: %d\n", ts->clients_spawned);
+    printf("Max rownoczesnie w sklepie: %d (limit N=%d)\n", ts->max_concurrent, st->N);
+    printf("Czas trwania testu: %lld ms\n", ts->end_time_ms - ts->start_time_ms);
+    
+    int total_sold = 0;
+    int total_wasted = 0;
+    int total_produced = 0;
+    int total_stockouts = 0;
+    int total_lost = 0;
+    for (int i = 0; i < st->P; ++i) {
+        total_produced += stats_produced(st, i);
+        total_stockouts += stats_stockouts(st, i);
+        total_lost += stats_lost(st, i);
+        total_wasted += stats_wasted(st, i);
+        total_sold += stats_sold(st, i);
+    }
+    
+    printf("Produktow wyprodukowanych: %d\n", total_produced);
+    printf("Produktow sprzedanych: %d\n", total_sold);
+    printf("Produktow zmarnowanych (ewakuacja): %d\n", total_wasted);
+    double minutes = (double)(ts->end_time_ms - ts->start_time_ms) / 60000.0;
+    printf("Sprzedaz: %.1f szt./min, braki towaru: %d, utracona sprzedaz: %d szt. (piekarz: %s)\n",
+           minutes > 0.0 ? total_sold / minutes : 0.0, total_stockouts, total_lost, bake_mode_name(st->bake_mode));
+    long long now = vclock_now_ms();
+    for (int b = 0; b < st->baker_count; ++b) {
+        const BakerBlock* bb = &st->bakers[b];
+        long long end = bb->end_ms ? bb->end_ms : now;
+        double hours = (double)(end - bb->start_ms) / 3600000.0;
+        int produced = atomic_load_explicit(&bb->produced, memory_order_relaxed);
+        printf("  Piekarz %d: %d szt., %d partii, przejete produkty: %d, %.0f szt./h\n", b, produced,
+               atomic_load_explicit(&bb->batches, memory_order_relaxed),
+               atomic_load_explicit(&bb->taken_over, memory_order_relaxed),
+               hours > 0.0 ? produced / hours : 0.0);
+    }
+    lat_report(stdout, st);
+    printf("========================================\n\n");
+}
+
+/* =========================
+ *  Log tekstowy
+ * ========================= */
+
+const char* log_tag_color(const char* tag) {
+    switch (tag[0]) {
+    case 'p': return COLOR_PIEKARZ;
+    case 'k':
+        if (tag[1] == 'i') return COLOR_KIEROWNIK;
+        if (tag[1] == 'a') return COLOR_KASJER;
+        if (tag[1] == 'l') return COLOR_KLIENT;
+        break;
+    }
+    return ANSI_WHITE;
+}
+
+void log_text(const char* tag, const char* fmt, ...) {
+    char line[1024];
+    char ts[24];
+    vclock_stamp(ts, sizeof(ts));
+    int n = snprintf(line, sizeof(line), "%s%s[%s pid=%d]%s ", ts, log_tag_color(tag), tag, (int)getpid(), ANSI_RESET);
+    va_list ap;
+    va_start(ap, fmt);
+    n += vsnprintf(line + n, sizeof(line) - (size_t)n, fmt, ap);
+    va_end(ap);
+    if (n > (int)sizeof(line) - 2) n = (int)sizeof(line) - 2;
+    line[n++] = '\n';
+    fwrite(line, 1, (size_t)n, stdout);
+}
+
 /* =========================
  *  Sygnały
  * ========================= */
@@ -10,6 +10,7 @@
 
 #include <errno.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -34,16 +35,34 @@
 #define PROJECT_NAME        "bakery"
 #define IPC_KEY_FILE        "./.bakery_ipc_key"   /* Tworzony przez bakery, używany do ftok() */
 #define CTRL_FIFO_PATH      "./bakery_ctrl.fifo"  /* Opcjonalny kanał sterowania */
+#define METRICS_PATH        "./bakery_metrics.jsonl" /* migawki metryk (komenda STATUS) */
 
 /* Minimalne prawa dostępu*/
 #define IPC_PERMS_MIN       0600
 #define FIFO_PERMS_MIN      0600
 
-/* Ograniczenia statyczne*/
-#define MAX_P               15      
-#define MAX_KI              64     
+/*
+ * Granice walidacji. Rozmiary tablic w SHM nie zależą od nich - segment jest
+ * liczony w czasie działania z konfiguracji ShmConfig (bakery_layout).
+ */
+#define P_LIMIT             10000   /* 2+3P semaforów musi się zmieścić w SEMMSL */
+#define KI_LIMIT            32767   /* SEMVMX - wartość SEM_CONV_EMPTY(i) */
+#define BASKET_LIMIT        1000    /* ClientMsg musi się zmieścić w msgmax (8 KiB) */
+
+#define DEFAULT_P           15
+#define DEFAULT_BASKET_ITEMS 16
+
+/* Liczba kas (BakeryState.cashier_count, --cashiers) */
+#define CASHIERS_MIN        2
+#define CASHIERS_MAX        32      /* kolejki 0x50..0x6F w ftok */
+#define DEFAULT_CASHIERS    3
+
+/* Liczba piekarzy (BakeryState.baker_count, --bakers); każdy ma shard produktów */
+#define BAKERS_MAX          16
+#define DEFAULT_BAKERS      1
 
-#define CASHIERS            3
+/* Liczba shardów liczników klientów (klient pisze do shardu pid % CLIENT_SHARDS) */
+#define CLIENT_SHARDS       64
 
 /* Sygnały*/
 #define SIG_EVAC            SIGUSR1
@@ -92,121 +111,427 @@
 #define COLOR_KASJER    ANSI_BOLD ANSI_GREEN    /* zielony - pieniądze */
 #define COLOR_KLIENT    ANSI_CYAN               /* cyjan - klient */
 
-/* Makro do kolorowego logowania - wybiera kolor na podstawie tagu */
-#define LOGF(tag, ...) do { \
-    const char* _color = ANSI_WHITE; \
-    if (strcmp((tag), "kierownik") == 0) _color = COLOR_KIEROWNIK; \
-    else if (strcmp((tag), "piekarz") == 0) _color = COLOR_PIEKARZ; \
-    else if (strcmp((tag), "kasjer") == 0) _color = COLOR_KASJER; \
-    else if (strcmp((tag), "klient") == 0) _color = COLOR_KLIENT; \
-    fprintf(stdout, "%s[%s pid=%d]%s ", _color, (tag), (int)getpid(), ANSI_RESET); \
-    fprintf(stdout, __VA_ARGS__); \
-    fprintf(stdout, "\n"); \
-} while (0)
+/* Kolorowe logowanie tekstowe - cała linia jednym zapisem (gorące ścieżki: LOGE, log_ring.h) */
+#define LOGF(tag, ...) log_text((tag), __VA_ARGS__)
+/* =========================
+ *  Indeksy semaforów
+ * ========================= */
+
+/*
+ * Używamy jednego zestawu semaforów (semget) i mapujemy indeksy:
+ *  - SEM_STORE_SLOTS: licznik wolnych miejsc w sklepie (N)
+ *  - SEM_SHM_GLOBAL : mutex na pola globalne w SHM
+ *  - Dla każdego produktu i:
+ *      SEM_CONV_MUTEX(i)  : mutex na conveyor i
+ *      SEM_CONV_EMPTY(i)  : licznik wolnych miejsc (Ki)
+ *      SEM_CONV_FULL(i)   : licznik sztuk dostępnych
+ *
+ * Backend wybierany przy kompilacji (make SYNC=sysv|futex):
+ *  - sysv : semop() na zestawie System V (domyślnie)
+ *  - futex: słowa futexa w SHM (BakeryState.sync_sems), najpierw krótkie
+ *           adaptacyjne kręcenie się, potem uśpienie w FUTEX_WAIT. Zestaw
+ *           System V nadal powstaje, sem_id zostaje uchwytem API.
+ */
+
+#define SEM_STORE_SLOTS     0
+#define SEM_SHM_GLOBAL      1
+
+/* Początek semaforów per produkt */
+#define SEM_PRODUCTS_BASE   2
+#define SEM_PER_PRODUCT     3
+
+#define SEM_CONV_MUTEX(i)   (SEM_PRODUCTS_BASE + (i) * SEM_PER_PRODUCT + 0)
+#define SEM_CONV_EMPTY(i)   (SEM_PRODUCTS_BASE + (i) * SEM_PER_PRODUCT + 1)
+#define SEM_CONV_FULL(i)    (SEM_PRODUCTS_BASE + (i) * SEM_PER_PRODUCT + 2)
+
+/* Całkowita liczba semaforów w zestawie: 2 + 3*P */
+static inline int sem_count_for_P(int P) { return SEM_PRODUCTS_BASE + SEM_PER_PRODUCT * P; }
+
 /* =========================
  *  Struktury danych w SHM
  * ========================= */
 
-/* Podajnik FIFO (bufor cykliczny) dla jednego produktu. */
+/*
+ * Układ pamięci: pola pisane przez różne procesy leżą na osobnych liniach
+ * cache (CACHE_LINE), żeby zapis piekarza nie unieważniał linii czytanych
+ * przez klientów i kasjerów (false sharing). Kompilacja z
+ * -DBAKERY_PACKED_LAYOUT (make LAYOUT=packed) przywraca ciasny układ
+ * - do porównań w benchmarku (make perf-stress).
+ */
+#define CACHE_LINE          64
+
+#ifdef BAKERY_PACKED_LAYOUT
+#define CACHELINE_ALIGNED
+#else
+#define CACHELINE_ALIGNED   _Alignas(CACHE_LINE)
+#endif
+
+/* Tryby pracy podajników (BakeryState.conveyor_mode) */
+#define CONVEYOR_SEM        0   /* semafory System V: EMPTY/FULL + MUTEX (wersja pierwotna) */
+#define CONVEYOR_LOCKFREE   1   /* pierścień na atomikach C11, bez wywołań systemowych */
+
+/* Slot podajnika: numer sekwencyjny obok sztuki - jedna linia cache na operację */
+typedef struct ConveyorSlot {
+    _Atomic uint64_t seq;         /* numer sekwencyjny slotu (tryb LOCKFREE) */
+    int item;                     /* sztuka (numer seryjny z piekarni) */
+} ConveyorSlot;
+
+/*
+ * Podajnik FIFO (bufor cykliczny) dla jednego produktu.
+ *
+ * Tryb CONVEYOR_SEM używa head/tail/count pod SEM_CONV_MUTEX(i).
+ * Tryb CONVEYOR_LOCKFREE używa numerów sekwencyjnych enq_pos/deq_pos oraz
+ * seq per slot (ograniczona kolejka Vyukova): slot k jest wolny dla zapisu
+ * o numerze pos gdy seq==pos, a gotowy do odczytu gdy seq==pos+1.
+ * Zwykle pisze jeden piekarz (właściciel produktu), przy przejęciu produktu
+ * przez chwilę dwóch; wielu klientów czyta; kolejność FIFO jest zachowana.
+ *
+ * Strona producenta i strona konsumentów leżą na osobnych liniach cache.
+ * Sloty (Ki sztuk) leżą bezpośrednio za nagłówkiem - rozmiar podajnika
+ * wyznacza bakery_layout.
+ */
 typedef struct Conveyor {
-    int capacity;                 /* Ki */
-    int head;                     /* indeks odczytu */
+    int capacity;                 /* Ki (tylko do odczytu po starcie) */
+
+    /* Strona producenta - pisze piekarz */
+    CACHELINE_ALIGNED
+    _Atomic uint64_t enq_pos;     /* numer następnego zapisu */
     int tail;                     /* indeks zapisu */
-    int count;                    /* liczba sztuk na podajniku */
-    int items[MAX_KI];            
+    int count;                    /* liczba sztuk na podajniku (tryb SEM, pod mutexem) */
+    _Atomic int produced;         /* ile wyprodukowano (sumarycznie) */
+    _Atomic int next_item;        /* numer seryjny następnej sztuki (wielu piekarzy) */
+
+    /* Strona konsumentów - piszą klienci */
+    CACHELINE_ALIGNED
+    _Atomic uint64_t deq_pos;     /* numer następnego odczytu */
+    int head;                     /* indeks odczytu */
+
+    CACHELINE_ALIGNED
+    ConveyorSlot slots[];         /* capacity slotów */
 } Conveyor;
 
+/*
+ * Blok jednej kasy. open/accepting ustawia kierownik, queue_len zmieniają
+ * klienci i kasjer. Sprzedaż kasy (wiersz sold, bakery_sold) i licznik
+ * koszyków pisze tylko ta kasa - atomowo, bez SEM_SHM_GLOBAL.
+ * Praca kasy dla wyboru kasy (TILL_WORK): queue_work_ms zwiększa klient
+ * stający w kolejce, zmniejsza kasjer na początku kasowania, ustawiając
+ * scan_end_ms - koniec bieżącego kasowania (czas vclock, 0 = wolna).
+ */
+typedef struct CashierBlock {
+    CACHELINE_ALIGNED
+    int open;                     /* czy kasa jest otwarta */
+    int accepting;                /* czy kasa przyjmuje nowych (zamykanie = 0) */
+    int queue_len;                /* liczba klientów w kolejce */
+    _Atomic int baskets;          /* skasowane koszyki (metryka) */
+    _Atomic int queue_work_ms;    /* czas kasowania koszyków czekających w kolejce */
+    _Atomic long long scan_end_ms; /* koniec kasowania w toku, 0 = kasa wolna */
+} CashierBlock;
+
+/* Czas kasowania koszyka (ms symulacji) - kasjer, ./sim i szacunek pracy kasy */
+#define SCAN_BASE_MS        300
+#define SCAN_ITEM_MS        150
+static inline int basket_scan_ms(int item_count) {
+    return SCAN_BASE_MS + item_count * SCAN_ITEM_MS;
+}
+
+/* Wybór kasy przez klienta (BakeryState.till_choice, --till) */
+#define TILL_QUEUE          0   /* najmniej klientów w kolejce */
+#define TILL_WORK           1   /* najmniej pracy: kolejka w ms kasowania + reszta kasowania w toku (domyślnie) */
+
+/*
+ * Blok jednego piekarza: liczniki pisze tylko ten piekarz, czyta kierownik.
+ * Który piekarz wypieka produkt i - region baker_owner (bakery_baker_owner).
+ */
+typedef struct BakerBlock {
+    CACHELINE_ALIGNED
+    _Atomic int produced;         /* sztuk wypieczonych przez tego piekarza */
+    _Atomic int batches;          /* partii */
+    _Atomic int taken_over;       /* produktów przejętych od innych piekarzy */
+    long long start_ms;           /* vclock_now_ms() startu pracy */
+    long long end_ms;             /* 0 = nadal pracuje */
+} BakerBlock;
+
+/* Kasowanie partiami (BakeryState.cashier_batch): maks. koszyków zdejmowanych naraz */
+#define CASHIER_BATCH_MAX   64
+
+/*
+ * Shard liczników pisanych przez klientów. Każdy klient zapisuje tylko do
+ * swojego shardu (atomowo, bez SEM_SHM_GLOBAL); czytelnicy sumują shardy.
+ * Wyrzucone przy ewakuacji sztuki: wiersz wasted shardu (bakery_wasted),
+ * braki towaru na podajniku: wiersz stockouts (bakery_stockouts), a sztuki,
+ * których klient chciał, a nie dostał: wiersz lost (bakery_lost).
+ * Liczniki poza in_store tylko rosną - migawka STATUS (stats_*).
+ */
+typedef struct ClientShard {
+    CACHELINE_ALIGNED
+    _Atomic int in_store;         /* wejścia - wyjścia klientów tego shardu */
+    _Atomic int arrivals;         /* przyszli pod sklep */
+    _Atomic int entries;          /* weszli do sklepu */
+    _Atomic int rejected;         /* nie weszli: zamknięcie, ewakuacja, odmowa */
+} ClientShard;
+
+typedef struct BasketItem {
+    int product_id;
+    int quantity;
+} BasketItem;
+
+/*
+ * Kanał kasowy w SHM (--checkout=shm) zamiast kolejek komunikatów.
+ * Klient zajmuje skrzynkę (CheckoutSlot), wpisuje do niej koszyk i wstawia
+ * do pierścienia kasy tylko jej numer; kasjer czyta koszyk na miejscu i
+ * odpowiada w tej samej skrzynce, budząc klienta futexem na słowie state.
+ *
+ * Liczbę skrzynek wyznacza bakery_layout z N (klient w sklepie zajmuje co
+ * najwyżej jedną), zaokrągloną do pełnych słów bitmapy zajętości. Pierścień
+ * każdej kasy ma tyle samo komórek, więc nigdy się nie przepełnia.
+ */
+#define CHECKOUT_MQ         0   /* kolejki System V (domyślnie) */
+#define CHECKOUT_SHM        1
+
+#define CHECKOUT_SLOT_BITS  64  /* skrzynek na słowo bitmapy checkout_used */
+
+#define CK_FREE             0
+#define CK_CLAIMED          1   /* klient wypełnia koszyk */
+#define CK_POSTED           2   /* w pierścieniu kasy / kasowanie */
+#define CK_DONE             3   /* odpowiedź gotowa */
+#define CK_ABANDONED        4   /* klient zrezygnował (sygnał) - zwalnia kasjer */
+
+typedef struct CheckoutSlot {
+    CACHELINE_ALIGNED
+    _Atomic uint32_t state;       /* CK_*, słowo futexa odpowiedzi */
+    int cashier_id;
+    int success;
+    double total_price;
+    long client_id;
+    long long sent_us;            /* lat_now_us() wysłania koszyka */
+    int item_count;
+    BasketItem items[];           /* basket_max pozycji */
+} CheckoutSlot;
+
+typedef struct CheckoutCell {
+    _Atomic uint64_t seq;
+    int slot;
+} CheckoutCell;
+
+/* Pierścień MPSC jednej kasy: wstawiają klienci, zdejmuje tylko kasjer */
+typedef struct CheckoutRing {
+    CACHELINE_ALIGNED
+    _Atomic uint64_t enq_pos;
+
+    CACHELINE_ALIGNED
+    uint64_t deq_pos;             /* tylko kasjer */
+    _Atomic uint32_t doorbell;    /* futex kasjera: +1 przy każdym wstawieniu */
+    _Atomic uint32_t sleeping;    /* kasjer śpi na doorbell */
+
+    CACHELINE_ALIGNED
+    CheckoutCell cells[];         /* checkout_slots komórek */
+} CheckoutRing;
+
+/* Semafor na futexie (backend SYNC=futex), osobna linia cache na semafor */
+#define FUTEX_SPIN_MIN      16
+#define FUTEX_SPIN_MAX      2000
+
+typedef struct FutexSem {
+    CACHELINE_ALIGNED
+    _Atomic uint32_t value;       /* wartość semafora = słowo futexa */
+    _Atomic uint32_t waiters;     /* liczba procesów uśpionych w FUTEX_WAIT */
+    _Atomic int32_t  spin;        /* adaptacyjny limit kręcenia się przed uśpieniem */
+} FutexSem;
+
 typedef struct Product {
     char nazwa[64];            /* nazwa produktu */
     double cena;              /* cena produktu */
 } Product;
 
-/* Konfiguracja i stan globalny */
+/*
+ * Konfiguracja i stan globalny - nagłówek segmentu SHM. Za nim leżą regiony
+ * o rozmiarze zależnym od konfiguracji (offsety od początku nagłówka,
+ * wylicza bakery_layout), dostępne przez bakery_product/bakery_conveyor/...:
+ *   produkty[P], tablica offsetów podajników[P], podajniki (nagłówek + Ki slotów),
+ *   wiersze sold[P] kas, wiersze wasted[P], stockouts[P] i lost[P] shardów, histogramy opóźnień,
+ *   semafory futex (SYNC=futex), pierścienie i skrzynki kanału kasowego
+ *   (tylko CHECKOUT_SHM), pierścień logu (tylko --log=ring).
+ */
 typedef struct BakeryState {
+    /* Konfiguracja - tylko do odczytu po starcie */
     int P;                        /* liczba produktów*/
     int N;                        /* max klientów w sklepie */
     int open_hour;                /* Tp */
     int close_hour;               /* Tk */
-
-    Product produkty[MAX_P];      /* lista produktów: nazwa + cena */
-    int Ki[MAX_P];                /* pojemność podajnika i */
-
-    /* Stan */
+    int conveyor_mode;            /* CONVEYOR_SEM / CONVEYOR_LOCKFREE */
+    int checkout_mode;            /* CHECKOUT_MQ / CHECKOUT_SHM */
+    int cashier_batch;            /* koszyków na partię kasjera (1 = po jednym) */
+    int till_choice;              /* TILL_QUEUE / TILL_WORK */
+    int cashier_count;            /* liczba kas (CASHIERS_MIN..CASHIERS_MAX) */
+    int baker_count;              /* liczba piekarzy (1..BAKERS_MAX) */
+    int bake_mode;                /* BAKE_RANDOM / BAKE_DEMAND */
+    uint64_t seed;                /* ziarno główne (--seed): procesy wyprowadzają z niego swoje */
+
+    /* Zegar symulacji (vclock_*) - ustawia kierownik przed startem procesów */
+    long long clock_start_ns;     /* CLOCK_MONOTONIC w chwili startu */
+    long long clock_start_ms;     /* czas symulowany startu (ms od północy) */
+    double clock_speed;           /* 1 = czas rzeczywisty, 60 = minuta na sekundę */
+
+    /* Układ segmentu - offsety regionów (0 = regionu nie ma) */
+    size_t shm_size;              /* rozmiar całego segmentu */
+    int basket_max;               /* maks. pozycji w koszyku */
+    size_t off_products;          /* Product[P] */
+    size_t off_conveyor_table;    /* size_t[P]: offset podajnika i */
+    size_t off_sold;              /* cashier_count wierszy _Atomic int[P] */
+    size_t off_wasted;            /* CLIENT_SHARDS wierszy _Atomic int[P] */
+    size_t off_stockouts;         /* CLIENT_SHARDS wierszy _Atomic int[P]: brak towaru */
+    size_t off_lost;              /* CLIENT_SHARDS wierszy _Atomic int[P]: utracona sprzedaż (szt.) */
+    size_t off_baker_owner;       /* _Atomic int[P]: piekarz wypiekający produkt i */
+    size_t counter_row;           /* wiersz liczników: P intów do pełnych linii cache */
+    size_t off_sync_sems;         /* FutexSem[2+3P] */
+    size_t off_checkout_rings;    /* cashier_count pierścieni po checkout_ring_size */
+    size_t checkout_ring_size;
+    size_t off_checkout_used;     /* _Atomic uint64_t[checkout_slots / 64]: bit = skrzynka zajęta */
+    size_t off_checkout_slots;    /* checkout_slots skrzynek */
+    size_t checkout_slot_size;
+    int checkout_slots;           /* N zaokrąglone do CHECKOUT_SLOT_BITS */
+    size_t off_log_ring;          /* LogRing (log_ring.h), 0 = log tekstowy */
+    size_t off_latency;           /* LatHist etapów i kas (latency.h) */
+
+    /* Stan - pisze kierownik, czytają wszyscy */
+    CACHELINE_ALIGNED
     int store_open;               /* 1=otwarty, 0=zamykanie/zamknięty */
     int inventory_mode;           /* 1 po SIG_INV */
     int evacuated;                /* 1 po SIG_EVAC */
+    _Atomic uint32_t control_gen; /* +1 po każdej zmianie stanu sterującego (słowo futexa) */
 
-    int customers_in_store;       /* aktualna liczba klientów */
+    /* Gorący licznik klientów przed wejściem */
+    CACHELINE_ALIGNED
     int waiting_before_store;     /* liczba klientów czekających przed sklepem */
 
-    int cashier_open[CASHIERS];       /* czy kasa jest otwarta */
-    int cashier_accepting[CASHIERS];  /* czy kasa przyjmuje nowych (zamykanie = 0) */
-    int cashier_queue_len[CASHIERS];
+    /*
+     * Kasy i statystyki - liczniki z jednym właścicielem, aktualizowane
+     * atomowo bez SEM_SHM_GLOBAL. Sumy liczą funkcje stats_*() w common.c.
+     */
+    CashierBlock cashiers[CASHIERS_MAX];          /* używane: cashier_count */
+    ClientShard client_shards[CLIENT_SHARDS];     /* klienci: customers_in_store */
+    BakerBlock bakers[BAKERS_MAX];                /* używane: baker_count */
 
-    /* Statystyki */
-    int produced[MAX_P];          /* ile wyprodukowano (sumarycznie) */
-    int wasted[MAX_P];            /* ile wyrzucono do kosza (ewakuacja) */
-    int sold_by_cashier[CASHIERS][MAX_P]; /* ile skasował każdy kasjer */
+} BakeryState;
 
-    Conveyor conveyors[MAX_P];    /* FIFO dla każdego produktu */
+/* Dostęp do regionów segmentu (offsety z nagłówka) */
+#define BAKERY_REGION(st, off)  ((char*)(st) + (off))
 
-} BakeryState;
+static inline Product* bakery_product(const BakeryState* st, int i) {
+    return (Product*)BAKERY_REGION(st, st->off_products) + i;
+}
 
-/* =========================
- *  Indeksy semaforów
- * ========================= */
+static inline Conveyor* bakery_conveyor(const BakeryState* st, int i) {
+    const size_t* table = (const size_t*)BAKERY_REGION(st, st->off_conveyor_table);
+    return (Conveyor*)BAKERY_REGION(st, table[i]);
+}
 
-/*
- * Używamy jednego zestawu semaforów (semget) i mapujemy indeksy:
- *  - SEM_STORE_SLOTS: licznik wolnych miejsc w sklepie (N)
- *  - SEM_SHM_GLOBAL : mutex na pola globalne w SHM
- *  - Dla każdego produktu i:
- *      SEM_CONV_MUTEX(i)  : mutex na conveyor i
- *      SEM_CONV_EMPTY(i)  : licznik wolnych miejsc (Ki)
- *      SEM_CONV_FULL(i)   : licznik sztuk dostępnych
- */
+/* Wiersz sprzedaży kasy: sold[pid] */
+static inline _Atomic int* bakery_sold(const BakeryState* st, int cashier) {
+    return (_Atomic int*)BAKERY_REGION(st, st->off_sold + (size_t)cashier * st->counter_row);
+}
 
-#define SEM_STORE_SLOTS     0
-#define SEM_SHM_GLOBAL      1
+/* Wiersz sztuk wyrzuconych przez klientów shardu: wasted[pid] */
+static inline _Atomic int* bakery_wasted(const BakeryState* st, int shard) {
+    return (_Atomic int*)BAKERY_REGION(st, st->off_wasted + (size_t)shard * st->counter_row);
+}
 
-/* Początek semaforów per produkt */
-#define SEM_PRODUCTS_BASE   2
-#define SEM_PER_PRODUCT     3
+/* Wiersz braków towaru (klient nie zastał produktu) w shardzie: stockouts[pid] */
+static inline _Atomic int* bakery_stockouts(const BakeryState* st, int shard) {
+    return (_Atomic int*)BAKERY_REGION(st, st->off_stockouts + (size_t)shard * st->counter_row);
+}
 
-#define SEM_CONV_MUTEX(i)   (SEM_PRODUCTS_BASE + (i) * SEM_PER_PRODUCT + 0)
-#define SEM_CONV_EMPTY(i)   (SEM_PRODUCTS_BASE + (i) * SEM_PER_PRODUCT + 1)
-#define SEM_CONV_FULL(i)    (SEM_PRODUCTS_BASE + (i) * SEM_PER_PRODUCT + 2)
+/* Wiersz utraconej sprzedaży shardu: lost[pid] - sztuki brakujące do zamówienia klienta */
+static inline _Atomic int* bakery_lost(const BakeryState* st, int shard) {
+    return (_Atomic int*)BAKERY_REGION(st, st->off_lost + (size_t)shard * st->counter_row);
+}
 
-/* Całkowita liczba semaforów w zestawie: 2 + 3*P */
-static inline int sem_count_for_P(int P) { return SEM_PRODUCTS_BASE + SEM_PER_PRODUCT * P; }
+static inline FutexSem* bakery_sync_sem(const BakeryState* st, int sem_num) {
+    return (FutexSem*)BAKERY_REGION(st, st->off_sync_sems) + sem_num;
+}
+
+static inline _Atomic int* bakery_baker_owner(const BakeryState* st) {
+    return (_Atomic int*)BAKERY_REGION(st, st->off_baker_owner);
+}
+
+static inline CheckoutRing* bakery_checkout_ring(const BakeryState* st, int cashier) {
+    return (CheckoutRing*)BAKERY_REGION(st, st->off_checkout_rings + (size_t)cashier * st->checkout_ring_size);
+}
+
+static inline _Atomic uint64_t* bakery_checkout_used(const BakeryState* st) {
+    return (_Atomic uint64_t*)BAKERY_REGION(st, st->off_checkout_used);
+}
+
+static inline CheckoutSlot* bakery_checkout_slot(const BakeryState* st, int slot) {
+    return (CheckoutSlot*)BAKERY_REGION(st, st->off_checkout_slots + (size_t)slot * st->checkout_slot_size);
+}
+
+#ifndef BAKERY_PACKED_LAYOUT
+/* Raport układu w czasie kompilacji: granice linii cache (szczegóły: ./manager layout) */
+#define ASSERT_CACHELINE(type, field) \
+    _Static_assert(offsetof(type, field) % CACHE_LINE == 0, #type "." #field " nie zaczyna linii cache")
+
+ASSERT_CACHELINE(Conveyor, enq_pos);
+ASSERT_CACHELINE(Conveyor, deq_pos);
+ASSERT_CACHELINE(Conveyor, slots);
+ASSERT_CACHELINE(CashierBlock, open);
+ASSERT_CACHELINE(BakeryState, store_open);
+ASSERT_CACHELINE(BakeryState, waiting_before_store);
+ASSERT_CACHELINE(BakeryState, cashiers);
+ASSERT_CACHELINE(CheckoutRing, deq_pos);
+ASSERT_CACHELINE(CheckoutRing, cells);
+ASSERT_CACHELINE(BakeryState, client_shards);
+ASSERT_CACHELINE(BakeryState, bakers);
+_Static_assert(sizeof(Conveyor) % CACHE_LINE == 0, "Conveyor musi zajmować pełne linie cache");
+_Static_assert(sizeof(CashierBlock) % CACHE_LINE == 0, "CashierBlock musi zajmować pełne linie cache");
+_Static_assert(sizeof(ClientShard) % CACHE_LINE == 0, "ClientShard musi zajmować pełne linie cache");
+_Static_assert(sizeof(FutexSem) % CACHE_LINE == 0, "FutexSem musi zajmować pełne linie cache");
+_Static_assert(offsetof(Conveyor, deq_pos) - offsetof(Conveyor, enq_pos) >= CACHE_LINE,
+               "producent i konsumenci podajnika na wspólnej linii cache");
+#endif
 
 /* =========================
  *  Kolejki komunikatów
  * ========================= */
 
-#define MAX_BASKET_ITEMS    16  
-
-typedef struct BasketItem {
-    int product_id;
-    int quantity;
-} BasketItem;
+/* mtype koszyka w kolejce kasy; odpowiedzi mają mtype = client_id (> 1),
+ * więc kasjer odbiera wyłącznie CLIENT_MSG_TYPE i nie przechwytuje odpowiedzi */
+#define CLIENT_MSG_TYPE     1
 
-/* Wiadomość klient -> kasjer */
+/* Wiadomość klient -> kasjer (zmiennej długości: item_count pozycji) */
 typedef struct ClientMsg {
-    long mtype;              /* np. 1 */
-    pid_t client_pid;
+    long mtype;              /* = CLIENT_MSG_TYPE */
+    long client_id;          /* mtype odpowiedzi: PID procesu klienta albo id klienta w silniku */
+    long long sent_us;       /* lat_now_us() wysłania - kasjer liczy czas w kolejce */
     int item_count;
-    BasketItem items[MAX_BASKET_ITEMS];
+    BasketItem items[];
 } ClientMsg;
 
+/* Rozmiar ClientMsg z n pozycjami (bufor); msgsnd/msgrcv biorą go bez pola mtype */
+static inline size_t client_msg_size(int n) {
+    return offsetof(ClientMsg, items) + (size_t)n * sizeof(BasketItem);
+}
+
 /* Wiadomość kasjer -> klient (potwierdzenie zakończenia kasowania) */
 typedef struct CashierReply {
-    long mtype;              /* = client_pid (klient odbiera po swoim PID) */
+    long mtype;              /* = client_id (klient odbiera po swoim identyfikatorze) */
     int cashier_id;
     double total_price;      /* suma do zapłaty */
     int success;             /* 1 = OK, 0 = błąd */
 } CashierReply;
 
+/* Statystyki testu (kierownik: czas rzeczywisty, sim: czas symulowany) */
+typedef struct TestStats {
+    int clients_spawned;
+    int clients_entered;
+    int clients_completed;
+    int max_concurrent;
+    int waiting_clients;
+    long long start_time_ms;
+    long long end_time_ms;
+} TestStats;
+
 /* =========================
  *  Uchwyt do zasobów IPC
  * ========================= */
@@ -214,9 +539,20 @@ typedef struct CashierReply {
 typedef struct IpcHandles {
     int shm_id;
     int sem_id;
-    int msg_id[CASHIERS];
+    int msg_id[CASHIERS_MAX];     /* kolejka kasy i (cashier_count z SHM) */
 } IpcHandles;
 
+/* Konfiguracja wyznaczająca układ segmentu SHM */
+typedef struct ShmConfig {
+    int P;
+    const int* Ki;                /* pojemności podajników [P] */
+    int basket_max;
+    int cashiers;
+    int checkout_mode;
+    int log_records;              /* pierścień logu (--log=ring), 0 = log tekstowy */
+    int store_n;                  /* N - liczba skrzynek kanału kasowego (CHECKOUT_SHM) */
+} ShmConfig;
+
 /* =========================
  *  API wspólne (common.c)
  * ========================= */
@@ -229,22 +565,210 @@ extern "C" {
 key_t bakery_ftok_or_die(int proj_id);
 void ensure_ipc_key_file_or_die(void);
 
-void ipc_create_or_die(IpcHandles* out, int P);
+/*
+ * Układ segmentu: zwraca jego rozmiar dla konfiguracji; gdy st != NULL, wpisuje
+ * offsety regionów, tablicę podajników i ich pojemności (st wyzerowany, >= rozmiar).
+ */
+size_t bakery_layout(BakeryState* st, const ShmConfig* cfg);
+
+void ipc_create_or_die(IpcHandles* out, const ShmConfig* cfg);
 void ipc_attach_or_die(const IpcHandles* h, BakeryState** out_state);
+void ipc_open_queues_or_die(IpcHandles* h, const BakeryState* st); /* po attach: kolejki kas */
 void ipc_detach_or_die(BakeryState* state);
+BakeryState* bakery_attached_state(void);        /* segment dołączony przez ipc_attach_or_die */
 void ipc_destroy_or_die(const IpcHandles* h, int P);
 
-/* Semafory: operacje P/V + nowait */
+/* Semafory: operacje P/V + nowait (backend: SYNC=sysv lub SYNC=futex) */
 void sem_P(int sem_id, int sem_num);
+int  sem_P_intr(int sem_id, int sem_num);   /* 0=ok, -1=przerwane sygnałem (EINTR) lub błąd */
 int  sem_P_nowait(int sem_id, int sem_num); /* 0=ok, -1=błąd (errno ustawione) */
+int  sem_P_timed(int sem_id, int sem_num, int timeout_ms); /* ms rzeczywiste; -1: EAGAIN=czas minął, EINTR */
 void sem_V(int sem_id, int sem_num);
+int  sem_getval(int sem_id, int sem_num);
+void sem_setval(int sem_id, int sem_num, int val);
+
+/* Futex współdzielony między procesami (słowo w SHM) */
+int  futex_wait(_Atomic uint32_t* addr, uint32_t expected, const struct timespec* timeout);
+int  futex_wake(_Atomic uint32_t* addr, int count);
 
 /* Mutex dla SHM globalnej */
 void shm_lock(int sem_id);
 void shm_unlock(int sem_id);
 
-/* Losowanie */
-int rand_between(int a, int b);
+/* Podajniki: 0=ok, -1=błąd (errno: EAGAIN pełny/pusty, EINTR przerwane sygnałem, EINVAL) */
+void conveyor_init(BakeryState* st, int pid);   /* pojemność z bakery_layout */
+int  conveyor_push(BakeryState* st, int sem_id, int pid, int item, int nowait);
+int  conveyor_pop(BakeryState* st, int sem_id, int pid, int* out_item);
+int  conveyor_count(const BakeryState* st, int pid);
+
+/*
+ * Operacje wsadowe - jedna rezerwacja i jedna sekcja krytyczna na całą partię.
+ * push_n: dokłada sztuki first_item..first_item+n-1 (n obcięte do Ki);
+ *         nowait=0 czeka na n miejsc, nowait=1 dokłada "do n" (częściowo).
+ * pop_up_to_n: zdejmuje "do max" dostępnych sztuk, bez czekania.
+ * Zwracają liczbę przeniesionych sztuk (>0) albo -1 (errno jak wyżej).
+ */
+int  conveyor_push_n(BakeryState* st, int sem_id, int pid, int first_item, int n, int nowait);
+int  conveyor_pop_up_to_n(BakeryState* st, int sem_id, int pid, int max, int* out_items);
+
+/*
+ * Kanał kasowy w SHM. submit: zajmij skrzynkę, wpisz koszyk, wstaw do pierścienia
+ * kasy -> numer skrzynki albo -1 (EAGAIN brak skrzynek/miejsca). wait: czekaj na
+ * odpowiedź (nowait=1 -> EAGAIN gdy jeszcze nie ma, EINTR przerwane sygnałem).
+ * take: kasjer zdejmuje kolejną skrzynkę (timeout_ms<0 bez limitu, 0 bez czekania).
+ * abandon: klient rezygnuje z oczekiwania (skrzynkę zwolni kasjer).
+ */
+void checkout_init(BakeryState* st);
+int  checkout_submit(BakeryState* st, int cashier, long client_id, const BasketItem* items, int n);
+int  checkout_wait(BakeryState* st, int slot, int nowait, CashierReply* out);
+void checkout_abandon(BakeryState* st, int slot);
+int  checkout_take(BakeryState* st, int cashier, int timeout_ms);
+void checkout_reply(BakeryState* st, int slot, int cashier, double total_price, int success);
+
+/*
+ * Stan sterujący (store_open, evacuated, inventory_mode, open/accepting kas)
+ * pisze kierownik pod SEM_SHM_GLOBAL, a po zmianie woła control_publish:
+ * +1 w control_gen i budzenie czekających. Procesy trzymają migawkę i biorą
+ * shm_lock tylko po zmianie generacji; control_wait śpi na futexie do zmiany.
+ * Kasjer czekający na koszyk (msgrcv / doorbell pierścienia) nie śpi na
+ * control_gen - budzi go control_wake_cashiers: pusta wiadomość
+ * CONTROL_WAKE_ID w kolejce kasy albo dzwonek pierścienia (--checkout=shm).
+ */
+#define CONTROL_WAKE_ID     0   /* client_id wiadomości budzącej kasjera (klienci mają id > 1) */
+
+typedef struct ControlView {
+    uint32_t gen;
+    int valid;                    /* 0 = migawki jeszcze nie było */
+    int store_open;
+    int evacuated;
+    int inventory_mode;
+    int cashier_open;             /* kasa podana w control_refresh (0 gdy cashier < 0) */
+    int cashier_accepting;
+} ControlView;
+
+void control_publish(BakeryState* st);
+void control_wake_cashiers(BakeryState* st, const IpcHandles* h);
+int  control_refresh(BakeryState* st, int sem_id, int cashier, ControlView* v); /* 1 = nowa migawka */
+int  control_wait(BakeryState* st, const ControlView* v, int timeout_ms); /* ms symulacji; 0=zmiana, -1=EINTR/ETIMEDOUT */
+
+/* Statystyki: shard klienta oraz sumy liczone na żądanie (bez blokady) */
+int stats_shard_of(long client_id);
+ClientShard* stats_client_shard(BakeryState* st, long client_id);
+int stats_customers_in_store(const BakeryState* st);
+int stats_produced(const BakeryState* st, int pid);
+int stats_sold(const BakeryState* st, int pid);
+int stats_wasted(const BakeryState* st, int pid);
+int stats_stockouts(const BakeryState* st, int pid);
+int stats_lost(const BakeryState* st, int pid);
+int stats_arrivals(const BakeryState* st);
+int stats_entries(const BakeryState* st);
+int stats_rejected(const BakeryState* st);
+int stats_baskets(const BakeryState* st, int cashier);
+
+/* Polityka sklepu - te same reguły w ./manager, kliencie i symulacji ./sim */
+void bakery_default_products(Product* produkty, int* Ki, int P, int ki); /* ki=0: domyślne Ki */
+int  cashier_policy_desired(int customers, int N, int cashiers, int last); /* ile kas przyjmuje (1..cashiers) */
+
+/*
+ * Obsada kas (--policy). THRESHOLD: progi liczby klientów w sklepie
+ * (cashier_policy_desired). EWMA: prognoza pracy przy kasach - tempo
+ * przyjść do kas wygładzone wykładniczo z trendem (Holt) na STAFF_HORIZON_MS
+ * naprzód plus kolejki do rozładowania w tym horyzoncie, wobec przepustowości
+ * kas z EWMA czasu kasowania każdej kasy. Kasy otwiera od razu, gdy prognoza
+ * przekracza STAFF_UTIL ich przepustowości; zamyka po jednej, gdy prognoza
+ * mieści się w STAFF_SLACK części kas o jedną mniej. Kasa 0 zawsze przyjmuje,
+ * zamykana kasa dokańcza kolejkę (accepting=0).
+ */
+#define POLICY_THRESHOLD    0
+#define POLICY_EWMA         1
+
+#define STAFF_ALPHA         0.3     /* waga nowej próbki tempa i czasu kasowania */
+#define STAFF_BETA          0.2     /* waga nowej próbki trendu */
+#define STAFF_HORIZON_MS    10000   /* horyzont prognozy (ms symulacji) */
+#define STAFF_UTIL          0.8     /* docelowe obciążenie otwartych kas */
+#define STAFF_SLACK         0.7     /* zamknięcie: prognoza <= SLACK * UTIL * (kasy - 1) */
+#define STAFF_SERVICE_MS    750.0   /* czas kasowania przed pierwszym pomiarem (basket_scan_ms(3)) */
+
+typedef struct StaffingPolicy {
+    int policy;                   /* POLICY_THRESHOLD / POLICY_EWMA */
+    int last;                     /* kas przyjmujących po ostatniej decyzji */
+
+    /* POLICY_EWMA: poprzednia próbka i wygładzone oceny */
+    int primed;
+    long long t_ms;
+    long long arrivals;           /* koszyki przy kasach (skasowane + w kolejkach) narastająco */
+    double rate;                  /* przyjścia do kas [koszyki/s] */
+    double trend;                 /* zmiana tempa [koszyki/s^2] */
+    double demand;                /* prognoza z ostatniej decyzji [koszyki/s] */
+    uint64_t scan_count[CASHIERS_MAX];
+    uint64_t scan_sum_us[CASHIERS_MAX];
+    double service_ms[CASHIERS_MAX]; /* 0 = kasa jeszcze nie kasowała */
+} StaffingPolicy;
+
+void        staffing_init(StaffingPolicy* sp, int policy);
+int         staffing_policy_parse(const char* name);    /* -1 = nieznana */
+const char* staffing_policy_name(int policy);
+/* Ile kas ma przyjmować (1..cashier_count); now_ms - czas symulacji, st czytany pod shm_lock */
+int         staffing_desired(StaffingPolicy* sp, const BakeryState* st, int customers, long long now_ms);
+
+/*
+ * Harmonogram piekarza (--bake). RANDOM: losowy produkt z miejscem na partię.
+ * DEMAND: produkt o największym niedoborze - popyt (sztuki zdjęte z podajnika
+ * i utracone przez klientów) wygładzony wykładniczo i przeliczony na
+ * BAKE_HORIZON_MS naprzód, minus bieżący zapas na podajniku.
+ */
+#define BAKE_RANDOM         0
+#define BAKE_DEMAND         1
+
+#define BAKE_ALPHA          0.3     /* waga nowej próbki popytu */
+#define BAKE_HORIZON_MS     3000    /* na ile ms symulacji naprzód piec */
+
+typedef struct BakeDemand {
+    int P;
+    int primed;
+    long long t_ms;
+    int* seen;                    /* popyt narastająco przy ostatniej próbce [P] */
+    double* rate;                 /* popyt [szt./s] [P] */
+} BakeDemand;
+
+void   bake_demand_init(BakeDemand* bd, int P);
+void   bake_demand_free(BakeDemand* bd);
+/* stock[pid] - sztuki na podajniku teraz; now_ms - czas symulacji */
+void   bake_demand_update(BakeDemand* bd, const BakeryState* st, const int* stock, long long now_ms);
+double bake_demand_score(const BakeDemand* bd, int pid, int stock); /* większy = piec pilniej */
+int         bake_mode_parse(const char* name);          /* -1 = nieznany */
+const char* bake_mode_name(int mode);
+int  cashier_choose(const BakeryState* st, long client_id, long long now_ms); /* kasa dla klienta */
+/* Kolejka klienta przy kasie (pod shm_lock): queue_len i praca kasy; leave cofa join */
+void cashier_queue_join(BakeryState* st, int cashier, int item_count);
+void cashier_queue_leave(BakeryState* st, int cashier, int item_count);
+void print_test_stats(const BakeryState* st, const TestStats* ts);
+
+/* Raport układu BakeryState (offsety i linie cache, regiony dla konfiguracji) */
+void bakery_layout_report(FILE* out, const ShmConfig* cfg);
+
+/*
+ * Losowanie: xoshiro256** ze stanem na proces/wątek. Ziarno każdej roli
+ * wyprowadza rng_derive() z ziarna głównego - ten sam --seed daje te same
+ * losowania piekarzy, kasjerów i klientów (klient o danym numerze kolejnym).
+ */
+typedef struct Rng {
+    uint64_t s[4];
+} Rng;
+
+enum { RNG_ROLE_MANAGER, RNG_ROLE_BAKER, RNG_ROLE_CASHIER, RNG_ROLE_CLIENT, RNG_ROLE_ENGINE };
+
+void     rng_seed(Rng* r, uint64_t seed);
+uint64_t rng_next(Rng* r);
+int      rng_between(Rng* r, int a, int b);                  /* [a, b] bez obciążenia modulo */
+uint64_t rng_derive(uint64_t master, int role, long index);
+uint64_t rng_time_seed(void);                                /* gdy brak --seed */
+void     rng_thread_seed(uint64_t seed);                     /* generator rand_between wątku */
+int      rand_between(int a, int b);
+
+/* Log tekstowy (LOGF) */
+const char* log_tag_color(const char* tag);
+void log_text(const char* tag, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
 
 /* Walidacja parametrów (bakery) */
 int validate_config(int P, int N, int open_hour, int close_hour, const int* Ki, const Product* produkty);
@@ -252,8 +776,21 @@ int validate_config(int P, int N, int open_hour, int close_hour, const int* Ki,
 /* Bezpieczna instalacja handlerów sygnałów */
 void install_signal_handlers_or_die(void (*handler)(int));
 
-/* Pomocnicze: czas */
+/*
+ * Zegar symulacji: czas symulowany = start + (teraz - start_rzeczywisty) * speed.
+ * Czytają go wszystkie procesy po ipc_attach_or_die; bez SHM - czas rzeczywisty.
+ */
+void      vclock_init(BakeryState* st, double speed, long long start_ms_of_day);
+long long vclock_now_ms(void);       /* ms od północy (czasu symulowanego) */
+int       vclock_hour(void);
+double    vclock_speed(void);
+void      vclock_stamp(char* buf, size_t n); /* "HH:MM:SS.mmm " albo "" bez zegara */
+void      vclock_stamp_at(char* buf, size_t n, long long t_ms); /* jw. dla danej chwili, t_ms<0 -> "" */
+long long clock_local_ms_of_day(void);       /* bieżąca godzina zegara ściennego */
+
+/* Pomocnicze: czas. msleep - ms czasu symulowanego, msleep_real - rzeczywiste */
 void msleep(int ms);
+void msleep_real(int ms);
 
 /* Kolorowe logowanie dla specjalnych komunikatów */
 void log_header(const char* title);
@@ -0,0 +1,120 @@
+#include "latency.h"
+
+/*
+ * latency.c – zapis do histogramów opóźnień i raport percentyli.
+ */
+
+static const char* const g_lat_names[LAT_STAGE_COUNT] = {
+    [LAT_DOOR]       = "przed sklepem",
+    [LAT_SHOPPING]   = "zakupy",
+    [LAT_CONVEYOR]   = "podajnik",
+    [LAT_TILL_QUEUE] = "kolejka do kasy",
+    [LAT_TILL_SCAN]  = "kasowanie",
+    [LAT_CHECKOUT]   = "przy kasie (lacznie)",
+};
+
+size_t lat_region_size(int cashiers) {
+    return (size_t)(LAT_STAGE_COUNT + cashiers * LAT_TILL_STAGES) * sizeof(LatHist);
+}
+
+long long lat_now_us(void) {
+    struct timespec ts;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Grupa g >= 1 obejmuje [LAT_SUB << (g-1), LAT_SUB << g) kubełkami szerokości 2^(g-1) */
+static int lat_bucket(uint64_t us) {
+    if (us < LAT_SUB) return (int)us;
+    int msb = 63 - __builtin_clzll(us);
+    int g = msb - LAT_SUB_BITS + 1;
+    if (g >= LAT_GROUPS) return LAT_BUCKETS - 1;
+    return g * LAT_SUB + (int)(us >> (msb - LAT_SUB_BITS)) - LAT_SUB;
+}
+
+/* Największa wartość kubełka */
+static uint64_t lat_bucket_high(int idx) {
+    int g = idx / LAT_SUB;
+    uint64_t s = (uint64_t)(idx % LAT_SUB);
+    if (g == 0) return s;
+    return ((LAT_SUB + s + 1) << (g - 1)) - 1;
+}
+
+static void lat_hist_add(LatHist* h, uint64_t us) {
+    atomic_fetch_add_explicit(&h->buckets[lat_bucket(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, us, memory_order_relaxed);
+    uint64_t m = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (us > m && !atomic_compare_exchange_weak_explicit(&h->max_us, &m, us,
+                                                            memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void lat_record(BakeryState* st, int stage, int cashier, long long us) {
+    if (!st->off_latency) return;
+    uint64_t v = us > 0 ? (uint64_t)us : 0;
+    lat_hist_add(bakery_lat(st, stage, -1), v);
+    if (cashier >= 0 && cashier < st->cashier_count) lat_hist_add(bakery_lat(st, stage, cashier), v);
+}
+
+uint64_t lat_count(const LatHist* h) {
+    uint64_t n = 0;
+    for (int i = 0; i < LAT_BUCKETS; ++i) n += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    return n;
+}
+
+uint64_t lat_percentile(const LatHist* h, double q) {
+    uint64_t total = lat_count(h);
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total + 0.999999);
+    if (rank < 1) rank = 1;
+    uint64_t max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; ++i) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t v = lat_bucket_high(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+/* 850us / 12.40ms / 3.25s */
+static const char* lat_fmt(char* buf, size_t n, uint64_t us) {
+    if (us < 1000) snprintf(buf, n, "%lluus", (unsigned long long)us);
+    else if (us < 1000000) snprintf(buf, n, "%.2fms", (double)us / 1e3);
+    else snprintf(buf, n, "%.2fs", (double)us / 1e6);
+    return buf;
+}
+
+static void lat_row(FILE* out, const char* name, const LatHist* h) {
+    static const double qs[] = { 0.50, 0.90, 0.99, 0.999 };
+    uint64_t n = lat_count(h);
+    fprintf(out, "  %-24s %8llu", name, (unsigned long long)n);
+    char buf[24];
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); ++i) {
+        fprintf(out, " %9s", n ? lat_fmt(buf, sizeof(buf), lat_percentile(h, qs[i])) : "-");
+    }
+    fprintf(out, " %9s\n", n ? lat_fmt(buf, sizeof(buf), atomic_load_explicit(&h->max_us, memory_order_relaxed)) : "-");
+}
+
+void lat_report(FILE* out, const BakeryState* st) {
+    if (!st->off_latency) return;
+    /* procesy mierzą czas rzeczywisty przy zegarze xclock_speed, sim (clock_speed = 0) - symulowany */
+    if (st->clock_speed > 0.0) {
+        fprintf(out, "Opoznienia etapow klienta (czas rzeczywisty, zegar x%g):\n", st->clock_speed);
+    } else {
+        fprintf(out, "Opoznienia etapow klienta (czas symulowany):\n");
+    }
+    fprintf(out, "  %-24s %8s %9s %9s %9s %9s %9s\n", "etap", "liczba", "p50", "p90", "p99", "p99.9", "max");
+    for (int s = 0; s < LAT_STAGE_COUNT; ++s) lat_row(out, g_lat_names[s], bakery_lat(st, s, -1));
+    for (int c = 0; c < st->cashier_count; ++c) {
+        for (int s = LAT_TILL_QUEUE; s < LAT_TILL_QUEUE + LAT_TILL_STAGES; ++s) {
+            const LatHist* h = bakery_lat(st, s, c);
+            if (lat_count(h) == 0) continue;
+            char name[40];
+            snprintf(name, sizeof(name), "kasa %d: %s", c, g_lat_names[s]);
+            lat_row(out, name, h);
+        }
+    }
+}
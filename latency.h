@@ -0,0 +1,56 @@
+#ifndef BAKERY_LATENCY_H
+#define BAKERY_LATENCY_H
+
+#include "common.h"
+
+/*
+ * latency.h – histogramy opóźnień etapów klienta (region w segmencie SHM).
+ *
+ * Kubełki logarytmiczne jak w HdrHistogram: wartości < 2*LAT_SUB us są
+ * dokładne, dalej każda potęga dwójki dzieli się na LAT_SUB równych kubełków
+ * (błąd względny percentyla <= 1/LAT_SUB). Klienci i kasjerzy zapisują
+ * atomowo (relaxed) bez blokad; kierownik liczy percentyle na koniec testu.
+ *
+ * Procesy mierzą czas rzeczywisty (CLOCK_MONOTONIC), ./sim - symulowany.
+ */
+
+#define LAT_SUB_BITS        4
+#define LAT_SUB             (1 << LAT_SUB_BITS)
+#define LAT_GROUPS          37      /* do 2^40 us (~12 dni), większe w ostatnim kubełku */
+#define LAT_BUCKETS         (LAT_GROUPS * LAT_SUB)
+
+typedef enum LatStage {
+    LAT_DOOR,                     /* czekanie przed sklepem (wait_before_store) */
+    LAT_SHOPPING,                 /* od wejścia do podejścia do kasy */
+    LAT_CONVEYOR,                 /* jedno zdjęcie z podajnika (blokada + pobranie) */
+    LAT_TILL_QUEUE,               /* od wysłania koszyka do początku kasowania */
+    LAT_TILL_SCAN,                /* kasowanie koszyka */
+    LAT_CHECKOUT,                 /* przy kasie łącznie: od wysłania koszyka do odpowiedzi */
+    LAT_STAGE_COUNT
+} LatStage;
+
+/* Etapy zapisywane także per kasa: LAT_TILL_QUEUE, LAT_TILL_SCAN */
+#define LAT_TILL_STAGES     2
+
+typedef struct LatHist {
+    CACHELINE_ALIGNED
+    _Atomic uint64_t sum_us;
+    _Atomic uint64_t max_us;
+    _Atomic uint32_t buckets[LAT_BUCKETS];
+} LatHist;
+
+/* Histogram etapu (cashier < 0) albo etapu kasy (tylko LAT_TILL_*) */
+static inline LatHist* bakery_lat(const BakeryState* st, int stage, int cashier) {
+    LatHist* h = (LatHist*)BAKERY_REGION(st, st->off_latency);
+    if (cashier < 0) return h + stage;
+    return h + LAT_STAGE_COUNT + cashier * LAT_TILL_STAGES + (stage - LAT_TILL_QUEUE);
+}
+
+size_t    lat_region_size(int cashiers);
+long long lat_now_us(void);                                  /* CLOCK_MONOTONIC */
+void      lat_record(BakeryState* st, int stage, int cashier, long long us); /* cashier<0: bez kasy */
+uint64_t  lat_count(const LatHist* h);
+uint64_t  lat_percentile(const LatHist* h, double q);        /* q w [0, 1] */
+void      lat_report(FILE* out, const BakeryState* st);      /* p50/p90/p99/p99.9 etapów i kas */
+
+#endif /* BAKERY_LATENCY_H */
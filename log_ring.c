@@ -0,0 +1,181 @@
+#include "log_ring.h"
+
+/*
+ * log_ring.c – binarny log zdarzeń: zapis rekordu do pierścienia w SHM
+ * i formatowanie rekordów (opróżniający pierścień albo od razu, bez pierścienia).
+ */
+
+typedef struct LogRoleDef {
+    const char* tag;
+    const char* color;
+} LogRoleDef;
+
+static const LogRoleDef g_log_roles[LOG_ROLE_COUNT] = {
+    [LOG_ROLE_KIEROWNIK] = { "kierownik", COLOR_KIEROWNIK },
+    [LOG_ROLE_PIEKARZ]   = { "piekarz",   COLOR_PIEKARZ },
+    [LOG_ROLE_KASJER]    = { "kasjer",    COLOR_KASJER },
+    [LOG_ROLE_KLIENT]    = { "klient",    COLOR_KLIENT },
+};
+
+static const char* const g_log_events[LOG_EVENT_COUNT] = {
+    [EV_KL_DOOR_WAIT]      = "Czekam przed sklepem - brak wolnych miejsc (w sklepie: %d/%d, w kolejce: %d).",
+    [EV_KL_DOOR_ABORT]     = "Przerywam oczekiwanie przed sklepem (sygnal).",
+    [EV_KL_NO_PRODUCT]     = "Brak produktu %d na podajniku - pomijam",
+    [EV_KL_PARTIAL]        = "Produkt %d: wzialem %d z %d (reszty brak)",
+    [EV_KL_EMPTY_BASKET]   = "Koszyk pusty - nie znalazlem zadnych produktow",
+    [EV_KL_STORE_CLOSED]   = "Sklep zamkniety - nie moge wyslac koszyka (%d produktow)",
+    [EV_KL_SEND]           = "Wysylam koszyk do kasy %d, item_count=%d",
+    [EV_KL_CHOSE]          = "Wybralem kase %d (dlugosc kolejki: %d), czekam na kasowanie...",
+    [EV_KL_PAID]           = "Zaplacono %.2f zl przy kasie %d",
+    [EV_KL_CHECKOUT_ABORT] = "Kasowanie przerwane (ewakuacja/zamkniecie)",
+    [EV_KL_CHECKOUT_EVAC]  = "Ewakuacja podczas oczekiwania na kase - wychodze",
+    [EV_KL_NOT_ENTERED]    = "Nie wszedlem do sklepu - ewakuacja/zamkniecie.",
+    [EV_KL_ENTER]          = "Wchodze do sklepu (klientow w sklepie: %d/%d)",
+    [EV_KL_LOOK]           = "Rozgladam sie po sklepie...",
+    [EV_KL_EXIT]           = "Wychodze ze sklepu.",
+    [EV_KL_EVAC]           = "EWAKUACJA! Odkladam towar do kosza i wychodze.",
+    [EV_KL_FINISHED]       = "Zakonczono zakupy, liczba pozycji w koszyku: %d",
+    [EV_KA_SALE]           = "KASUJĘ: klient=%ld, pozycji=%d (kasa=%d)",
+    [EV_KA_SERVE]          = "Obsługuję klienta %ld (pozycji: %d)",
+    [EV_KA_ITEM]           = "  - %P x%d",
+    [EV_KA_BAD_ITEM]       = "  - (BŁĘDNY PRODUKT pid=%d, qty=%d)",
+    [EV_KA_SERVED]         = "Zakończyłem obsługę klienta %ld (kasa=%d, suma=%.2f zł)",
+    [EV_PI_TAKEOVER]       = "Piekarz %d przejmuje %P od piekarza %d (pusty podajnik)",
+    [EV_PI_FULL]           = "Taśma pełna dla %P, czekam...",
+    [EV_PI_BAKED]          = "Wypiek: %P x%d",
+    [EV_KI_CHILD_EXIT]     = "Proces potomny pid=%d zakończył się kodem=%d",
+    [EV_KI_CHILD_SIGNAL]   = "Proces potomny pid=%d zakończony sygnałem=%d",
+    [EV_KI_CHILD_OTHER]    = "Proces potomny pid=%d zakończony (status=%d)",
+};
+
+size_t log_ring_size(int capacity) {
+    return sizeof(LogRing) + (size_t)capacity * sizeof(LogRecord);
+}
+
+void log_ring_init(LogRing* r, int capacity) {
+    r->capacity = (uint64_t)capacity;
+    atomic_init(&r->closing, 0);
+    atomic_init(&r->enq_pos, 0);
+    atomic_init(&r->dropped, 0);
+    r->deq_pos = 0;
+    for (int i = 0; i < capacity; ++i) atomic_init(&r->recs[i].seq, (uint64_t)i);
+}
+
+/*
+ * Formatowanie wg tabeli: %d/%ld/%lld/%i/%u -> int64, %f -> double (bity w int64),
+ * %P -> nazwa produktu (id w argumencie). Flagi, szerokość i precyzja jak w printf.
+ */
+static int log_format_msg(char* buf, size_t n, const BakeryState* st, const char* fmt,
+                          const int64_t* args, int nargs) {
+    size_t len = 0;
+    int ai = 0;
+    for (const char* p = fmt; *p && len + 1 < n; ) {
+        if (*p != '%') {
+            buf[len++] = *p++;
+            continue;
+        }
+        const char* spec = p++;
+        if (*p == '%') {
+            buf[len++] = '%';
+            ++p;
+            continue;
+        }
+        while (*p && strchr("-+ #0123456789.", *p)) ++p;
+        const char* mods = p;
+        while (*p == 'l' || *p == 'h' || *p == 'z') ++p;
+        char conv = *p ? *p++ : 'd';
+
+        char f[24];
+        size_t flen = (size_t)(mods - spec);
+        if (flen > sizeof(f) - 4) flen = sizeof(f) - 4;
+        memcpy(f, spec, flen);
+        int64_t a = ai < nargs ? args[ai] : 0;
+        ++ai;
+
+        int w;
+        if (conv == 'f') {
+            double d;
+            memcpy(&d, &a, sizeof(d));
+            f[flen] = 'f';
+            f[flen + 1] = '\0';
+            w = snprintf(buf + len, n - len, f, d);
+        } else if (conv == 'P') {
+            const char* name = st && a >= 0 && a < st->P ? bakery_product(st, (int)a)->nazwa : "?";
+            f[flen] = 's';
+            f[flen + 1] = '\0';
+            w = snprintf(buf + len, n - len, f, name);
+        } else {
+            memcpy(f + flen, "lld", 4);
+            w = snprintf(buf + len, n - len, f, (long long)a);
+        }
+        if (w < 0) break;
+        len += (size_t)w < n - len ? (size_t)w : n - len - 1;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+static void log_write_record(FILE* out, const BakeryState* st, const LogRecord* rec) {
+    const LogRoleDef* role = &g_log_roles[rec->role < LOG_ROLE_COUNT ? rec->role : LOG_ROLE_KIEROWNIK];
+    const char* fmt = rec->event < LOG_EVENT_COUNT ? g_log_events[rec->event] : "(nieznane zdarzenie %d)";
+    char line[512];
+    char ts[24];
+    vclock_stamp_at(ts, sizeof(ts), rec->t_ms);
+    int n = snprintf(line, sizeof(line), "%s%s[%s pid=%d]%s ", ts, role->color, role->tag, (int)rec->pid, ANSI_RESET);
+    n += log_format_msg(line + n, sizeof(line) - (size_t)n - 1, st, fmt, rec->args, rec->nargs);
+    line[n++] = '\n';
+    fwrite(line, 1, (size_t)n, out);
+}
+
+void log_emit(int role, const int64_t* ev_args, int n) {
+    BakeryState* st = bakery_attached_state();
+    LogRing* r = st ? bakery_log_ring(st) : NULL;
+
+    LogRecord tmp;
+    LogRecord* rec = &tmp;
+    uint64_t pos = 0;
+    if (r) {
+        /* rezerwacja rekordu (Vyukov MPSC); pełny pierścień -> rekord odrzucony, bez czekania */
+        pos = atomic_load_explicit(&r->enq_pos, memory_order_relaxed);
+        for (;;) {
+            rec = &r->recs[pos & (r->capacity - 1)];
+            uint64_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+            int64_t dif = (int64_t)(seq - pos);
+            if (dif == 0) {
+                if (atomic_compare_exchange_weak_explicit(&r->enq_pos, &pos, pos + 1,
+                                                          memory_order_relaxed, memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+                return;
+            } else {
+                pos = atomic_load_explicit(&r->enq_pos, memory_order_relaxed);
+            }
+        }
+    }
+
+    rec->t_ms = st && st->clock_speed > 0.0 ? vclock_now_ms() : -1;
+    rec->pid = (int32_t)getpid();
+    rec->role = (uint8_t)role;
+    rec->event = (uint16_t)ev_args[0];
+    rec->nargs = (uint8_t)(n - 1 < LOG_ARGS ? n - 1 : LOG_ARGS);
+    for (int i = 0; i < rec->nargs; ++i) rec->args[i] = ev_args[i + 1];
+
+    if (r) atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+    else log_write_record(stdout, st, rec);
+}
+
+int log_ring_drain(BakeryState* st, FILE* out) {
+    LogRing* r = bakery_log_ring(st);
+    if (!r) return 0;
+    int count = 0;
+    for (;;) {
+        LogRecord* rec = &r->recs[r->deq_pos & (r->capacity - 1)];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != r->deq_pos + 1) break;
+        log_write_record(out, st, rec);
+        atomic_store_explicit(&rec->seq, r->deq_pos + r->capacity, memory_order_release);
+        r->deq_pos++;
+        count++;
+    }
+    if (count > 0) fflush(out);
+    return count;
+}
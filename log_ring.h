@@ -0,0 +1,136 @@
+#ifndef BAKERY_LOG_RING_H
+#define BAKERY_LOG_RING_H
+
+#include "common.h"
+
+/*
+ * log_ring.h – binarny log zdarzeń (--log=ring).
+ *
+ * Gorące ścieżki (klient, kasjer, piekarz, zbieranie dzieci w kierowniku)
+ * logują przez LOGE: rekord stałej wielkości (czas, pid, rola, numer zdarzenia,
+ * do LOG_ARGS argumentów) trafia do pierścienia MPSC w segmencie SHM bez
+ * formatowania i bez wywołań systemowych. Proces ./logdrain (albo kierownik na
+ * końcu) formatuje rekordy według tabeli zdarzeń i pisze je na stdout.
+ * Bez pierścienia (--log=text, ./sim) LOGE formatuje od razu - wynik jak LOGF.
+ *
+ * Poziomy per rola są stałymi kompilacji: zdarzenie powyżej LOG_LEVEL_<ROLA>
+ * znika z kodu, np. make LOGLEVEL_KLIENT=0 wyłącza cały log klientów.
+ */
+
+#define LOG_OFF             0
+#define LOG_INFO            1       /* przebieg: wejście, zapłata, wyjście */
+#define LOG_DEBUG           2       /* szczegóły: każdy krok, każda pozycja */
+
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT   LOG_DEBUG
+#endif
+#ifndef LOG_LEVEL_KIEROWNIK
+#define LOG_LEVEL_KIEROWNIK LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_PIEKARZ
+#define LOG_LEVEL_PIEKARZ   LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_KASJER
+#define LOG_LEVEL_KASJER    LOG_LEVEL_DEFAULT
+#endif
+#ifndef LOG_LEVEL_KLIENT
+#define LOG_LEVEL_KLIENT    LOG_LEVEL_DEFAULT
+#endif
+
+enum LogRole { LOG_ROLE_KIEROWNIK, LOG_ROLE_PIEKARZ, LOG_ROLE_KASJER, LOG_ROLE_KLIENT, LOG_ROLE_COUNT };
+
+/*
+ * Katalog zdarzeń - formaty w log_ring.c (g_log_events). Argumenty to int64:
+ * %d/%ld/%lld - liczba, %f - double (LOG_F), %P - nazwa produktu o danym id.
+ */
+typedef enum LogEvent {
+    EV_KL_DOOR_WAIT,
+    EV_KL_DOOR_ABORT,
+    EV_KL_NO_PRODUCT,
+    EV_KL_PARTIAL,
+    EV_KL_EMPTY_BASKET,
+    EV_KL_STORE_CLOSED,
+    EV_KL_SEND,
+    EV_KL_CHOSE,
+    EV_KL_PAID,
+    EV_KL_CHECKOUT_ABORT,
+    EV_KL_CHECKOUT_EVAC,
+    EV_KL_NOT_ENTERED,
+    EV_KL_ENTER,
+    EV_KL_LOOK,
+    EV_KL_EXIT,
+    EV_KL_EVAC,
+    EV_KL_FINISHED,
+    EV_KA_SALE,
+    EV_KA_SERVE,
+    EV_KA_ITEM,
+    EV_KA_BAD_ITEM,
+    EV_KA_SERVED,
+    EV_PI_TAKEOVER,
+    EV_PI_FULL,
+    EV_PI_BAKED,
+    EV_KI_CHILD_EXIT,
+    EV_KI_CHILD_SIGNAL,
+    EV_KI_CHILD_OTHER,
+    LOG_EVENT_COUNT
+} LogEvent;
+
+#define LOG_ARGS            5
+#define LOG_RING_DEFAULT    65536   /* rekordów (64 B) przy --log=ring */
+
+/* Rekord: jedna linia cache */
+typedef struct LogRecord {
+    _Atomic uint64_t seq;         /* gotowy do odczytu gdy seq == pos+1 */
+    long long t_ms;               /* vclock_now_ms() */
+    int32_t pid;
+    uint8_t role;
+    uint8_t nargs;
+    uint16_t event;
+    int64_t args[LOG_ARGS];
+} LogRecord;
+
+/* Pierścień MPSC (Vyukov): wielu piszących, jeden opróżniający */
+typedef struct LogRing {
+    uint64_t capacity;            /* potęga dwójki */
+    _Atomic int closing;          /* kierownik kończy - drain opróżnia i wychodzi */
+
+    CACHELINE_ALIGNED
+    _Atomic uint64_t enq_pos;
+    _Atomic uint64_t dropped;     /* rekordy odrzucone przy pełnym pierścieniu */
+
+    CACHELINE_ALIGNED
+    uint64_t deq_pos;             /* tylko opróżniający */
+
+    CACHELINE_ALIGNED
+    LogRecord recs[];
+} LogRing;
+
+#ifndef BAKERY_PACKED_LAYOUT
+_Static_assert(sizeof(LogRecord) == CACHE_LINE, "LogRecord != linia cache");
+#endif
+
+static inline LogRing* bakery_log_ring(const BakeryState* st) {
+    return st->off_log_ring ? (LogRing*)BAKERY_REGION(st, st->off_log_ring) : NULL;
+}
+
+static inline int64_t log_f64(double x) {
+    int64_t v;
+    memcpy(&v, &x, sizeof(v));
+    return v;
+}
+#define LOG_F(x) log_f64((double)(x))
+
+size_t log_ring_size(int capacity);
+void   log_ring_init(LogRing* r, int capacity);
+void   log_emit(int role, const int64_t* ev_args, int n);   /* ev_args[0] = zdarzenie */
+int    log_ring_drain(BakeryState* st, FILE* out);          /* zwraca liczbę rekordów */
+
+/* LOGE(KLIENT, LOG_INFO, EV_KL_ENTER, curr, N) - poziom sprawdzany w czasie kompilacji */
+#define LOGE(role, lvl, ...) do { \
+    if ((lvl) <= LOG_LEVEL_##role) { \
+        const int64_t _ev[] = { __VA_ARGS__ }; \
+        log_emit(LOG_ROLE_##role, _ev, (int)(sizeof(_ev) / sizeof(_ev[0]))); \
+    } \
+} while (0)
+
+#endif /* BAKERY_LOG_RING_H */
@@ -0,0 +1,57 @@
+#include "log_ring.h"
+
+/*
+ * logdrain.c – proces opróżniający pierścień logu (--log=ring).
+ *
+ * Formatuje rekordy LOGE z segmentu SHM i pisze je na stdout pełnymi
+ * buforami. Kończy po ustawieniu closing przez kierownika (albo SIGTERM),
+ * gdy pierścień jest pusty; resztę dopisaną później opróżnia kierownik.
+ */
+
+#define DRAIN_IDLE_MS       2
+
+static volatile sig_atomic_t g_stop = 0;
+static void handler(int sig) {
+    if (sig == SIG_EVAC || sig == SIG_INV) return;   /* ewakuacja: logi nadal płyną */
+    g_stop = 1;
+}
+
+int main(void) {
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    install_signal_handlers_or_die(handler);
+
+    ensure_ipc_key_file_or_die();
+    IpcHandles h;
+    memset(&h, 0, sizeof(h));
+
+    h.shm_id = shmget(bakery_ftok_or_die(0x41), 0, IPC_PERMS_MIN);
+    if (h.shm_id == -1) DIE_PERROR("shmget(logdrain)");
+
+    h.sem_id = semget(bakery_ftok_or_die(0x42), 0, IPC_PERMS_MIN);
+    if (h.sem_id == -1) DIE_PERROR("semget(logdrain)");
+
+    BakeryState* st = NULL;
+    ipc_attach_or_die(&h, &st);
+    LogRing* r = bakery_log_ring(st);
+    if (!r) {
+        fprintf(stderr, "logdrain: segment bez pierścienia logu (uruchom kierownika z --log=ring)\n");
+        return EXIT_FAILURE;
+    }
+
+    long long records = 0;
+    for (;;) {
+        int n = log_ring_drain(st, stdout);
+        records += n;
+        if (n > 0) continue;
+        if (g_stop || atomic_load_explicit(&r->closing, memory_order_acquire)) break;
+        msleep_real(DRAIN_IDLE_MS);
+    }
+    records += log_ring_drain(st, stdout);
+
+    LOGF("kierownik", "logdrain: wypisano %lld rekordow, odrzuconych (pelny pierscien): %llu", records,
+         (unsigned long long)atomic_load_explicit(&r->dropped, memory_order_relaxed));
+    fflush(stdout);
+    ipc_detach_or_die(st);
+    return 0;
+}
@@ -1,4 +1,6 @@
 #include "common.h"
+#include "latency.h"
+#include "log_ring.h"
 
 /*
  * manager.c – program kierownika (glowna petla i sterowanie) i petla sterujaca symulacja.
@@ -7,28 +9,105 @@
  *   ./manager           - normalny tryb pracy (sklep otwarty wg godzin)
  *   ./manager test N    - test przeciazeniowy z N klientami (domyslnie 1000)
  *   ./manager stress    - test stresu z maksymalna liczba klientow
+ *   ./manager layout    - raport ukladu BakeryState (offsety, linie cache, regiony segmentu)
+ *
+ * OPCJE (w dowolnym miejscu wiersza polecen):
+ *   --conveyor=sem|lockfree   - implementacja podajnikow (domyslnie sem)
+ *   --checkout=mq|shm         - kanal klient-kasa: kolejki komunikatow (domyslnie)
+ *                               albo skrzynki i pierscienie w SHM z futexami
+ *   --policy=threshold|ewma   - obsada kas: progi liczby klientow (domyslnie) albo
+ *                               prognoza EWMA przyjsc do kas i czasu kasowania
+ *   --till=work|queue         - wybor kasy przez klienta: najmniej pracy (domyslnie)
+ *                               albo najkrotsza kolejka
+ *   --bake=random|demand      - harmonogram piekarza: losowy (domyslnie) albo wg
+ *                               popytu z brakow towaru zglaszanych przez klientow
+ *   --batch[=K]               - kasjer zdejmuje do K koszykow naraz (domyslnie 64)
+ *                               i ksieguje je w jednej sekcji krytycznej
+ *   --products=P              - liczba produktow (domyslnie 15; wiecej = warianty wyrobow)
+ *   --ki=K                    - pojemnosc kazdego podajnika (domyslnie 10..14)
+ *   --basket=B                - maks. pozycji w koszyku (domyslnie 16)
+ *   --clients=N               - liczba klientow w trybie test/stress
+ *   --engine[=WATKI]          - klienci w jednym procesie ./client_engine (pula watkow,
+ *                               domyslnie 8) zamiast fork+exec ./client na klienta
+ *   --zygote                  - klienci tworzeni fork() (bez execv) przez zygote ./client --zygote
+ *   --rate=R                  - tempo przychodzenia klientow na sekunde (0 = bez limitu;
+ *                               domyslnie 5, w trybie stress 0)
+ *   --speed=X                 - predkosc zegara symulacji (60 = minuta na sekunde)
+ *   --start=H[:MM]            - godzina startu zegara symulacji (domyslnie biezaca)
+ *   --store=N                 - limit klientow w sklepie (domyslnie 30)
+ *   --report=PLIK             - dopisz wynik przebiegu jako linie JSON (./bench_sweep)
  */
 
+#include <getopt.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
 #define MAX_CLIENTS_TOTAL 500
-#define SPAWN_COOLDOWN_MS 200    /* minimalny odstep miedzy spawnem klientow (ms) */
+#define SPAWN_DEFAULT_RATE 5.0   /* klientow na sekunde, gdy nie podano --rate */
+#define ENGINE_DEFAULT_THREADS 8
+#define POLICY_INTERVAL_MS 500   /* polityka kas co tyle ms czasu symulacji */
+#define STATS_INTERVAL_MS  1000
+#define SPAWN_RETRY_MS     10    /* ms rzeczywiste miedzy losowaniami przyjscia (tryb normalny) */
+#define SPAWN_CHANCE       35    /* szansa przyjscia w jednym losowaniu: rand_between(0, 100) < 35 */
+#define DRAIN_POLL_MS      100   /* ms rzeczywiste: test po utworzeniu klientow - sprawdzanie, czy sklep pusty */
+#define DRAIN_STALL_MS     30000 /* ms rzeczywiste bez postepu (wejscia, wyjscia) - limit bezpieczenstwa */
+#define MS_PER_HOUR        (3600LL * 1000LL)
 
 /* Flagi trybu testowego */
 static int g_test_mode = 0;
 static int g_stress_mode = 0;
 static int g_test_client_count = 1000; 
 
+/* Opcje konfiguracji */
+static int g_conveyor_mode = CONVEYOR_SEM;
+static int g_checkout_mode = CHECKOUT_MQ;
+static int g_cashier_batch = 1;
+static int g_policy = POLICY_THRESHOLD;        /* --policy */
+static int g_till_choice = TILL_WORK;          /* --till */
+static int g_bake_mode = BAKE_RANDOM;          /* --bake */
+static int g_products = DEFAULT_P;   /* --products */
+static int g_ki = 0;                 /* --ki, 0 = domyslne Ki */
+static int g_basket_max = DEFAULT_BASKET_ITEMS; /* --basket */
+static int g_cashiers = DEFAULT_CASHIERS;      /* --cashiers */
+static int g_bakers = DEFAULT_BAKERS;          /* --bakers */
+static uint64_t g_seed = 0;                    /* --seed */
+static int g_log_records = 0;                  /* --log=ring: pojemność pierścienia logu */
+static int g_seed_set = 0;
+static int g_clients_opt = 0;        /* --clients=N (0 = domyslnie dla trybu) */
+static int g_engine_threads = 0;     /* --engine: 0 = proces na klienta */
+static int g_zygote = 0;             /* --zygote */
+static double g_spawn_rate = -1.0;   /* --rate (klientow/s), <0 = domyslnie dla trybu */
+static double g_clock_speed = 1.0;   /* --speed */
+static long long g_clock_start_ms = -1; /* --start, <0 = biezaca godzina */
+static int g_store_n = 30;           /* --store */
+static const char* g_report_path = NULL; /* --report */
+
+/* Proces tworzacy wszystkich klientow (silnik albo zygota) */
+static pid_t g_launcher_pid = -1;
+static int g_launcher_done = 0;
+
+/* Statystyki testow (raport na koniec i migawki STATUS) */
+static TestStats g_stats = {0};
+
+/* Procesy potomne wg roli - czas CPU zebrany z wait4() do raportu --report */
+enum { ROLE_BAKER, ROLE_CASHIER, ROLE_CLIENT, ROLE_LOGDRAIN, ROLE_COUNT };
+static const char* const g_role_names[ROLE_COUNT] = { "baker", "cashier", "client", "logdrain" };
+static pid_t g_baker_pids[BAKERS_MAX];
+static pid_t g_cashier_pids[CASHIERS_MAX];
+static pid_t g_logdrain_pid = -1;
+static double g_role_cpu_ms[ROLE_COUNT];
+
 /* Flagi ustawiane w handlerze sygnału */
-static volatile sig_atomic_t g_sig_evac = 0;
-static volatile sig_atomic_t g_sig_inv  = 0;
-static volatile sig_atomic_t g_sig_term = 0;
+/* Ustawiane z signalfd i FIFO sterującego (sygnały kierownika są zablokowane) */
+static int g_sig_evac = 0;
+static int g_sig_inv  = 0;
+static int g_sig_term = 0;
 
 static pid_t g_pgid = -1;
-
-static void signal_handler(int sig) {
-    if (sig == SIG_EVAC) g_sig_evac = 1;
-    else if (sig == SIG_INV) g_sig_inv = 1;
-    else g_sig_term = 1; /* SIGINT / SIGTERM */
-}
+static sigset_t g_orig_sigmask;      /* maska sprzed blokady - przywracana w dzieciach */
 
 /* =========================
  *  Uruchamianie procesów
@@ -39,6 +118,8 @@ static pid_t spawn_process_or_die(const char* path, char* const argv[]) {
     if (pid == -1) DIE_PERROR("fork");
 
     if (pid == 0) {
+        /* maska sygnałów przechodzi przez execv - dzieci odbierają sygnały normalnie */
+        CHECK_SYS(sigprocmask(SIG_SETMASK, &g_orig_sigmask, NULL), "sigprocmask(child)");
         execv(path, argv);
         /* jeśli execv wrócił, to błąd */
         DIE_PERROR("execv");
@@ -46,82 +127,104 @@ static pid_t spawn_process_or_die(const char* path, char* const argv[]) {
     return pid;
 }
 
-static void spawn_baker_or_die(void) {
-    char* const argv[] = { "./baker", NULL };
-    (void)spawn_process_or_die("./baker", argv);
+/* Proces formatujący binarny log (--log=ring) */
+static void spawn_logdrain_or_die(void) {
+    char* const argv[] = { "./logdrain", NULL };
+    g_logdrain_pid = spawn_process_or_die("./logdrain", argv);
+}
+
+static void spawn_bakers_or_die(int count) {
+    for (int i = 0; i < count; ++i) {
+        char idbuf[16];
+        snprintf(idbuf, sizeof(idbuf), "%d", i);
+        char* const argv[] = { "./baker", idbuf, NULL };
+        g_baker_pids[i] = spawn_process_or_die("./baker", argv);
+    }
 }
 
-static void spawn_cashiers_or_die(void) {
-    for (int i = 0; i < CASHIERS; ++i) {
+static void spawn_cashiers_or_die(int count) {
+    for (int i = 0; i < count; ++i) {
         char idbuf[16];
         snprintf(idbuf, sizeof(idbuf), "%d", i);
         char* const argv[] = { "./cashier", idbuf, NULL };
-        (void)spawn_process_or_die("./cashier", argv);
+        g_cashier_pids[i] = spawn_process_or_die("./cashier", argv);
     }
 }
 
-static void spawn_client_or_die(void) {
-    char* const argv[] = { "./client", NULL };
+/*
+ * Liczba nieudanych losowan przyjscia przed udanym (rozklad geometryczny).
+ * Kierownik nie budzi sie co SPAWN_RETRY_MS, zeby losowac od nowa - od razu
+ * wyznacza chwile nastepnego przyjscia i nastawia na nia timerfd.
+ */
+static int spawn_failed_draws(void) {
+    int failed = 0;
+    while (rand_between(0, 100) >= SPAWN_CHANCE) failed++;
+    return failed;
+}
+
+/* seq: numer kolejny klienta - z niego i ziarna głównego klient wyprowadza swoje losowania */
+static void spawn_client_or_die(int seq) {
+    char seqbuf[16];
+    snprintf(seqbuf, sizeof(seqbuf), "%d", seq);
+    char* const argv[] = { "./client", seqbuf, NULL };
     (void)spawn_process_or_die("./client", argv);
 }
 
+/* Jeden proces z pula watkow dla wszystkich klientow; rate = klientow/s (0 = bez limitu) */
+static pid_t spawn_client_engine_or_die(int count, int threads, double rate) {
+    char countbuf[16], threadsbuf[16], ratebuf[32];
+    snprintf(countbuf, sizeof(countbuf), "%d", count);
+    snprintf(threadsbuf, sizeof(threadsbuf), "%d", threads);
+    snprintf(ratebuf, sizeof(ratebuf), "%.3f", rate);
+    char* const argv[] = { "./client_engine", countbuf, threadsbuf, ratebuf, NULL };
+    return spawn_process_or_die("./client_engine", argv);
+}
+
+/* Zygota: jeden execv, potem klienci jako fork() z juz dolaczonym IPC */
+static pid_t spawn_client_zygote_or_die(int count, double rate) {
+    char countbuf[16], ratebuf[32];
+    snprintf(countbuf, sizeof(countbuf), "%d", count);
+    snprintf(ratebuf, sizeof(ratebuf), "%.3f", rate);
+    char* const argv[] = { "./client", "--zygote", countbuf, ratebuf, NULL };
+    return spawn_process_or_die("./client", argv);
+}
+
 /* =========================
  *  Polityka kas 
  * ========================= */
 
+static StaffingPolicy g_staffing;  /* pamięta poprzednią decyzję (histereza) i oceny EWMA */
+
 static int desired_open_cashiers(const BakeryState* st) {
-    /* Zasad: K = N/3, min 1, max 3, zależnie od liczby klientów w sklepie. */
-    static int last = 1;          /* pamięta poprzednią decyzję */
-    int c = st->customers_in_store;
-    int N = st->N;
-
-    int t1_on  = (N / 3) + 1;         
-    int t1_off = (N / 3) - 1;         
-    int t2_on  = (2 * N / 3) + 1;    
-    int t2_off = (2 * N / 3) - 1;    
-
-    if (t1_off < 0) t1_off = 0;
-    if (t2_off < 0) t2_off = 0;
-
-    if (last == 1) {
-        if (c >= t2_on) last = 3;
-        else if (c >= t1_on) last = 2;
-    } else if (last == 2) {
-        if (c >= t2_on) last = 3;
-        else if (c <= t1_off) last = 1;
-    } else { /* last == 3 */
-        if (c <= t2_off) last = 2;
-    }
-
-    return last;
+    return staffing_desired(&g_staffing, st, stats_customers_in_store(st), vclock_now_ms());
+}
+
+/* Po każdej zmianie stanu sterującego: nowa generacja i pobudka kasjerów czekających na koszyk */
+static void publish_control(BakeryState* st, const IpcHandles* h) {
+    control_publish(st);
+    control_wake_cashiers(st, h);
 }
 
-static void apply_cashier_policy(BakeryState* st, int sem_id) {
-    shm_lock(sem_id);
+static void apply_cashier_policy(BakeryState* st, const IpcHandles* h) {
+    shm_lock(h->sem_id);
 
     int want = desired_open_cashiers(st);
+    int changed = 0;
 
     /* procesy kasjerów istnieją cały czas -> open=1 */
-    for (int i = 0; i < CASHIERS; ++i) st->cashier_open[i] = 1;
-
-    int a0 = 1;
-    int a1 = (want >= 2);
-    int a2 = (want >= 3);
-
-    if (st->cashier_accepting[0] != a0) {
-        st->cashier_accepting[0] = a0;
-        LOGF("kierownik", "Kasa 0 accepting=%d", a0);
-    }
-    if (st->cashier_accepting[1] != a1) {
-        st->cashier_accepting[1] = a1;
-        LOGF("kierownik", "Kasa 1 accepting=%d", a1);
-    }
-    if (st->cashier_accepting[2] != a2) {
-        st->cashier_accepting[2] = a2;
-        LOGF("kierownik", "Kasa 2 accepting=%d", a2);
+    /* kasy 0..want-1 przyjmują klientów (kasa 0 zawsze) */
+    for (int i = 0; i < st->cashier_count; ++i) {
+        int accepting = (i < want);
+        if (!st->cashiers[i].open || st->cashiers[i].accepting != accepting) {
+            st->cashiers[i].open = 1;
+            st->cashiers[i].accepting = accepting;
+            changed = 1;
+            LOGF("kierownik", "Kasa %d accepting=%d", i, accepting);
+        }
     }
 
-    shm_unlock(sem_id);
+    shm_unlock(h->sem_id);
+    if (changed) publish_control(st, h);   /* kasjerzy śpiący w control_wait reagują od razu */
 }
 
 /* 
@@ -135,7 +238,11 @@ static int ctrl_fifo_open_or_off(void) {
             return -1;
         }
     }
-    int fd = open(CTRL_FIFO_PATH, O_RDONLY | O_NONBLOCK);
+    /*
+     * O_RDWR: kierownik sam trzyma koniec do zapisu, więc po rozłączeniu
+     * piszącego FIFO nie zgłasza w epoll bez końca EPOLLHUP (Linux).
+     */
+    int fd = open(CTRL_FIFO_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
     if (fd == -1) {
         perror("open(CTRL_FIFO_PATH)");
         return -1;
@@ -143,98 +250,304 @@ static int ctrl_fifo_open_or_off(void) {
     return fd;
 }
 
-static void ctrl_fifo_poll(int fd) {
+/*
+ * Migawka metryk jako jedna linia JSON dopisywana do METRICS_PATH (jednym
+ * write z O_APPEND - czytelnik pliku nie zobaczy połowy linii). Procesy
+ * pracują dalej: każdy licznik jest czytany raz, od końca cyklu klienta
+ * (koszyki, wejścia, przyjścia), żeby późniejszy etap nie wyprzedził
+ * wcześniejszego w tej samej migawce.
+ */
+static void status_write_json(const BakeryState* st) {
+    static int seq = 0;
+    char* buf = NULL;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    if (!out) {
+        perror("open_memstream(STATUS)");
+        return;
+    }
+
+    long long now = vclock_now_ms();
+    fprintf(out, "{\"seq\":%d,\"t_ms\":%lld,\"uptime_ms\":%lld,\"store_open\":%d,\"evacuated\":%d",
+            ++seq, now, now - g_stats.start_time_ms, st->store_open, st->evacuated);
+
+    int units_sold = 0, units_produced = 0, stockouts = 0, lost_units = 0;
+    fprintf(out, ",\"products\":[");
+    for (int i = 0; i < st->P; ++i) {
+        int sold = stats_sold(st, i);
+        int fill = conveyor_count(st, i);
+        int produced = stats_produced(st, i);
+        int miss = stats_stockouts(st, i);
+        int lost = stats_lost(st, i);
+        fprintf(out, "%s{\"id\":%d,\"fill\":%d,\"capacity\":%d,\"produced\":%d,\"sold\":%d,\"stockouts\":%d,"
+                     "\"lost\":%d}",
+                i ? "," : "", i, fill, bakery_conveyor(st, i)->capacity, produced, sold, miss, lost);
+        units_sold += sold;
+        units_produced += produced;
+        stockouts += miss;
+        lost_units += lost;
+    }
+
+    int baskets = 0, queued = 0;
+    fprintf(out, "],\"cashiers\":[");
+    for (int c = 0; c < st->cashier_count; ++c) {
+        int b = stats_baskets(st, c);
+        fprintf(out, "%s{\"id\":%d,\"accepting\":%d,\"queue\":%d,\"baskets\":%d}",
+                c ? "," : "", c, st->cashiers[c].accepting, st->cashiers[c].queue_len, b);
+        baskets += b;
+        queued += st->cashiers[c].queue_len;
+    }
+
+    int in_store = stats_customers_in_store(st);
+    int waiting = st->waiting_before_store;
+    int entries = stats_entries(st);
+    int rejected = stats_rejected(st);
+    int arrivals = stats_arrivals(st);
+    fprintf(out, "],\"arrivals\":%d,\"entries\":%d,\"rejected\":%d,\"in_store\":%d,\"waiting\":%d"
+            ",\"queued\":%d,\"baskets\":%d,\"units_sold\":%d,\"units_produced\":%d,\"stockouts\":%d"
+            ",\"lost_units\":%d}\n",
+            arrivals, entries, rejected, in_store, waiting, queued, baskets, units_sold, units_produced, stockouts,
+            lost_units);
+    fclose(out);
+
+    int fd = open(METRICS_PATH, O_WRONLY | O_CREAT | O_APPEND, FIFO_PERMS_MIN);
+    if (fd == -1) {
+        perror("open(METRICS_PATH)");
+    } else {
+        if (write(fd, buf, len) != (ssize_t)len) perror("write(METRICS_PATH)");
+        close(fd);
+        LOGF("kierownik", "STATUS #%d -> %s (klientow: %d przyszlo, %d w sklepie, %d koszykow)", seq, METRICS_PATH,
+             arrivals, in_store, baskets);
+    }
+    free(buf);
+}
+
+static void ctrl_fifo_poll(int fd, const BakeryState* st) {
     if (fd < 0) return;
-    char buf[128];
+    char buf[512];
     ssize_t n = read(fd, buf, sizeof(buf) - 1);
     if (n <= 0) return;
     buf[n] = '\0';
 
-    /* Proste komendy: EVAC, INV, CLOSE, STATUS */
-    if (strstr(buf, "EVAC")) {
-        g_sig_evac = 1;
-    } else if (strstr(buf, "INV")) {
-        g_sig_inv = 1;
-    } else if (strstr(buf, "CLOSE")) {
-        g_sig_term = 1;
-    } else if (strstr(buf, "STATUS")) {
-        /* Można rozszerzyć o wypisanie statusu */
+    /* Proste komendy po jednej w linii: EVAC, INV, CLOSE, STATUS */
+    char* save = NULL;
+    for (char* cmd = strtok_r(buf, "\n", &save); cmd; cmd = strtok_r(NULL, "\n", &save)) {
+        if (strstr(cmd, "EVAC")) {
+            g_sig_evac = 1;
+        } else if (strstr(cmd, "INV")) {
+            g_sig_inv = 1;
+        } else if (strstr(cmd, "CLOSE")) {
+            g_sig_term = 1;
+        } else if (strstr(cmd, "STATUS")) {
+            status_write_json(st);
+        }
     }
 }
 
-static int current_hour_local(void) {
-    time_t t = time(NULL);
-    struct tm lt;
-    localtime_r(&t, &lt);
-    return lt.tm_hour;
+static int role_of_child(pid_t pid) {
+    if (pid == g_logdrain_pid) return ROLE_LOGDRAIN;
+    for (int i = 0; i < BAKERS_MAX; ++i) if (g_baker_pids[i] == pid) return ROLE_BAKER;
+    for (int i = 0; i < CASHIERS_MAX; ++i) if (g_cashier_pids[i] == pid) return ROLE_CASHIER;
+    return ROLE_CLIENT;   /* klient, silnik albo zygota (z jej dziećmi) */
+}
+
+static double rusage_cpu_ms(const struct rusage* ru) {
+    return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000.0 +
+           (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1000.0;
 }
 
-static long long now_ms(void) {
-    struct timespec ts;
-    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
-    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000LL;
+static void account_child(pid_t pid, const struct rusage* ru) {
+    g_role_cpu_ms[role_of_child(pid)] += rusage_cpu_ms(ru);
 }
 
 static void reap_children_nonblocking(void) {
     int status;
     pid_t pid;
+    struct rusage ru;
 
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+        account_child(pid, &ru);
+        if (pid == g_launcher_pid) g_launcher_done = 1;
         if (WIFEXITED(status)) {
-            LOGF("kierownik", "Proces potomny pid=%d zakończył się kodem=%d",
-                 (int)pid, WEXITSTATUS(status));
+            LOGE(KIEROWNIK, LOG_DEBUG, EV_KI_CHILD_EXIT, pid, WEXITSTATUS(status));
         } else if (WIFSIGNALED(status)) {
-            LOGF("kierownik", "Proces potomny pid=%d zakończony sygnałem=%d",
-                 (int)pid, WTERMSIG(status));
+            LOGE(KIEROWNIK, LOG_DEBUG, EV_KI_CHILD_SIGNAL, pid, WTERMSIG(status));
         } else {
-            LOGF("kierownik", "Proces potomny pid=%d zakończony (status=%d)",
-                 (int)pid, status);
+            LOGE(KIEROWNIK, LOG_DEBUG, EV_KI_CHILD_OTHER, pid, status);
         }
     }
 
-    /* waitpid == 0 -> brak zakończonych dzieci, waitpid == -1 -> np. brak dzieci (ECHILD) */
+    /* wait4 == 0 -> brak zakończonych dzieci, wait4 == -1 -> np. brak dzieci (ECHILD) */
 }
 
-
 /* =========================
- *  Statystyki testow
+ *  Pętla zdarzeń kierownika
  * ========================= */
 
-typedef struct TestStats {
-    int clients_spawned;
-    int clients_entered;
-    int clients_completed;
-    int max_concurrent;
-    int waiting_clients;
-    long long start_time_ms;
-    long long end_time_ms;
-} TestStats;
+/*
+ * Kierownik śpi w epoll_wait na trzech deskryptorach: FIFO sterujące,
+ * signalfd (SIG_EVAC, SIG_INV, SIGINT, SIGTERM, SIGCHLD) i timerfd
+ * nastawiany na najbliższy termin pętli (przyjście klienta, polityka kas,
+ * statystyki, godzina otwarcia/zamknięcia). Bez zdarzeń nie zużywa CPU,
+ * a na sygnał i zakończenie dziecka reaguje od razu.
+ */
+typedef struct ManagerEvents {
+    int epoll_fd;
+    int signal_fd;
+    int timer_fd;
+    int fifo_fd;                  /* -1 = bez FIFO sterującego */
+} ManagerEvents;
+
+/* Przed utworzeniem dzieci: sygnał wysłany wcześniej niż signalfd nie może zginąć */
+static void block_manager_signals_or_die(sigset_t* mask) {
+    sigemptyset(mask);
+    sigaddset(mask, SIG_EVAC);
+    sigaddset(mask, SIG_INV);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGTERM);
+    sigaddset(mask, SIGCHLD);
+    CHECK_SYS(sigprocmask(SIG_BLOCK, mask, &g_orig_sigmask), "sigprocmask(manager)");
+}
 
-static TestStats g_stats = {0};
+static void events_add_or_die(int epoll_fd, int fd) {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(e));
+    e.events = EPOLLIN;
+    e.data.fd = fd;
+    CHECK_SYS(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &e), "epoll_ctl(ADD)");
+}
 
-static void print_test_stats(const BakeryState* st) {
-    printf("\n========== STATYSTYKI TESTU ==========\n");
-    printf("Klientow wygenerowanych: %d\n", g_stats.clients_spawned);
-    printf("Max rownoczesnie w sklepie: %d (limit N=%d)\n", g_stats.max_concurrent, st->N);
-    printf("Czas trwania testu: %lld ms\n", g_stats.end_time_ms - g_stats.start_time_ms);
-    
-    int total_sold = 0;
-    int total_wasted = 0;
-    int total_produced = 0;
-    for (int i = 0; i < st->P; ++i) {
-        total_produced += st->produced[i];
-        total_wasted += st->wasted[i];
-        for (int c = 0; c < CASHIERS; ++c) {
-            total_sold += st->sold_by_cashier[c][i];
+static void events_open_or_die(ManagerEvents* ev, const sigset_t* mask, int fifo_fd) {
+    ev->fifo_fd = fifo_fd;
+    ev->signal_fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (ev->signal_fd == -1) DIE_PERROR("signalfd");
+    ev->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ev->timer_fd == -1) DIE_PERROR("timerfd_create");
+    ev->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ev->epoll_fd == -1) DIE_PERROR("epoll_create1");
+
+    events_add_or_die(ev->epoll_fd, ev->signal_fd);
+    events_add_or_die(ev->epoll_fd, ev->timer_fd);
+    if (fifo_fd >= 0) events_add_or_die(ev->epoll_fd, fifo_fd);
+}
+
+static void events_close(ManagerEvents* ev) {
+    close(ev->epoll_fd);
+    close(ev->timer_fd);
+    close(ev->signal_fd);
+}
+
+static void events_read_signals(ManagerEvents* ev) {
+    struct signalfd_siginfo si[8];
+    ssize_t n;
+    int reap = 0;
+    while ((n = read(ev->signal_fd, si, sizeof(si))) > 0) {
+        for (size_t i = 0; i < (size_t)n / sizeof(si[0]); ++i) {
+            int sig = (int)si[i].ssi_signo;
+            if (sig == SIG_EVAC) g_sig_evac = 1;
+            else if (sig == SIG_INV) g_sig_inv = 1;
+            else if (sig == SIGCHLD) reap = 1;
+            else g_sig_term = 1;   /* SIGINT / SIGTERM */
+        }
+    }
+    if (n == -1 && errno != EAGAIN) perror("read(signalfd)");
+    /* kilka SIGCHLD zlewa się w jeden - zbieramy wszystkie zakończone dzieci */
+    if (reap) reap_children_nonblocking();
+}
+
+/*
+ * Czekaj na zdarzenie albo do terminu wake_ms (czas symulacji, jak
+ * vclock_now_ms). Termin już miniony: tylko odbierz zdarzenia gotowe.
+ */
+static void events_wait(ManagerEvents* ev, const BakeryState* st, long long wake_ms) {
+    double delay_ms = (double)(wake_ms - vclock_now_ms()) / vclock_speed();
+    int timeout = 0;
+    if (delay_ms > 0.0) {
+        long long ns = (long long)(delay_ms * 1000000.0);
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        if (ns <= 0) ns = 1;      /* it_value == 0 rozbroiłoby timer */
+        its.it_value.tv_sec = ns / 1000000000LL;
+        its.it_value.tv_nsec = ns % 1000000000LL;
+        CHECK_SYS(timerfd_settime(ev->timer_fd, 0, &its, NULL), "timerfd_settime");
+        timeout = -1;
+    }
+
+    struct epoll_event ready[4];
+    int n = epoll_wait(ev->epoll_fd, ready, 4, timeout);
+    if (n == -1) {
+        if (errno != EINTR) perror("epoll_wait");
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        int fd = ready[i].data.fd;
+        if (fd == ev->signal_fd) {
+            events_read_signals(ev);
+        } else if (fd == ev->fifo_fd) {
+            ctrl_fifo_poll(fd, st);
+        } else if (fd == ev->timer_fd) {
+            uint64_t expirations;
+            if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) perror("read(timerfd)");
         }
     }
-    
-    printf("Produktow wyprodukowanych: %d\n", total_produced);
-    printf("Produktow sprzedanych: %d\n", total_sold);
-    printf("Produktow zmarnowanych (ewakuacja): %d\n", total_wasted);
-    printf("========================================\n\n");
 }
 
+/*
+ * Wynik przebiegu dla ./bench_sweep: konfiguracja, przepustowość na sekundę
+ * czasu rzeczywistego, opóźnienie przy kasie (histogram LAT_CHECKOUT) i czas
+ * CPU ról. Jedna linia JSON dopisywana do pliku --report.
+ */
+static void write_run_report(const BakeryState* st, long long wall_us) {
+    FILE* f = fopen(g_report_path, "a");
+    if (!f) {
+        perror("fopen(--report)");
+        return;
+    }
+    int baskets = 0, units_sold = 0, wasted = 0, stockouts = 0, lost_units = 0;
+    for (int c = 0; c < st->cashier_count; ++c) baskets += stats_baskets(st, c);
+    for (int i = 0; i < st->P; ++i) {
+        units_sold += stats_sold(st, i);
+        wasted += stats_wasted(st, i);
+        stockouts += stats_stockouts(st, i);
+        lost_units += stats_lost(st, i);
+    }
+    double wall_s = wall_us / 1e6;
+    double sim_min = (double)(g_stats.end_time_ms - g_stats.start_time_ms) / 60000.0;   /* minuty zegara symulacji */
+    const LatHist* ck = bakery_lat(st, LAT_CHECKOUT, -1);
+    uint64_t ck_n = lat_count(ck);
+    const LatHist* tq = bakery_lat(st, LAT_TILL_QUEUE, -1);   /* czekanie w kolejce do kasy */
+    uint64_t tq_n = lat_count(tq);
+    struct rusage self;
+    CHECK_SYS(getrusage(RUSAGE_SELF, &self), "getrusage");
+
+    fprintf(f, "{\"N\":%d,\"P\":%d,\"ki\":%d,\"cashiers\":%d,\"bakers\":%d,\"clients\":%d,"
+               "\"checkout\":\"%s\",\"conveyor\":\"%s\",\"policy\":\"%s\",\"till\":\"%s\",\"bake\":\"%s\","
+               "\"speed\":%g,\"seed\":%llu,"
+               "\"wall_ms\":%.1f,\"arrivals\":%d,\"entries\":%d,\"customers\":%d,\"customers_per_s\":%.3f,"
+               "\"units_sold\":%d,\"units_sold_per_s\":%.3f,\"units_sold_per_min\":%.1f,\"wasted\":%d,"
+               "\"stockouts\":%d,\"lost_units\":%d,"
+               "\"checkout_mean_us\":%.1f,\"checkout_p50_us\":%llu,\"checkout_p99_us\":%llu,"
+               "\"checkout_p999_us\":%llu,\"checkout_max_us\":%llu,"
+               "\"till_wait_mean_us\":%.1f,\"till_wait_p99_us\":%llu,\"cpu_ms\":{\"manager\":%.1f",
+            st->N, st->P, g_ki, st->cashier_count, st->baker_count, g_stats.clients_spawned,
+            st->checkout_mode == CHECKOUT_SHM ? "shm" : "mq", st->conveyor_mode == CONVEYOR_LOCKFREE ? "lockfree" : "sem",
+            staffing_policy_name(g_staffing.policy), st->till_choice == TILL_WORK ? "work" : "queue",
+            bake_mode_name(st->bake_mode), st->clock_speed, (unsigned long long)st->seed,
+            wall_us / 1e3, stats_arrivals(st), stats_entries(st), baskets, wall_s > 0 ? baskets / wall_s : 0.0,
+            units_sold, wall_s > 0 ? units_sold / wall_s : 0.0, sim_min > 0 ? units_sold / sim_min : 0.0, wasted,
+            stockouts, lost_units,
+            ck_n ? (double)atomic_load_explicit(&ck->sum_us, memory_order_relaxed) / (double)ck_n : 0.0,
+            (unsigned long long)lat_percentile(ck, 0.50), (unsigned long long)lat_percentile(ck, 0.99),
+            (unsigned long long)lat_percentile(ck, 0.999),
+            (unsigned long long)atomic_load_explicit(&ck->max_us, memory_order_relaxed),
+            tq_n ? (double)atomic_load_explicit(&tq->sum_us, memory_order_relaxed) / (double)tq_n : 0.0,
+            (unsigned long long)lat_percentile(tq, 0.99), rusage_cpu_ms(&self));
+    for (int r = 0; r < ROLE_COUNT; ++r) fprintf(f, ",\"%s\":%.1f", g_role_names[r], g_role_cpu_ms[r]);
+    fprintf(f, "}}\n");
+    if (fclose(f) != 0) perror("fclose(--report)");
+}
+
+
 
 /* =========================
  *  Main
@@ -243,65 +556,245 @@ static void print_test_stats(const BakeryState* st) {
 int main(int argc, char** argv) {
     setvbuf(stdout, NULL, _IOLBF, 0);
     
+    /* Parsowanie opcji */
+    static const struct option long_opts[] = {
+        { "conveyor", required_argument, NULL, 'c' },
+        { "checkout", required_argument, NULL, 'k' },
+        { "batch",    optional_argument, NULL, 'b' },
+        { "policy",   required_argument, NULL, 'O' },
+        { "till",     required_argument, NULL, 'T' },
+        { "bake",     required_argument, NULL, 'D' },
+        { "products", required_argument, NULL, 'p' },
+        { "ki",       required_argument, NULL, 'K' },
+        { "basket",   required_argument, NULL, 'B' },
+        { "cashiers", required_argument, NULL, 'C' },
+        { "bakers",   required_argument, NULL, 'P' },
+        { "seed",     required_argument, NULL, 'S' },
+        { "log",      required_argument, NULL, 'L' },
+        { "clients",  required_argument, NULL, 'n' },
+        { "engine",   optional_argument, NULL, 'e' },
+        { "zygote",   no_argument,       NULL, 'z' },
+        { "rate",     required_argument, NULL, 'r' },
+        { "speed",    required_argument, NULL, 's' },
+        { "start",    required_argument, NULL, 't' },
+        { "store",    required_argument, NULL, 'N' },
+        { "report",   required_argument, NULL, 'R' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            if (strcmp(optarg, "sem") == 0) g_conveyor_mode = CONVEYOR_SEM;
+            else if (strcmp(optarg, "lockfree") == 0) g_conveyor_mode = CONVEYOR_LOCKFREE;
+            else {
+                fprintf(stderr, "Nieznany tryb podajnikow: %s (sem|lockfree)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'k':
+            if (strcmp(optarg, "mq") == 0) g_checkout_mode = CHECKOUT_MQ;
+            else if (strcmp(optarg, "shm") == 0) g_checkout_mode = CHECKOUT_SHM;
+            else {
+                fprintf(stderr, "Nieznany kanal kasowy: %s (mq|shm)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            g_cashier_batch = optarg ? atoi(optarg) : CASHIER_BATCH_MAX;
+            if (g_cashier_batch <= 0 || g_cashier_batch > CASHIER_BATCH_MAX) {
+                fprintf(stderr, "Błędny rozmiar partii kasjera: %s (1..%d)\n", optarg, CASHIER_BATCH_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'O':
+            g_policy = staffing_policy_parse(optarg);
+            if (g_policy < 0) {
+                fprintf(stderr, "Nieznana polityka kas: %s (threshold|ewma)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            if (strcmp(optarg, "work") == 0) g_till_choice = TILL_WORK;
+            else if (strcmp(optarg, "queue") == 0) g_till_choice = TILL_QUEUE;
+            else {
+                fprintf(stderr, "Nieznany wybor kasy: %s (work|queue)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'D':
+            g_bake_mode = bake_mode_parse(optarg);
+            if (g_bake_mode < 0) {
+                fprintf(stderr, "Nieznany harmonogram piekarza: %s (random|demand)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            g_products = atoi(optarg);
+            break;
+        case 'K':
+            g_ki = atoi(optarg);
+            if (g_ki <= 0) {
+                fprintf(stderr, "Błędna pojemnosc podajnika: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'B':
+            g_basket_max = atoi(optarg);
+            if (g_basket_max <= 0 || g_basket_max > BASKET_LIMIT) {
+                fprintf(stderr, "Błędny rozmiar koszyka: %s (1..%d)\n", optarg, BASKET_LIMIT);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C':
+            g_cashiers = atoi(optarg);
+            if (g_cashiers < CASHIERS_MIN || g_cashiers > CASHIERS_MAX) {
+                fprintf(stderr, "Błędna liczba kas: %s (%d..%d)\n", optarg, CASHIERS_MIN, CASHIERS_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'P':
+            g_bakers = atoi(optarg);
+            if (g_bakers < 1 || g_bakers > BAKERS_MAX) {
+                fprintf(stderr, "Błędna liczba piekarzy: %s (1..%d)\n", optarg, BAKERS_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S': {
+            char* end = NULL;
+            errno = 0;
+            g_seed = strtoull(optarg, &end, 0);
+            if (errno != 0 || end == optarg || *end != '\0') {
+                fprintf(stderr, "Błędne ziarno: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            g_seed_set = 1;
+            break;
+        }
+        case 'L':
+            if (strcmp(optarg, "text") == 0) g_log_records = 0;
+            else if (strcmp(optarg, "ring") == 0) g_log_records = LOG_RING_DEFAULT;
+            else {
+                fprintf(stderr, "Nieznany tryb logu: %s (text|ring)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            g_clients_opt = atoi(optarg);
+            if (g_clients_opt <= 0) {
+                fprintf(stderr, "Błędna liczba klientow: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            g_engine_threads = optarg ? atoi(optarg) : ENGINE_DEFAULT_THREADS;
+            if (g_engine_threads <= 0) {
+                fprintf(stderr, "Błędna liczba watkow silnika: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'z':
+            g_zygote = 1;
+            break;
+        case 'r':
+            g_spawn_rate = atof(optarg);
+            if (g_spawn_rate < 0.0) {
+                fprintf(stderr, "Błędne tempo klientow: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            g_clock_speed = atof(optarg);
+            if (g_clock_speed <= 0.0) {
+                fprintf(stderr, "Błędna predkosc zegara: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't': {
+            int hh = 0, mm = 0;
+            if (sscanf(optarg, "%d:%d", &hh, &mm) < 1 || hh < 0 || hh > 23 || mm < 0 || mm > 59) {
+                fprintf(stderr, "Błędna godzina startu: %s (H albo H:MM)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            g_clock_start_ms = (hh * 60LL + mm) * 60LL * 1000LL;
+            break;
+        }
+        case 'N':
+            g_store_n = atoi(optarg);
+            if (g_store_n <= 0) {
+                fprintf(stderr, "Błędny limit klientow w sklepie: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R':
+            g_report_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Użycie: %s [test N | stress | layout] [--conveyor=sem|lockfree] [--checkout=mq|shm]"
+                            " [--policy=threshold|ewma] [--till=work|queue]"
+                            " [--bake=random|demand] [--batch[=K]] [--products=P] [--ki=K] [--basket=B] [--cashiers=C] [--bakers=B] [--seed=S] [--log=text|ring]"
+                            " [--clients=N] [--engine[=WATKI] | --zygote] [--rate=R]"
+                            " [--speed=X] [--start=H[:MM]] [--store=N] [--report=PLIK]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int P = g_products; /* liczba produktow: bakery_default_products */
+    int N = g_store_n; /* limit klientow w sklepie */
+    int Tp = 6;        /* otwarcie: 6:00 */
+    int Tk = 22;       /* zamkniecie: 22:00 */
+    if (P < 10 || P > P_LIMIT) {
+        fprintf(stderr, "Błędna liczba produktow: %d (10..%d)\n", P, P_LIMIT);
+        return EXIT_FAILURE;
+    }
+    Product* produkty = calloc((size_t)P, sizeof(Product));
+    int* Ki = calloc((size_t)P, sizeof(int));
+    if (!produkty || !Ki) DIE_PERROR("calloc(produkty)");
+
+    /* Domyslna lista produktow (P=15), Ki = 10..14 albo --ki */
+    bakery_default_products(produkty, Ki, P, g_ki);
+    ShmConfig shm_cfg = { P, Ki, g_basket_max, g_cashiers, g_checkout_mode, g_log_records, N };
+
     /* Parsowanie argumentow */
-    if (argc >= 2) {
-        if (strcmp(argv[1], "test") == 0) {
+    int argn = argc - optind;
+    char** args = argv + optind;
+    if (argn >= 1) {
+        if (strcmp(args[0], "test") == 0) {
             g_test_mode = 1;
-            if (argc >= 3) {
-                g_test_client_count = atoi(argv[2]);
+            if (argn >= 2) {
+                g_test_client_count = atoi(args[1]);
                 if (g_test_client_count <= 0) g_test_client_count = 1000;
             }
+            if (g_clients_opt > 0) g_test_client_count = g_clients_opt;
             printf("=== TRYB TESTOWY: %d klientow ===\n", g_test_client_count);
-        } else if (strcmp(argv[1], "stress") == 0) {
+        } else if (strcmp(args[0], "stress") == 0) {
             g_stress_mode = 1;
             g_test_mode = 1;
             g_test_client_count = 5000;
+            if (g_clients_opt > 0) g_test_client_count = g_clients_opt;
             printf("=== TRYB STRESS: %d klientow ===\n", g_test_client_count);
+        } else if (strcmp(args[0], "layout") == 0) {
+            bakery_layout_report(stdout, &shm_cfg);
+            return 0;
         }
     }
 
-    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+    if (!g_seed_set) g_seed = rng_time_seed();
+    rng_thread_seed(rng_derive(g_seed, RNG_ROLE_MANAGER, 0));
 
-    install_signal_handlers_or_die(signal_handler);
+    sigset_t manager_sigs;
+    block_manager_signals_or_die(&manager_sigs);
 
     /* Utworz osobna grupe procesow dla symulacji (zeby kill(-pgid, ...) nie dotknol powloki) */
     CHECK_SYS(setpgid(0, 0), "setpgid(manager)");
     g_pgid = getpgrp();
 
 
-    int P = 15;
-    int N = 30;        /* limit klientow w sklepie */
-    int Tp = 6;        /* otwarcie: 6:00 */
-    int Tk = 22;       /* zamkniecie: 22:00 */
-    Product produkty[MAX_P];
-    int Ki[MAX_P];
     int spawned_clients_total = 0;
     long long last_spawn_ms = 0;
     long long last_policy_ms = 0;
     long long last_stats_ms = 0;
 
-    /* Domyslna lista produktow (P=15) */
-    memset(produkty, 0, sizeof(produkty));
-    strcpy(produkty[0].nazwa, "Bułka kajzerka");             produkty[0].cena = 3.0;
-    strcpy(produkty[1].nazwa, "Bułka grahamka");            produkty[1].cena = 4.0;
-    strcpy(produkty[2].nazwa, "Chleb pszenny");             produkty[2].cena = 6.0;
-    strcpy(produkty[3].nazwa, "Chleb pełnoziarnisty");      produkty[3].cena = 7.0;
-    strcpy(produkty[4].nazwa, "Chleb żytni");               produkty[4].cena = 8.0;
-    strcpy(produkty[5].nazwa, "Bagietka");                  produkty[5].cena = 9.0;
-    strcpy(produkty[6].nazwa, "Chleb na zakwasie");         produkty[6].cena = 10.0;
-    strcpy(produkty[7].nazwa, "Pieczywo bezglutenowe");     produkty[7].cena = 11.0;
-    strcpy(produkty[8].nazwa, "Pączek");                    produkty[8].cena = 2.0;
-    strcpy(produkty[9].nazwa, "Rogalik");                   produkty[9].cena = 12.0;
-    strcpy(produkty[10].nazwa, "Ciastko kruche");           produkty[10].cena = 1.0;
-    strcpy(produkty[11].nazwa, "Strucla");                  produkty[11].cena = 13.0;
-    strcpy(produkty[12].nazwa, "Zapiekanka");               produkty[12].cena = 14.0;
-    strcpy(produkty[13].nazwa, "Focaccia");                 produkty[13].cena = 15.0;
-    strcpy(produkty[14].nazwa, "Rogal świętomarciński");    produkty[14].cena = 16.0;
-
-    for (int i = 0; i < P; ++i) {
-        Ki[i] = 10 + (i % 5);     
-    }
-
     if (!validate_config(P, N, Tp, Tk, Ki, produkty)) {
         fprintf(stderr, "Błędna konfiguracja. Sprawdź P>10, N>0, Tp<Tk, Ki/prices.\n");
         return EXIT_FAILURE;
@@ -311,16 +804,15 @@ int main(int argc, char** argv) {
     IpcHandles h;
     memset(&h, 0, sizeof(h));
     h.shm_id = h.sem_id = -1;
-    for (int i = 0; i < CASHIERS; ++i) h.msg_id[i] = -1;
+    for (int i = 0; i < CASHIERS_MAX; ++i) h.msg_id[i] = -1;
 
-    ipc_create_or_die(&h, P);
+    ipc_create_or_die(&h, &shm_cfg);
 
     BakeryState* st = NULL;
     ipc_attach_or_die(&h, &st);
 
     /* Ustawic konfigurację w SHM */
     shm_lock(h.sem_id);
-    st->P = P;
     st->N = N;
     st->open_hour = Tp;
     st->close_hour = Tk;
@@ -328,74 +820,100 @@ int main(int argc, char** argv) {
     st->store_open = 1;
     st->evacuated = 0;
     st->inventory_mode = 0;
-    st->customers_in_store = 0;
+    st->conveyor_mode = g_conveyor_mode;
+    st->checkout_mode = g_checkout_mode;
+    st->cashier_batch = g_cashier_batch;
+    st->till_choice = g_till_choice;
+    st->bake_mode = g_bake_mode;
+    st->baker_count = g_bakers;
+    st->seed = g_seed;
+    checkout_init(st);
+    if (st->off_log_ring) log_ring_init(bakery_log_ring(st), g_log_records);
+    vclock_init(st, g_clock_speed, g_clock_start_ms >= 0 ? g_clock_start_ms : clock_local_ms_of_day());
 
     for (int i = 0; i < P; ++i) {
-        st->produkty[i] = produkty[i];
-        st->Ki[i] = Ki[i];
-        st->produced[i] = 0;
-        st->wasted[i] = 0;
-
-        st->conveyors[i].capacity = Ki[i];
-        st->conveyors[i].head = 0;
-        st->conveyors[i].tail = 0;
-        st->conveyors[i].count = 0;
-        /* items[] zostaje 0 */
+        *bakery_product(st, i) = produkty[i];
+        conveyor_init(st, i);
+        atomic_init(&bakery_baker_owner(st)[i], i % g_bakers);   /* shard piekarza: pid % B */
     }
 
-    for (int c = 0; c < CASHIERS; ++c) {
-        st->cashier_open[c] = 1;       /* albo 1 tylko dla kasy 0, jeśli chcesz min 1 na start */
-        st->cashier_accepting[c] = 1;  /* jw. */
-        st->cashier_queue_len[c] = 0;
-        for (int i = 0; i < P; ++i) st->sold_by_cashier[c][i] = 0;
+    for (int c = 0; c < st->cashier_count; ++c) {
+        st->cashiers[c].open = 1;       /* albo 1 tylko dla kasy 0, jeśli chcesz min 1 na start */
+        st->cashiers[c].accepting = 1;  /* jw. */
+        st->cashiers[c].queue_len = 0;
+        atomic_init(&st->cashiers[c].queue_work_ms, 0);
+        atomic_init(&st->cashiers[c].scan_end_ms, 0);
+        for (int i = 0; i < P; ++i) atomic_init(&bakery_sold(st, c)[i], 0);
     }
     shm_unlock(h.sem_id);
-    LOGF("kierownik", "Start symulacji: P=%d, N=%d, godziny %d-%d", P, N, Tp, Tk);
-    LOGF("kierownik", "IPC: shm_id=%d, sem_id=%d, msg=[%d,%d,%d]",
-        h.shm_id, h.sem_id, h.msg_id[0], h.msg_id[1], h.msg_id[2]);
+    control_publish(st);   /* stan startowy: migawki procesów zaczynają od tej generacji */
+    staffing_init(&g_staffing, g_policy);
+    LOGF("kierownik", "Start symulacji: P=%d, N=%d, godziny %d-%d, podajniki=%s, kasa=%s, partia=%d, polityka kas=%s, wybor kasy=%s, piekarz=%s, zegar x%.0f",
+         P, N, Tp, Tk, g_conveyor_mode == CONVEYOR_LOCKFREE ? "lockfree" : "sem",
+         g_checkout_mode == CHECKOUT_SHM ? "shm" : "mq", g_cashier_batch, staffing_policy_name(g_policy),
+         g_till_choice == TILL_WORK ? "work" : "queue", bake_mode_name(g_bake_mode), g_clock_speed);
+    LOGF("kierownik", "Ziarno losowania: --seed=%llu", (unsigned long long)g_seed);
+    LOGF("kierownik", "Segment SHM: %zu B (koszyk do %d pozycji, kas %d)", st->shm_size, st->basket_max,
+         st->cashier_count);
+    LOGF("kierownik", "IPC: shm_id=%d, sem_id=%d, msg=[%d..%d]",
+        h.shm_id, h.sem_id, h.msg_id[0], h.msg_id[st->cashier_count - 1]);
     
 
     /* Ustawic semafory: store slots = N, empty[i]=Ki[i] */
-    {
-        union semun arg;
-
-        arg.val = N;
-        CHECK_SYS(semctl(h.sem_id, SEM_STORE_SLOTS, SETVAL, arg), "semctl(SETVAL STORE_SLOTS)");
-
-        for (int i = 0; i < P; ++i) {
-            arg.val = Ki[i];
-            CHECK_SYS(semctl(h.sem_id, SEM_CONV_EMPTY(i), SETVAL, arg), "semctl(SETVAL EMPTY)");
-        }
+    sem_setval(h.sem_id, SEM_STORE_SLOTS, N);
+    for (int i = 0; i < P; ++i) {
+        sem_setval(h.sem_id, SEM_CONV_EMPTY(i), Ki[i]);
     }
 
     /* ====== Uruchom procesy ====== */
-    spawn_baker_or_die();
-    spawn_cashiers_or_die();
-    LOGF("kierownik", "Uruchomiono piekarza i %d kasjerow", CASHIERS);
+    if (st->off_log_ring) spawn_logdrain_or_die();
+    spawn_bakers_or_die(st->baker_count);
+    spawn_cashiers_or_die(st->cashier_count);
+    LOGF("kierownik", "Uruchomiono %d piekarzy i %d kasjerow", st->baker_count, st->cashier_count);
 
     /* Opcjonalny FIFO */
     int fifo_fd = ctrl_fifo_open_or_off();
 
     /* Inicjalizacja statystyk */
-    g_stats.start_time_ms = now_ms();
+    g_stats.start_time_ms = vclock_now_ms();
+    long long wall_start_us = lat_now_us();
     
     int max_clients = g_test_mode ? g_test_client_count : MAX_CLIENTS_TOTAL;
 
+    /* stress: przyjscia bez limitu (wejscie i tak ogranicza N) */
+    double rate = g_spawn_rate >= 0.0 ? g_spawn_rate : (g_stress_mode ? 0.0 : SPAWN_DEFAULT_RATE);
+    long long spawn_interval_ms = rate > 0.0 ? (long long)(1000.0 / rate) : 0;
+    long long spawn_retry_ms = (long long)(SPAWN_RETRY_MS * vclock_speed());
+    long long next_arrival_ms = -1;   /* tryb normalny: chwila nastepnego przyjscia, <0 = do wylosowania */
+    long long drain_start_us = -1;    /* test: wszyscy klienci utworzeni, czekamy na pusty sklep */
+    int drain_progress = -1;          /* ostatnio widziane decided - in_store (rosnie z kazdym wyjsciem) */
+
+    if (g_engine_threads > 0) {
+        g_launcher_pid = spawn_client_engine_or_die(max_clients, g_engine_threads, rate);
+        LOGF("kierownik", "Uruchomiono silnik klientow: %d klientow, %d watkow", max_clients, g_engine_threads);
+    } else if (g_zygote) {
+        g_launcher_pid = spawn_client_zygote_or_die(max_clients, rate);
+        LOGF("kierownik", "Uruchomiono zygote klientow: %d klientow, %.1f/s", max_clients, rate);
+    }
+    if (g_launcher_pid > 0) {
+        spawned_clients_total = max_clients;
+        g_stats.clients_spawned = max_clients;
+    }
+
     /* ====== Glowna petla symulacji ====== */
-    
-    while (!g_sig_term) {
-        /* Obsluga FIFO */
-        ctrl_fifo_poll(fifo_fd);
 
-        /* Zbieraj dzieci (zombie) */
-        reap_children_nonblocking();
+    /* Petla sterowana zdarzeniami: budzi ja sygnal, komenda FIFO albo najblizszy termin */
+    ManagerEvents ev;
+    events_open_or_die(&ev, &manager_sigs, fifo_fd);
 
+    while (!g_sig_term) {
         /* Obsluga sygnalow */
         if (g_sig_evac) {
             shm_lock(h.sem_id);
             st->evacuated = 1;
             st->store_open = 0;
             shm_unlock(h.sem_id);
+            publish_control(st, &h);
 
             /* Wyslij ewakuacje do grupy procesow */
             LOGF("kierownik", "EWAKUACJA! Wysylam sygnal do wszystkich procesow.");
@@ -412,16 +930,19 @@ int main(int argc, char** argv) {
             shm_lock(h.sem_id);
             st->inventory_mode = 1;
             shm_unlock(h.sem_id);
+            publish_control(st, &h);
             LOGF("kierownik", "INWENTARYZACJA: tryb wlaczony (klienci kupuja do zamkniecia).");
             g_sig_inv = 0;
         }
 
+        long long tnow = vclock_now_ms();
+
         /* W trybie testowym ignorujemy godziny */
         if (!g_test_mode) {
-            int hour = current_hour_local();
+            int hour = vclock_hour();
 
             if (hour < Tp) {
-                msleep(500);
+                events_wait(&ev, st, (long long)Tp * MS_PER_HOUR);
                 continue;
             }
 
@@ -429,26 +950,24 @@ int main(int argc, char** argv) {
                 shm_lock(h.sem_id);
                 st->store_open = 0;
                 shm_unlock(h.sem_id);
+                publish_control(st, &h);
                 LOGF("kierownik", "Zamkniecie sklepu (godzina=%d >= %d).", hour, Tk);
                 break;
             }
         }
 
         /* Polityka kas */
-        long long tnow = now_ms();
-        if (tnow - last_policy_ms >= 500) {
-            apply_cashier_policy(st, h.sem_id);
+        if (tnow - last_policy_ms >= POLICY_INTERVAL_MS) {
+            apply_cashier_policy(st, &h);
             last_policy_ms = tnow;
         }
 
-        /* Aktualizuj statystyki */
-        if (tnow - last_stats_ms >= 1000) {
-            shm_lock(h.sem_id);
-            int curr = st->customers_in_store;
+        /* Aktualizuj statystyki (suma shardow, bez SEM_SHM_GLOBAL) */
+        if (tnow - last_stats_ms >= STATS_INTERVAL_MS) {
+            int curr = stats_customers_in_store(st);
             if (curr > g_stats.max_concurrent) {
                 g_stats.max_concurrent = curr;
             }
-            shm_unlock(h.sem_id);
             
             if (g_test_mode && (spawned_clients_total % 100 == 0 || spawned_clients_total == max_clients)) {
                 LOGF("kierownik", "[STATS] Spawned=%d/%d, InStore=%d, MaxConcurrent=%d",
@@ -457,28 +976,76 @@ int main(int argc, char** argv) {
             last_stats_ms = tnow;
         }
 
-        /* Generacja klientow */
-        int should_spawn = g_test_mode ? 1 : (rand_between(0, 100) < 35);
+        /* Najblizszy termin petli (czas symulacji) */
+        long long wake_ms = last_policy_ms + POLICY_INTERVAL_MS;
+        if (last_stats_ms + STATS_INTERVAL_MS < wake_ms) wake_ms = last_stats_ms + STATS_INTERVAL_MS;
+        if (!g_test_mode && (long long)Tk * MS_PER_HOUR < wake_ms) wake_ms = (long long)Tk * MS_PER_HOUR;
+
+        /*
+         * Test po utworzeniu wszystkich klientow: petla dziala dalej (polityka kas,
+         * statystyki) az sklep sie oprozni - dopiero potem zamykanie kas.
+         */
+        if (drain_start_us >= 0) {
+            /* pusto na dobre: kazdy klient juz wszedl albo odszedl spod drzwi i nikt nie zostal w srodku */
+            int in_store = stats_customers_in_store(st);
+            int decided = stats_entries(st) + stats_rejected(st);
+            if (in_store == 0 && decided >= spawned_clients_total) break;
+            if (decided - in_store != drain_progress) {
+                drain_progress = decided - in_store;
+                drain_start_us = lat_now_us();
+            } else if (lat_now_us() - drain_start_us > DRAIN_STALL_MS * 1000LL) {
+                LOGF("kierownik", "TIMEOUT: %d klientow nadal w sklepie, zamykam.", in_store);
+                break;
+            }
+            long long poll_ms = tnow + (long long)(DRAIN_POLL_MS * vclock_speed());
+            events_wait(&ev, st, poll_ms < wake_ms ? poll_ms : wake_ms);
+            continue;
+        }
+
+        /* Generacja klientow (w trybie --engine/--zygote robi to osobny proces, koniec zglosi SIGCHLD) */
+        if (g_launcher_pid > 0) {
+            if (g_launcher_done) {
+                LOGF("kierownik", "Generator klientow zakonczyl prace (%d klientow).", max_clients);
+                if (!g_test_mode) break;
+                drain_start_us = lat_now_us();
+                continue;
+            }
+            events_wait(&ev, st, wake_ms);
+            continue;
+        }
+
+        if (!g_test_mode && next_arrival_ms < 0) next_arrival_ms = tnow + spawn_failed_draws() * spawn_retry_ms;
+        int should_spawn = g_test_mode ? 1 : tnow >= next_arrival_ms;
+        long long spawn_wake_ms = g_test_mode ? tnow + spawn_retry_ms : next_arrival_ms;
         if (should_spawn) {
-            long long t = now_ms();
+            long long t = vclock_now_ms();
+
+            /* rate limit: w tescie tyle klientow, ile wynika z tempa od startu */
+            int spawn_due = 1;
+            if (g_test_mode && rate > 0.0) {
+                spawn_due = (int)((t - g_stats.start_time_ms) * rate / 1000.0) + 1 - spawned_clients_total;
+            } else if (g_test_mode) {
+                spawn_due = max_clients - spawned_clients_total;
+            }
 
-            /* rate limit */
-            if (t - last_spawn_ms < SPAWN_COOLDOWN_MS) {
-                /* za szybko - pomijamy */
-            } else if (spawned_clients_total >= max_clients) {
+            if (spawned_clients_total >= max_clients) {
                 /* osiagnieto limit - zakonczmy test */
                 if (g_test_mode) {
-                    LOGF("kierownik", "Wygenerowano wszystkich %d klientow. Czekam na zakonczenie...", max_clients);
-                    break;
+                    LOGF("kierownik", "Wygenerowano wszystkich %d klientow. Czekam az zrobia zakupy (sklep nadal otwarty)...",
+                         max_clients);
+                    drain_start_us = lat_now_us();
+                    continue;
                 }
+            } else if (spawn_due <= 0 || (!g_test_mode && t - last_spawn_ms < spawn_interval_ms)) {
+                /* za szybko - pomijamy */
             } else {
                 /* Nie spawnuj po zamknieciu sklepu (lub po ewakuacji) */
                 shm_lock(h.sem_id);
                 int open_now = (st->store_open && !st->evacuated);
                 shm_unlock(h.sem_id);
 
-                if (open_now) {
-                    spawn_client_or_die();
+                for (int k = 0; open_now && k < spawn_due && spawned_clients_total < max_clients; ++k) {
+                    spawn_client_or_die(spawned_clients_total);
                     spawned_clients_total++;
                     g_stats.clients_spawned = spawned_clients_total;
                     last_spawn_ms = t;
@@ -489,46 +1056,45 @@ int main(int argc, char** argv) {
                     }
                 }
             }
+
+            /* Kolejny klient: w tescie wg tempa od startu (limit - od razu do konca petli) */
+            if (g_test_mode) {
+                if (spawned_clients_total >= max_clients) spawn_wake_ms = t;
+                else if (rate > 0.0) {
+                    spawn_wake_ms = g_stats.start_time_ms + (long long)(spawned_clients_total * 1000.0 / rate + 0.999);
+                }
+            } else {
+                /* tryb normalny: kolejne losowanie za SPAWN_RETRY_MS, najwczesniej po odstepie od ostatniego klienta */
+                long long first_draw_ms = t + spawn_retry_ms;
+                if (last_spawn_ms + spawn_interval_ms > first_draw_ms) first_draw_ms = last_spawn_ms + spawn_interval_ms;
+                next_arrival_ms = spawned_clients_total >= max_clients ? LLONG_MAX
+                                : first_draw_ms + spawn_failed_draws() * spawn_retry_ms;
+                spawn_wake_ms = next_arrival_ms;
+            }
         }
+        if (spawn_wake_ms < wake_ms) wake_ms = spawn_wake_ms;
 
-        msleep(g_stress_mode ? 1 : 10); /* glowna petla */
+        events_wait(&ev, st, wake_ms);
     }
+    events_close(&ev);
     
     /* ====== Faza zamykania ====== */
     
-    /* W trybie testowym poczekaj az klienci zrobia zakupy */
-    if (g_test_mode) {
-        LOGF("kierownik", "Czekam az klienci zrobia zakupy (sklep nadal otwarty)...");
-        int wait_shopping = 0;
-        while (wait_shopping < 50) { /* max 5 sekund */
-            shm_lock(h.sem_id);
-            int in_store = st->customers_in_store;
-            shm_unlock(h.sem_id);
-            if (in_store == 0) break;
-            msleep(100);
-            wait_shopping++;
-        }
-    }
-    
-    /* Zamknij sklep */
-    shm_lock(h.sem_id);
-    st->store_open = 0;
-    shm_unlock(h.sem_id);
-    
+    /* Zamknij sklep i kasy dla nowych klientow (kolejki sa domykane) */
     LOGF("kierownik", "Zamykanie kas dla nowych klientow (domykanie kolejek).");
     shm_lock(h.sem_id);
-    for (int i = 0; i < CASHIERS; ++i) {
-        st->cashier_accepting[i] = 0;
+    st->store_open = 0;
+    for (int i = 0; i < st->cashier_count; ++i) {
+        st->cashiers[i].accepting = 0;
     }
     shm_unlock(h.sem_id);
+    publish_control(st, &h);
 
     /* Czekaj az wszyscy klienci wyjda */
     int wait_counter = 0;
-    int max_wait = g_test_mode ? 600 : 300; /* max 60s lub 30s */
+    int max_wait = g_test_mode ? 600 : 300; /* max 60s lub 30s czasu rzeczywistego */
     while (wait_counter < max_wait) {
-        shm_lock(h.sem_id);
-        int in_store = st->customers_in_store;
-        shm_unlock(h.sem_id);
+        int in_store = stats_customers_in_store(st);
 
         if (in_store <= 0) break;
         
@@ -536,7 +1102,7 @@ int main(int argc, char** argv) {
             LOGF("kierownik", "Czekam na wyjscie klientow: %d pozostalo w sklepie", in_store);
         }
         
-        msleep(100);
+        msleep_real(100);
         wait_counter++;
     }
     
@@ -544,7 +1110,8 @@ int main(int argc, char** argv) {
         LOGF("kierownik", "TIMEOUT: Wymuszam zamkniecie (klienci mogli sie zablokowac)");
     }
 
-    g_stats.end_time_ms = now_ms();
+    g_stats.end_time_ms = vclock_now_ms();
+    long long wall_us = lat_now_us() - wall_start_us;
     LOGF("kierownik", "Wszyscy klienci opuscili sklep.");
 
     /* Inwentaryzacja kierownika: towar na podajnikach */
@@ -562,10 +1129,10 @@ int main(int argc, char** argv) {
         int total_on_conveyors = 0;
         shm_lock(h.sem_id);
         for (int i = 0; i < st->P; ++i) {
-            int on_conv = st->conveyors[i].count;
+            int on_conv = conveyor_count(st, i);
             if (on_conv > 0) {
                 fprintf(stdout, COLOR_KIEROWNIK "║" ANSI_RESET "  P%02d: %-30s %6d szt.        " COLOR_KIEROWNIK "║" ANSI_RESET "\n", 
-                        i, st->produkty[i].nazwa, on_conv);
+                        i, bakery_product(st, i)->nazwa, on_conv);
                 total_on_conveyors += on_conv;
             }
         }
@@ -591,21 +1158,16 @@ int main(int argc, char** argv) {
         int grand_total_items = 0;
         double grand_total_value = 0.0;
         
-        shm_lock(h.sem_id);
         for (int i = 0; i < st->P; ++i) {
-            int total_sold = 0;
-            for (int c = 0; c < CASHIERS; ++c) {
-                total_sold += st->sold_by_cashier[c][i];
-            }
+            int total_sold = stats_sold(st, i);
             if (total_sold > 0) {
-                double value = total_sold * st->produkty[i].cena;
+                double value = total_sold * bakery_product(st, i)->cena;
                 fprintf(stdout, COLOR_KIEROWNIK "║" ANSI_RESET "  P%02d: %-25s %4d × %6.2f = " ANSI_BOLD "%8.2f zł" ANSI_RESET " " COLOR_KIEROWNIK "║" ANSI_RESET "\n", 
-                        i, st->produkty[i].nazwa, total_sold, st->produkty[i].cena, value);
+                        i, bakery_product(st, i)->nazwa, total_sold, bakery_product(st, i)->cena, value);
                 grand_total_items += total_sold;
                 grand_total_value += value;
             }
         }
-        shm_unlock(h.sem_id);
         
         if (grand_total_items == 0) {
             fprintf(stdout, COLOR_KIEROWNIK "║" ANSI_RESET "  (brak sprzedazy)                                        " COLOR_KIEROWNIK "║" ANSI_RESET "\n");
@@ -619,22 +1181,31 @@ int main(int argc, char** argv) {
 
     /* Wyswietl statystyki testowe */
     if (g_test_mode) {
-        print_test_stats(st);
+        print_test_stats(st, &g_stats);
     }
 
-    /* Poczekaj na dzieci */
+    /* Poczekaj na dzieci (logdrain kończy po closing, resztę rekordów wypisuje kierownik) */
+    LogRing* log_ring = bakery_log_ring(st);
+    if (log_ring) atomic_store_explicit(&log_ring->closing, 1, memory_order_release);
     int status;
     int children_reaped = 0;
-    while (wait(&status) > 0) {
+    pid_t pid;
+    struct rusage ru;
+    while ((pid = wait4(-1, &status, 0, &ru)) > 0) {
+        account_child(pid, &ru);
         children_reaped++;
     }
+    if (log_ring) log_ring_drain(st, stdout);
     LOGF("kierownik", "Zakonczono %d procesow potomnych.", children_reaped);
+    if (g_report_path) write_run_report(st, wall_us);
 
     if (fifo_fd >= 0) close(fifo_fd);
     unlink(CTRL_FIFO_PATH);
 
     ipc_detach_or_die(st);
     ipc_destroy_or_die(&h, P);
+    free(produkty);
+    free(Ki);
 
     LOGF("kierownik", "Symulacja zakonczona pomyslnie.");
     return 0;
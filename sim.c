@@ -0,0 +1,653 @@
+#include "common.h"
+#include "latency.h"
+
+#include <getopt.h>
+#include <limits.h>
+
+/*
+ * sim.c – symulacja zdarzeniowa piekarni w jednym procesie (bez msleep).
+ *
+ * Piekarz, kasjerzy, klienci i polityka kierownika dzialaja wg tych samych regul
+ * co procesy ./baker, ./cashier, ./client i ./manager (czasy, partie, wybor kasy,
+ * cashier_policy_desired), ale czas jest wirtualny: kolejka priorytetowa zdarzen
+ * przeskakuje od razu do nastepnego zdarzenia. Caly dzien Tp-Tk z setkami tysiecy
+ * klientow liczy sie w sekundy. Raport w formacie print_test_stats.
+ *
+ * Użycie: sim [--rate=R] [--clients=N] [--open=Tp] [--close=Tk] [--store=N] [--products=P] [--ki=K]
+ *            [--cashiers=C] [--policy=threshold|ewma] [--till=work|queue] [--bake=random|demand] [--seed=S]
+ *   --rate=R      klientow na sekunde czasu symulowanego, w rownych odstepach
+ *                 jak ./manager test --rate (domyslnie 5)
+ *   --clients=N   limit klientow (domyslnie bez limitu - przychodza do zamkniecia)
+ *   --products=P  liczba produktow, --ki=K pojemnosc podajnikow (jak w ./manager)
+ *   --cashiers=C  liczba kas (jak w ./manager, domyslnie 3)
+ *   --policy=P    obsada kas jak w ./manager: threshold (domyslnie) albo ewma
+ *   --till=T      wybor kasy jak w ./manager: work (domyslnie) albo queue
+ *   --bake=B      harmonogram piekarza jak w ./manager: random (domyslnie) albo demand
+ *   --seed=S      ziarno losowania - ten sam S daje identyczny przebieg i raport
+ */
+
+#define SIM_DEFAULT_RATE     5.0
+#define SIM_POLICY_MS        500     /* jak petla kierownika */
+#define SIM_HOUR_MS          (3600LL * 1000LL)
+#define SIM_MAX_WANT         3       /* jak CLIENT_MAX_WANT: 2-3 rozne produkty */
+
+typedef enum SimEventType {
+    EV_ARRIVAL,          /* przychodzi kolejny klient */
+    EV_CLIENT,           /* nastepny krok klienta */
+    EV_CASHIER_DONE,     /* kasa skonczyla kasowanie */
+    EV_BAKER,            /* piekarz konczy przerwe - kolejny wypiek */
+    EV_POLICY,           /* polityka kas kierownika */
+    EV_CLOSE             /* godzina zamkniecia */
+} SimEventType;
+
+typedef struct SimEvent {
+    long long t;          /* ms od otwarcia */
+    unsigned long long seq; /* kolejnosc FIFO dla zdarzen o tym samym czasie */
+    int type;
+    int id;
+} SimEvent;
+
+typedef enum SimStage {
+    S_LOOK_AROUND,       /* wszedl - rozglada sie */
+    S_WALK,              /* idzie do podajnika */
+    S_REACH,             /* siega po towar */
+    S_AT_CASHIER,        /* w kolejce / przy kasie */
+    S_PACKING            /* pakuje i wychodzi */
+} SimStage;
+
+typedef struct SimClient {
+    int stage;
+    int want_count;
+    int picked;
+    int cur_pid;
+    int cur_qty;
+    int chosen[SIM_MAX_WANT]; /* wybrane produkty (bez powtorzen) */
+    int cashier;
+    long long stage_t;   /* poczatek etapu (przed sklepem / zakupy / kolejka do kasy) */
+    int next_free;       /* lista wolnych rekordow */
+    int item_count;
+    BasketItem items[SIM_MAX_WANT];
+} SimClient;
+
+/* Kolejka FIFO indeksow (rosnie w razie potrzeby) */
+typedef struct SimQueue {
+    int* buf;
+    int cap;
+    int head;
+    int n;
+} SimQueue;
+
+typedef struct Sim {
+    BakeryState* st;      /* lokalna kopia ukladu (konfiguracja, kasy, liczniki) - bez SHM */
+
+    SimEvent* heap;
+    int heap_n, heap_cap;
+    unsigned long long seq;
+    long long now;
+    unsigned long long events;
+
+    SimClient* clients;
+    int clients_cap;
+    int free_head;
+
+    int in_store;
+    /*
+     * Czekajacy przed wejsciem (SEM_STORE_SLOTS): kolejne przyjscia door_first..
+     * door_first+door_n-1. Chwile przyjscia wynikaja z numeru (arrival_ms), wiec
+     * rekord klienta powstaje dopiero przy wejsciu - przeciazenie nie zjada pamieci.
+     */
+    int door_first;
+    int door_n;
+    SimQueue cashier_q[CASHIERS_MAX]; /* kolejki komunikatow kas */
+    int cashier_busy[CASHIERS_MAX];
+    int cashier_client[CASHIERS_MAX];
+
+    int* conv_count;                 /* sztuk na podajniku [P] */
+
+    /* piekarz */
+    int baker_batches;               /* partie pozostale w biezacym cyklu */
+    int baker_pid;                   /* -1 albo produkt, na ktorego miejsce czeka */
+    int baker_need;
+    BakeDemand demand;               /* --bake=demand */
+
+    StaffingPolicy policy;
+    int spawned;
+    int max_clients;                 /* 0 = bez limitu */
+    double rate;
+    long long close_ms;
+
+    TestStats stats;
+} Sim;
+
+static void* xrealloc(void* p, size_t n) {
+    void* q = realloc(p, n);
+    if (!q) DIE_PERROR("realloc(sim)");
+    return q;
+}
+
+/* =========================
+ *  Kolejka zdarzen (kopiec min po (t, seq))
+ * ========================= */
+
+static int ev_less(const SimEvent* a, const SimEvent* b) {
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void ev_push(Sim* s, long long t, int type, int id) {
+    if (s->heap_n == s->heap_cap) {
+        s->heap_cap = s->heap_cap ? s->heap_cap * 2 : 1024;
+        s->heap = xrealloc(s->heap, sizeof(SimEvent) * (size_t)s->heap_cap);
+    }
+    SimEvent e = { t, s->seq++, type, id };
+    int i = s->heap_n++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!ev_less(&e, &s->heap[parent])) break;
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = e;
+}
+
+static SimEvent ev_pop(Sim* s) {
+    SimEvent top = s->heap[0];
+    SimEvent last = s->heap[--s->heap_n];
+    int i = 0;
+    for (;;) {
+        int l = 2 * i + 1;
+        if (l >= s->heap_n) break;
+        int m = (l + 1 < s->heap_n && ev_less(&s->heap[l + 1], &s->heap[l])) ? l + 1 : l;
+        if (!ev_less(&s->heap[m], &last)) break;
+        s->heap[i] = s->heap[m];
+        i = m;
+    }
+    if (s->heap_n > 0) s->heap[i] = last;
+    return top;
+}
+
+/* =========================
+ *  Kolejki FIFO
+ * ========================= */
+
+static void q_push(SimQueue* q, int v) {
+    if (q->n == q->cap) {
+        int ncap = q->cap ? q->cap * 2 : 64;
+        int* nbuf = xrealloc(NULL, sizeof(int) * (size_t)ncap);
+        for (int i = 0; i < q->n; ++i) nbuf[i] = q->buf[(q->head + i) % q->cap];
+        free(q->buf);
+        q->buf = nbuf;
+        q->cap = ncap;
+        q->head = 0;
+    }
+    q->buf[(q->head + q->n) % q->cap] = v;
+    q->n++;
+}
+
+static int q_pop(SimQueue* q) {
+    int v = q->buf[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->n--;
+    return v;
+}
+
+/* =========================
+ *  Klienci
+ * ========================= */
+
+static int client_alloc(Sim* s) {
+    if (s->free_head == -1) {
+        int old = s->clients_cap;
+        s->clients_cap = old ? old * 2 : 256;
+        s->clients = xrealloc(s->clients, sizeof(SimClient) * (size_t)s->clients_cap);
+        for (int i = old; i < s->clients_cap; ++i) s->clients[i].next_free = i + 1 < s->clients_cap ? i + 1 : -1;
+        s->free_head = old;
+    }
+    int id = s->free_head;
+    s->free_head = s->clients[id].next_free;
+    memset(&s->clients[id], 0, sizeof(SimClient));
+    return id;
+}
+
+static void client_free(Sim* s, int id) {
+    s->clients[id].next_free = s->free_head;
+    s->free_head = id;
+}
+
+static void client_enter(Sim* s, int id) {
+    s->in_store++;
+    if (s->in_store > s->stats.max_concurrent) s->stats.max_concurrent = s->in_store;
+    s->stats.clients_entered++;
+    lat_record(s->st, LAT_DOOR, -1, (s->now - s->clients[id].stage_t) * 1000);
+    s->clients[id].stage_t = s->now;
+    s->clients[id].stage = S_LOOK_AROUND;
+    ev_push(s, s->now + rand_between(500, 1000), EV_CLIENT, id);
+}
+
+static void on_close(Sim* s);
+
+/* Chwila przyjscia k-tego klienta (ms od otwarcia) - rowne odstepy 1000/rate */
+static long long arrival_ms(const Sim* s, int k) {
+    return (long long)(k * 1000.0 / s->rate);
+}
+
+/* Wyjscie: zwalnia miejsce (sem_V SEM_STORE_SLOTS) - wchodzi pierwszy czekajacy */
+static void client_leave(Sim* s, int id) {
+    s->in_store--;
+    s->stats.clients_completed++;
+    s->stats.end_time_ms = s->now;
+    client_free(s, id);
+    if (s->door_n > 0) {
+        int next = client_alloc(s);
+        s->clients[next].stage_t = arrival_ms(s, s->door_first);
+        s->door_first++;
+        s->door_n--;
+        client_enter(s, next);
+    }
+
+    /* jak test kierownika: po ostatnim z --clients=N sklep sie zamyka */
+    if (s->max_clients > 0 && s->stats.clients_completed == s->max_clients) on_close(s);
+}
+
+static void baker_try_resume(Sim* s);
+
+static void client_take(Sim* s, SimClient* c) {
+    int pid = c->cur_pid;
+    int bought = c->cur_qty < s->conv_count[pid] ? c->cur_qty : s->conv_count[pid];
+    s->conv_count[pid] -= bought;
+    if (bought == 0) bakery_stockouts(s->st, 0)[pid]++;
+    if (bought < c->cur_qty) bakery_lost(s->st, 0)[pid] += c->cur_qty - bought;
+    if (bought > 0 && c->item_count < s->st->basket_max) {
+        c->items[c->item_count].product_id = pid;
+        c->items[c->item_count].quantity = bought;
+        c->item_count++;
+    }
+    if (bought > 0 && s->baker_pid == pid) baker_try_resume(s);
+}
+
+static void cashier_start(Sim* s, int cashier) {
+    if (s->cashier_busy[cashier] || s->cashier_q[cashier].n == 0) return;
+    int id = q_pop(&s->cashier_q[cashier]);
+    s->cashier_busy[cashier] = 1;
+    s->cashier_client[cashier] = id;
+    /* Ksiegowanie przy odbiorze koszyka, potem czas kasowania (jak process_sale) */
+    SimClient* c = &s->clients[id];
+    for (int i = 0; i < c->item_count; ++i) {
+        bakery_sold(s->st, cashier)[c->items[i].product_id] += c->items[i].quantity;
+    }
+    int scan_ms = basket_scan_ms(c->item_count);
+    CashierBlock* cb = &s->st->cashiers[cashier];
+    atomic_fetch_sub_explicit(&cb->queue_work_ms, scan_ms, memory_order_relaxed);
+    atomic_store_explicit(&cb->scan_end_ms, s->now + scan_ms, memory_order_relaxed);
+    lat_record(s->st, LAT_TILL_QUEUE, cashier, (s->now - c->stage_t) * 1000);
+    lat_record(s->st, LAT_TILL_SCAN, cashier, scan_ms * 1000LL);
+    ev_push(s, s->now + scan_ms, EV_CASHIER_DONE, cashier);
+}
+
+static void client_checkout(Sim* s, int id) {
+    BakeryState* st = s->st;
+    SimClient* c = &s->clients[id];
+    int cashier = cashier_choose(st, id, s->now);
+    lat_record(st, LAT_SHOPPING, -1, (s->now - c->stage_t) * 1000);
+
+    if (c->item_count <= 0) { client_leave(s, id); return; }
+
+    int ok = st->cashiers[cashier].open && st->cashiers[cashier].accepting && st->store_open;
+    if (!ok) { client_leave(s, id); return; }
+
+    cashier_queue_join(st, cashier, c->item_count);
+    c->cashier = cashier;
+    c->stage = S_AT_CASHIER;
+    c->stage_t = s->now;
+    q_push(&s->cashier_q[cashier], id);
+    cashier_start(s, cashier);
+}
+
+static void client_step(Sim* s, int id) {
+    SimClient* c = &s->clients[id];
+    switch (c->stage) {
+    case S_LOOK_AROUND:
+        c->want_count = 2 + (rand_between(0, 100) < 40 ? 1 : 0);
+        c->picked = 0;
+        c->stage = S_WALK;
+        /* fall through */
+    case S_WALK:
+        if (c->picked >= c->want_count) {
+            client_checkout(s, id);
+            return;
+        }
+        c->stage = S_REACH;
+        ev_push(s, s->now + rand_between(50, 150), EV_CLIENT, id);
+        return;
+    case S_REACH: {
+        if (c->cur_qty == 0) {
+            int pid;
+            int dup;
+            do {
+                pid = rand_between(0, s->st->P - 1);
+                dup = 0;
+                for (int i = 0; i < c->picked; ++i) dup |= c->chosen[i] == pid;
+            } while (dup);
+            c->chosen[c->picked] = pid;
+            c->cur_pid = pid;
+            c->cur_qty = rand_between(1, 3);
+            ev_push(s, s->now + rand_between(50, 150), EV_CLIENT, id);
+            return;
+        }
+        client_take(s, c);
+        c->cur_qty = 0;
+        c->picked++;
+        c->stage = S_WALK;
+        client_step(s, id);
+        return;
+    }
+    case S_PACKING:
+        client_leave(s, id);
+        return;
+    default:
+        return;
+    }
+}
+
+static void on_arrival(Sim* s) {
+    if (!s->st->store_open) return;
+    if (s->max_clients > 0 && s->spawned >= s->max_clients) return;
+
+    int k = s->spawned++;
+    s->stats.clients_spawned = s->spawned;
+    if (s->in_store < s->st->N) {
+        int id = client_alloc(s);
+        s->clients[id].stage_t = s->now;
+        client_enter(s, id);
+    } else {
+        if (s->door_n == 0) s->door_first = k;
+        s->door_n++;
+    }
+
+    /*
+     * Rowne odstepy jak w ./manager test --rate (fork+execv, zygota, silnik):
+     * k-ty klient w chwili arrival_ms(k) = k*1000/rate od otwarcia, wiec zaokraglenie
+     * do ms nie kumuluje sie, a rate > 1000/s daje kilku klientow na ms.
+     * Tryb normalny kierownika losuje przyjscie co 10 ms czasu rzeczywistego,
+     * wiec jego rozklad zalezy od --speed - sim go nie odtwarza.
+     */
+    if (s->max_clients == 0 || s->spawned < s->max_clients) {
+        ev_push(s, arrival_ms(s, s->spawned), EV_ARRIVAL, 0);
+    }
+}
+
+static void on_cashier_done(Sim* s, int cashier) {
+    int id = s->cashier_client[cashier];
+    lat_record(s->st, LAT_CHECKOUT, -1, (s->now - s->clients[id].stage_t) * 1000);
+    s->cashier_busy[cashier] = 0;
+    if (s->st->cashiers[cashier].queue_len > 0) s->st->cashiers[cashier].queue_len--;
+    atomic_store_explicit(&s->st->cashiers[cashier].scan_end_ms, 0, memory_order_relaxed);
+    s->clients[id].stage = S_PACKING;
+    ev_push(s, s->now + rand_between(200, 400), EV_CLIENT, id);
+    cashier_start(s, cashier);
+}
+
+/* =========================
+ *  Piekarz
+ * ========================= */
+
+/* --bake=demand: produkt o najwiekszym niedoborze z miejscem na partie (jak pick_product), inaczej najpilniejszy */
+static int baker_pick_demand(Sim* s, int qty) {
+    int P = s->st->P;
+    int first = rand_between(0, P - 1);
+    int best = -1, best_room = 0;
+    double best_score = 0.0;
+    for (int k = 0; k < P; ++k) {
+        int pid = (first + k) % P;
+        int room = s->conv_count[pid] + qty <= bakery_conveyor(s->st, pid)->capacity;
+        double score = bake_demand_score(&s->demand, pid, s->conv_count[pid]);
+        if (best == -1 || room > best_room || (room == best_room && score > best_score)) {
+            best = pid;
+            best_room = room;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+/* Partie biezacego cyklu; blokuje sie (jak conveyor_push_n) gdy brak miejsca na cala partie */
+static void baker_run(Sim* s) {
+    while (s->baker_batches > 0) {
+        int qty, pid;
+        if (s->st->bake_mode == BAKE_DEMAND) {
+            qty = rand_between(1, 5);
+            pid = baker_pick_demand(s, qty);
+        } else {
+            pid = rand_between(0, s->st->P - 1);
+            qty = rand_between(1, 5);
+        }
+        s->baker_batches--;
+        Conveyor* cv = bakery_conveyor(s->st, pid);
+        if (s->conv_count[pid] + qty > cv->capacity) {
+            s->baker_pid = pid;
+            s->baker_need = qty;
+            return;
+        }
+        s->conv_count[pid] += qty;
+        cv->produced += qty;
+    }
+    ev_push(s, s->now + rand_between(100, 300), EV_BAKER, 0);
+}
+
+static void baker_try_resume(Sim* s) {
+    int pid = s->baker_pid;
+    Conveyor* cv = bakery_conveyor(s->st, pid);
+    if (s->conv_count[pid] + s->baker_need > cv->capacity) return;
+    s->conv_count[pid] += s->baker_need;
+    cv->produced += s->baker_need;
+    s->baker_pid = -1;
+    if (s->st->store_open) baker_run(s);
+}
+
+static void on_baker(Sim* s) {
+    if (!s->st->store_open) return;
+    s->baker_batches = rand_between(1, 4);
+    if (s->st->bake_mode == BAKE_DEMAND) bake_demand_update(&s->demand, s->st, s->conv_count, s->now);
+    baker_run(s);
+}
+
+/* =========================
+ *  Kierownik
+ * ========================= */
+
+static void on_policy(Sim* s) {
+    BakeryState* st = s->st;
+    if (!st->store_open) return;
+    int want = staffing_desired(&s->policy, st, s->in_store, s->now);
+    for (int i = 0; i < st->cashier_count; ++i) {
+        st->cashiers[i].open = 1;
+        st->cashiers[i].accepting = i < want;
+    }
+    ev_push(s, s->now + SIM_POLICY_MS, EV_POLICY, 0);
+}
+
+static void on_close(Sim* s) {
+    BakeryState* st = s->st;
+    st->store_open = 0;
+    for (int i = 0; i < st->cashier_count; ++i) st->cashiers[i].accepting = 0;
+    /* czekajacy przed wejsciem rezygnuja */
+    s->door_n = 0;
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    Sim s;
+    memset(&s, 0, sizeof(s));
+    s.rate = SIM_DEFAULT_RATE;
+    int Tp = 6, Tk = 22, N = 30;
+    int P = DEFAULT_P, ki = 0, cashiers = DEFAULT_CASHIERS, policy = POLICY_THRESHOLD;
+    int till = TILL_WORK, bake = BAKE_RANDOM;
+    uint64_t seed = rng_time_seed();
+
+    static const struct option long_opts[] = {
+        { "rate",    required_argument, NULL, 'r' },
+        { "clients", required_argument, NULL, 'n' },
+        { "open",    required_argument, NULL, 'o' },
+        { "close",   required_argument, NULL, 'c' },
+        { "store",   required_argument, NULL, 's' },
+        { "products", required_argument, NULL, 'p' },
+        { "ki",      required_argument, NULL, 'k' },
+        { "cashiers", required_argument, NULL, 'C' },
+        { "policy",  required_argument, NULL, 'O' },
+        { "till",    required_argument, NULL, 'T' },
+        { "bake",    required_argument, NULL, 'B' },
+        { "seed",    required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'r': s.rate = atof(optarg); break;
+        case 'n': s.max_clients = atoi(optarg); break;
+        case 'o': Tp = atoi(optarg); break;
+        case 'c': Tk = atoi(optarg); break;
+        case 's': N = atoi(optarg); break;
+        case 'p': P = atoi(optarg); break;
+        case 'k': ki = atoi(optarg); break;
+        case 'C': cashiers = atoi(optarg); break;
+        case 'O':
+            policy = staffing_policy_parse(optarg);
+            if (policy < 0) {
+                fprintf(stderr, "Nieznana polityka kas: %s (threshold|ewma)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            if (strcmp(optarg, "work") == 0) till = TILL_WORK;
+            else if (strcmp(optarg, "queue") == 0) till = TILL_QUEUE;
+            else {
+                fprintf(stderr, "Nieznany wybor kasy: %s (work|queue)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'B':
+            bake = bake_mode_parse(optarg);
+            if (bake < 0) {
+                fprintf(stderr, "Nieznany harmonogram piekarza: %s (random|demand)\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S': seed = strtoull(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Użycie: %s [--rate=R] [--clients=N] [--open=Tp] [--close=Tk] [--store=N]"
+                            " [--products=P] [--ki=K] [--cashiers=C] [--policy=threshold|ewma] [--till=work|queue]"
+                            " [--bake=random|demand] [--seed=S]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (P < 10 || P > P_LIMIT || ki < 0 || cashiers < CASHIERS_MIN || cashiers > CASHIERS_MAX) {
+        fprintf(stderr, "Błędna konfiguracja. Sprawdź --products=10..%d, --ki>0, --cashiers=%d..%d.\n",
+                P_LIMIT, CASHIERS_MIN, CASHIERS_MAX);
+        return EXIT_FAILURE;
+    }
+    Product* produkty = calloc((size_t)P, sizeof(Product));
+    int* Ki = calloc((size_t)P, sizeof(int));
+    s.conv_count = calloc((size_t)P, sizeof(int));
+    if (!produkty || !Ki || !s.conv_count) DIE_PERROR("calloc(sim)");
+    bakery_default_products(produkty, Ki, P, ki);
+    if (s.rate <= 0.0 || s.max_clients < 0 || !validate_config(P, N, Tp, Tk, Ki, produkty)) {
+        fprintf(stderr, "Błędna konfiguracja. Sprawdź --rate>0, N>0, Tp<Tk.\n");
+        return EXIT_FAILURE;
+    }
+    /* numery przyjsc (int) calego dnia przy tym tempie */
+    if (s.max_clients == 0 && s.rate * (double)(Tk - Tp) * 3600.0 >= (double)INT_MAX) {
+        fprintf(stderr, "--rate=%g: za duzo klientow na dzien %d-%d (podaj --clients).\n", s.rate, Tp, Tk);
+        return EXIT_FAILURE;
+    }
+
+    rng_thread_seed(rng_derive(seed, RNG_ROLE_MANAGER, 0));
+
+    /* Lokalny BakeryState w układzie segmentu: te same funkcje statystyk i wyboru kasy co w SHM */
+    ShmConfig cfg = { P, Ki, DEFAULT_BASKET_ITEMS, cashiers, CHECKOUT_MQ, 0, 0 };
+    BakeryState* st = calloc(1, bakery_layout(NULL, &cfg));
+    if (!st) DIE_PERROR("calloc(BakeryState)");
+    bakery_layout(st, &cfg);
+    st->N = N;
+    st->open_hour = Tp;
+    st->close_hour = Tk;
+    st->store_open = 1;
+    st->till_choice = till;
+    st->bake_mode = bake;
+    for (int i = 0; i < P; ++i) *bakery_product(st, i) = produkty[i];
+    for (int c = 0; c < cashiers; ++c) {
+        st->cashiers[c].open = 1;
+        st->cashiers[c].accepting = 1;
+    }
+    s.st = st;
+    s.free_head = -1;
+    s.baker_pid = -1;
+    bake_demand_init(&s.demand, P);
+    staffing_init(&s.policy, policy);
+    s.close_ms = (long long)(Tk - Tp) * SIM_HOUR_MS;
+
+    LOGF("kierownik", "Symulacja zdarzeniowa: P=%d, N=%d, kas=%d, polityka kas=%s, piekarz=%s, godziny %d-%d, %.1f klientow/s%s, --seed=%llu",
+         P, N, cashiers, staffing_policy_name(policy), bake_mode_name(bake), Tp, Tk, s.rate, s.max_clients ? "" : " (do zamkniecia)",
+         (unsigned long long)seed);
+
+    /* Rozgrzewka piekarza: 3 rundy po 2-4 sztuki kazdego produktu (do pojemnosci) */
+    for (int warmup = 0; warmup < 3; ++warmup) {
+        for (int pid = 0; pid < P; ++pid) {
+            int qty = rand_between(2, 4);
+            int room = Ki[pid] - s.conv_count[pid];
+            int k = qty < room ? qty : room;
+            s.conv_count[pid] += k;
+            bakery_conveyor(st, pid)->produced += k;
+        }
+    }
+
+    struct timespec w0, w1;
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &w0), "clock_gettime");
+
+    ev_push(&s, 0, EV_POLICY, 0);
+    ev_push(&s, 0, EV_BAKER, 0);
+    ev_push(&s, 0, EV_ARRIVAL, 0);
+    ev_push(&s, s.close_ms, EV_CLOSE, 0);
+
+    int last_hour = 0;
+    while (s.heap_n > 0) {
+        SimEvent e = ev_pop(&s);
+        if (!st->store_open && e.type != EV_CLIENT && e.type != EV_CASHIER_DONE) continue;
+        s.now = e.t;
+        s.events++;
+
+        int hour = (int)(s.now / SIM_HOUR_MS);
+        if (hour != last_hour && s.now < s.close_ms) {
+            LOGF("kierownik", "[%02d:00] klientow=%d, w sklepie=%d, przed wejsciem=%d",
+                 Tp + hour, s.spawned, s.in_store, s.door_n);
+            last_hour = hour;
+        }
+
+        switch (e.type) {
+        case EV_ARRIVAL:      on_arrival(&s); break;
+        case EV_CLIENT:       client_step(&s, e.id); break;
+        case EV_CASHIER_DONE: on_cashier_done(&s, e.id); break;
+        case EV_BAKER:        on_baker(&s); break;
+        case EV_POLICY:       on_policy(&s); break;
+        case EV_CLOSE:        on_close(&s); break;
+        }
+    }
+
+    CHECK_SYS(clock_gettime(CLOCK_MONOTONIC, &w1), "clock_gettime");
+    long long wall_ms = (w1.tv_sec - w0.tv_sec) * 1000LL + (w1.tv_nsec - w0.tv_nsec) / 1000000LL;
+
+    s.stats.start_time_ms = 0;
+    print_test_stats(st, &s.stats);
+    LOGF("kierownik", "Obsluzono %d klientow, %llu zdarzen, czas rzeczywisty %lld ms",
+         s.stats.clients_completed, s.events, wall_ms);
+
+    free(s.heap);
+    free(s.clients);
+    for (int c = 0; c < cashiers; ++c) free(s.cashier_q[c].buf);
+    free(s.conv_count);
+    bake_demand_free(&s.demand);
+    free(produkty);
+    free(Ki);
+    free(st);
+    return 0;
+}